@@ -35,6 +35,17 @@
 
 // System
 #include <cstring>
+#include <cstddef>
+
+
+/*! \brief Maximum number of data bytes a packet can hold
+
+  32 bytes of CRTP payload plus the header byte, which replies
+  carry in front of their payload until it is decoded. */
+#define CRTP_MAX_DATA_LENGTH 33
+
+
+class CCRTPPacketPool;
 
 
 /*! \brief Class to hold and process communication-related data for
@@ -42,12 +53,10 @@
 class CCRTPPacket {
  private:
   // Variables
-  /*! \brief Internal storage pointer for payload data inside the
-    packet
+  /*! \brief Internal storage for payload data inside the packet
 
-    This data is freed when either new data is set or the class
-    instance is destroyed.*/
-  char *m_cData;
+    Payload is stored inline, so setting data never allocates. */
+  char m_cData[CRTP_MAX_DATA_LENGTH];
   /*! \brief The length of the data pointed to by m_cData */
   int m_nDataLength;
   /*! \brief The copter port the packet will be delivered to */
@@ -62,8 +71,8 @@ class CCRTPPacket {
     The function clearData() should be called before this if it is
     used outside of the constructor. */
   void basicSetup();
-  /*! \brief Deletes the internally stored data and resets the data
-    length and the pointer to zero */
+  /*! \brief Resets the length of the internally stored data to
+    zero */
   void clearData();
 
  public:
@@ -95,9 +104,24 @@ class CCRTPPacket {
     stored. */
   ~CCRTPPacket();
 
+  /*! \brief Allocates a packet from the heap */
+  static void *operator new(std::size_t szSize);
+  /*! \brief Allocates a packet from the given pool
+
+    Use as `new(ppPool) CCRTPPacket(...)`. Packets allocated this way
+    are deleted as usual and return to their pool then.
+
+    \param ppPool Pool to take the packet from; NULL allocates from
+    the heap */
+  static void *operator new(std::size_t szSize, CCRTPPacketPool *ppPool);
+  static void operator delete(void *vdPacket);
+  static void operator delete(void *vdPacket, CCRTPPacketPool *ppPool);
+
   /*! \brief Copies the given data of the specified length to the
     internal storage.
 
+    Data beyond CRTP_MAX_DATA_LENGTH bytes is cut off.
+
     \param cData Pointer pointing to the data that should be used as
     payload
     \param nDataLength Length (in bytes) of the data that should be
@@ -117,6 +141,16 @@ class CCRTPPacket {
     \return Returns the number of bytes stored as payload data */
   int dataLength();
 
+  /*! \brief Writes the sendable block of data into the given buffer
+
+    Writes the same block of data sendableData() returns, but without
+    allocating. Used by the transports to encode packets straight
+    into their transfer buffers.
+
+    \param cBuffer Buffer to write to; must hold at least
+    sendableDataLength() bytes
+    \return Number of bytes written */
+  int writeSendableData(char *cBuffer);
   /*! \brief Prepares a sendable block of data based on the
       CCRTPPacket details
 
@@ -0,0 +1,131 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_CRTP_PACKET_POOL_H__
+#define __C_CRTP_PACKET_POOL_H__
+
+
+// System
+#include <cstddef>
+#include <mutex>
+
+
+/*! \brief Number of packets a pool holds ready right from the start */
+#define CRTP_PACKET_POOL_INITIAL_SIZE 16
+
+
+/*! \brief Free-list of CCRTPPacket instances
+
+  Allocating a packet through a pool (`new(ppPool) CCRTPPacket(...)`)
+  takes a block from the pool's free list; deleting it puts the block
+  back. Once a pool has grown to the number of packets in flight at
+  the same time, sending and receiving doesn't touch the heap
+  anymore. Every transport owns one pool (see
+  CTransport::packetPool()).
+
+  Packets remember the pool they came from, so they are deleted as
+  usual, from any thread. A pool stays alive until its owner
+  released it and the last of its packets was deleted. */
+class CCRTPPacketPool {
+ private:
+  /*! \brief Header placed in front of every packet allocated through
+      CCRTPPacket's operator new */
+  struct alignas(std::max_align_t) BlockHeader {
+    /*! \brief The pool the block belongs to, or NULL for blocks
+	taken from the heap directly */
+    CCRTPPacketPool *ppPool;
+    /*! \brief Next free block while the block is in the free list */
+    BlockHeader *bhNext;
+  };
+
+  // Variables
+  std::mutex m_mtxPool;
+  /*! \brief First block of the free list */
+  BlockHeader *m_bhFree;
+  /*! \brief Number of blocks this pool ever allocated */
+  unsigned int m_unBlocks;
+  /*! \brief Number of packets currently handed out */
+  unsigned int m_unOutstanding;
+  /*! \brief Whether the owner released the pool */
+  bool m_bReleased;
+
+  // Functions
+  ~CCRTPPacketPool();
+
+  static BlockHeader *newBlock();
+  void *take();
+  /*! \brief Returns a block to the pool
+
+    \return Returns 'true' if the pool must be deleted now */
+  bool give(BlockHeader *bhBlock);
+
+ public:
+  /*! \brief Constructor for the packet pool
+
+    \param unInitialSize Number of packets to allocate right away */
+  CCRTPPacketPool(unsigned int unInitialSize = CRTP_PACKET_POOL_INITIAL_SIZE);
+
+  /*! \brief Gives up the owner's reference to the pool
+
+    Must be called instead of deleting the pool. The pool is deleted
+    as soon as no packet allocated from it exists anymore. */
+  void release();
+
+  /*! \brief Number of packet blocks the pool allocated from the heap
+      so far
+
+    Stays constant during steady-state operation. */
+  unsigned int blocksAllocated();
+  /*! \brief Number of packets from this pool currently in use */
+  unsigned int packetsInUse();
+
+  /*! \brief Allocates memory for a packet
+
+    Used by CCRTPPacket's operators new.
+
+    \param ppPool Pool to take the memory from, or NULL to allocate
+    from the heap
+    \param szSize Size requested by operator new
+    \return Memory for the packet */
+  static void *allocate(CCRTPPacketPool *ppPool, std::size_t szSize);
+  /*! \brief Frees memory obtained through allocate()
+
+    Used by CCRTPPacket's operator delete. Returns the memory to the
+    pool it came from.
+
+    \param vdMemory The memory to free */
+  static void deallocate(void *vdMemory);
+};
+
+
+#endif /* __C_CRTP_PACKET_POOL_H__ */
@@ -0,0 +1,129 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_CRTP_VIEW_H__
+#define __C_CRTP_VIEW_H__
+
+
+// Private
+#include "CCRTPPacket.h"
+#include "CCRTPPacketPool.h"
+
+
+/*! \brief Non-owning view of a received CRTP frame
+
+  Points into a transport's receive buffer and decodes header and
+  payload on access. A view is only valid until the transport
+  receives its next frame; consumers that want to keep the data
+  must copy() it. */
+class CCRTPView {
+ private:
+  // Variables
+  /*! \brief The frame, starting with the CRTP header byte */
+  const char *m_cData;
+  /*! \brief Length of the frame including the header byte */
+  int m_nLength;
+  /*! \brief When the frame was received, 0 if not recorded */
+  double m_dReceived;
+
+ public:
+  /*! \brief Constructor for an empty view */
+  CCRTPView();
+  /*! \brief Constructor for a view of the given frame
+
+    \param cData Frame data, starting with the CRTP header byte
+    \param nLength Length of the frame including the header byte */
+  CCRTPView(const char *cData, int nLength);
+
+  /*! \brief Points the view to another frame
+
+    Clears the receive time. */
+  void set(const char *cData, int nLength);
+  /*! \brief Records when the frame was received
+
+    \param dReceived Seconds on CLOCK_MONOTONIC */
+  void setReceiveTime(double dReceived);
+  /*! \brief When the frame was received, in seconds on
+      CLOCK_MONOTONIC
+
+    Set for frames that were kept before being consumed (see
+    CLogFrameRing); 0 for frames consumed right as they arrive. */
+  double receiveTime() const;
+
+  /*! \brief The frame data, starting with the CRTP header byte */
+  const char *data() const;
+  /*! \brief Length of the frame including the header byte */
+  int dataLength() const;
+  /*! \brief Whether the frame is empty (an ACK without data) */
+  bool empty() const;
+
+  /*! \brief The port the frame came from */
+  int port() const;
+  /*! \brief The channel the frame came from */
+  int channel() const;
+
+  /*! \brief The payload behind the header byte */
+  const char *payload() const;
+  /*! \brief Length of the payload behind the header byte */
+  int payloadLength() const;
+
+  /*! \brief Copies the frame into a packet of its own
+
+    The packet holds the whole frame (header byte included) with
+    port and channel set, just like the packets returned by
+    CTransport::sendPacket().
+
+    \param ppPool Pool to allocate the packet from, or NULL for the
+    heap
+    \return The new packet, to be deleted by the caller */
+  CCRTPPacket *copy(CCRTPPacketPool *ppPool = NULL) const;
+};
+
+
+/*! \brief Interface for classes decoding received frames directly
+
+  A consumer registered with a transport (see
+  CTransport::setLoggingConsumer()) is handed received frames as
+  views, so they can be decoded without copying them first. */
+class CCRTPConsumer {
+ public:
+  virtual ~CCRTPConsumer() {}
+
+  /*! \brief Called for every frame of interest received
+
+    \param cvFrame View of the frame, valid during the call only */
+  virtual void consumeFrame(const CCRTPView &cvFrame) = 0;
+};
+
+
+#endif /* __C_CRTP_VIEW_H__ */
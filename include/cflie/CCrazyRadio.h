@@ -35,16 +35,26 @@
 
 // System
 #include <list>
+#include <deque>
+#include <vector>
 #include <string>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 #include <libusb-1.0/libusb.h>
 #include <unistd.h>
 #include <iostream>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 // Private
 #include "CCRTPPacket.h"
+#include "CTransport.h"
+#include "CRadioRegistry.h"
 
 
 /*! \brief Power levels to configure the radio dongle with */
@@ -60,6 +70,85 @@ enum Power {
 };
 
 
+/*! \brief Size of the USB buffers used for bulk transfers to and
+    from the dongle */
+#define RADIO_USB_BUFFER_SIZE 64
+/*! \brief First dongle version (Crazyradio 2.0) that supports
+    inline radio settings */
+#define RADIO_INLINE_SETTINGS_VERSION 5.0
+/*! \brief Size of the settings header in front of every packet in
+    inline settings mode */
+#define RADIO_INLINE_HEADER_SIZE 8
+
+/*! \brief Number of packets the adaptive retransmit control looks
+    at before adjusting ARC and ARD */
+#define RADIO_ADAPT_WINDOW 100
+/*! \brief Failure rate above which the link counts as noisy */
+#define RADIO_ADAPT_MAX_FAILURE_RATE 0.02
+/*! \brief Mean retries per packet (as part of ARC) above which the
+    link counts as noisy */
+#define RADIO_ADAPT_RETRY_HEADROOM 0.5
+/*! \brief Mean retries per packet below which the link counts as
+    clean */
+#define RADIO_ADAPT_CLEAN_RETRIES 0.1
+
+#if RADIO_INLINE_HEADER_SIZE > TRANSPORT_HEADROOM
+#error "The inline settings header doesn't fit into the transport headroom"
+#endif
+
+
+/*! \brief Radio settings needed to reach one particular copter
+
+  The dongle talks to one channel, datarate and address at a
+  time. When several copters share a dongle, the radio switches
+  between their contexts before every packet. */
+struct RadioContext {
+  /*! \brief Radio channel, 0 - 125 */
+  int nChannel;
+  /*! \brief Datarate, one of "250K", "1M" and "2M" */
+  std::string strDataRate;
+  /*! \brief The 5 byte radio address, most significant byte first */
+  char cAddress[5];
+};
+
+
+class CCrazyRadio;
+class CRadioTarget;
+
+/*! \brief A pair of OUT/IN bulk transfers that is in flight in
+    asynchronous mode
+
+    Every packet written to the dongle is answered by exactly one ACK
+    read. Both transfers of a slot are submitted together, so the
+    order of submitted IN transfers matches the order of OUT
+    transfers and the ACK can be attributed to the packet it belongs
+    to. */
+struct AsyncSlot {
+  /*! \brief The radio instance this slot belongs to */
+  CCrazyRadio *crRadio;
+  /*! \brief Transfer writing the packet to endpoint 0x01 */
+  libusb_transfer *ltOut;
+  /*! \brief Transfer reading the ACK from endpoint 0x81 */
+  libusb_transfer *ltIn;
+  /*! \brief Sequence number of the packet currently in flight */
+  long lSequence;
+  /*! \brief Number of transfers of this slot not yet completed */
+  int nPending;
+  unsigned char ucOutBuffer[RADIO_USB_BUFFER_SIZE];
+  unsigned char ucInBuffer[RADIO_USB_BUFFER_SIZE];
+};
+
+/*! \brief A raw ACK as received by the asynchronous transfer engine */
+struct AsyncACK {
+  /*! \brief Sequence number of the packet this ACK answers */
+  long lSequence;
+  /*! \brief Number of valid bytes in ucData (including the status
+      byte), or -1 if the transfer failed */
+  int nLength;
+  unsigned char ucData[RADIO_USB_BUFFER_SIZE];
+};
+
+
 /*! \brief Communication class to connect to and communicate via the
     CrazyRadio USB dongle.
 
@@ -67,37 +156,97 @@ enum Power {
     host computer, open and maintain a connection, and send/receive
     data when communicating with the Crazyflie Nano copter using the
     Crazy Radio Transfer Protocol as defined by Bitcraze. */
-class CCrazyRadio {
+class CCrazyRadio : public CTransport {
 private:
   // Variables
   /*! \brief The radio URI as supplied when initializing the class
       instance */
   std::string m_strRadioIdentifier;
-  /*! \brief The current USB context as supplied by libusb */
+  /*! \brief The registry of dongles shared by all radios */
+  CRadioRegistry *m_rrRegistry;
+  /*! \brief The current USB context as supplied by libusb (shared
+      by all radios) */
   libusb_context *m_ctxContext;
   libusb_device *m_devDevice;
   libusb_device_handle *m_hndlDevice;
+  // The dongle settings as last written. They shadow the dongle's
+  // state so that control transfers are only issued for settings
+  // that actually change (see invalidateSettings()).
   int m_nARC;
   int m_nChannel;
   std::string m_strDataRate;
   int m_nARDTime;
   int m_nARDBytes;
+  /*! \brief Raw value last written to the ARD register (which holds
+      either ARD time or ARD bytes) */
+  int m_nARDValue;
   enum Power m_enumPower;
-  char *m_cAddress;
+  bool m_bPowerKnown;
+  char m_cAddress[5];
+  bool m_bAddressKnown;
   int m_bContCarrier;
   float m_fDeviceVersion;
-  bool m_bAckReceived;
-  std::list<CCRTPPacket*> m_lstLoggingPackets;
+  /*! \brief Number of control transfers issued since opening the
+      dongle */
+  unsigned long m_ulControlTransfers;
+  /*! \brief Bulk transfers that timed out */
+  CMetricCounter *m_mcUSBTimeouts;
+  /*! \brief Time from writing a frame until its ACK was read */
+  CMetricHistogram *m_mhBulkLatency;
+  /*! \brief Whether channel, datarate and address are sent in front
+      of every packet instead of through control transfers */
+  bool m_bInlineSettings;
+
+  /*! \brief Settings for the copter given in the radio URI */
+  struct RadioContext m_rcDefault;
+  /*! \brief Whether ARC and ARD are adjusted to the link quality */
+  bool m_bAdaptiveRetransmit;
+  int m_nARCMin;
+  int m_nARCMax;
+  /*! \brief Longest ARD time (in microseconds) the adaptive control
+      may set; 0 keeps ARD at 32 bytes */
+  int m_nARDTimeMax;
+  /*! \brief Packets, failures and retries seen in the current
+      adaptation window */
+  int m_nAdaptPackets;
+  int m_nAdaptFailures;
+  int m_nAdaptRetries;
+
+  /*! \brief Targets sharing this radio, see createTarget() */
+  std::vector<CRadioTarget*> m_vecTargets;
+  /*! \brief Index of the target nextTarget() returns next */
+  unsigned int m_unNextTarget;
+
+  // Asynchronous transfer engine
+  /*! \brief Whether packets are sent through the asynchronous
+      transfer engine */
+  bool m_bAsyncMode;
+  /*! \brief All transfer slots allocated for asynchronous mode */
+  std::vector<struct AsyncSlot*> m_vecAsyncSlots;
+  /*! \brief Slots currently not in flight */
+  std::list<struct AsyncSlot*> m_lstFreeSlots;
+  /*! \brief Sequence number assigned to the next submitted packet */
+  long m_lNextSequence;
+  /*! \brief Completed ACKs not yet collected, in submission order */
+  std::deque<struct AsyncACK> m_dqACKs;
+  /*! \brief Guards the slot lists and the ACK queue, which are
+      shared with the event handling thread */
+  std::mutex m_mtxAsync;
+  /*! \brief Signalled whenever a slot completes */
+  std::condition_variable m_cvAsync;
+  /*! \brief Buffer the last ACK is received into; reply views point
+      here */
+  char m_cReceiveBuffer[RADIO_USB_BUFFER_SIZE];
 
   // Functions
-  std::list<libusb_device*> listDevices(int nVendorID, int nProductID);
   bool openUSBDongle();
   bool claimInterface(int nInterface);
   void closeDevice();
 
-  CCRTPPacket *readACK();
+  bool readACK(CCRTPView &cvReply);
+  bool viewFromACK(char *cBuffer, int nBytesRead, CCRTPView &cvReply);
 
-  CCRTPPacket *writeData(void *vdData, int nLength);
+  bool writeData(void *vdData, int nLength, CCRTPView &cvReply);
   bool writeControl(void *vdData, int nLength, uint8_t u8Request, uint16_t u16Value, uint16_t u16Index);
   bool readData(void *vdData, int &nMaxLength);
 
@@ -108,20 +257,36 @@ private:
   void setARDTime(int nARDTime);
   void setAddress(char *cAddress);
   void setContCarrier(bool bContCarrier);
+  void invalidateSettings();
+  void selectContext(struct RadioContext &rcContext);
+  int dataRateCode(std::string strDataRate);
+  char *frameData(struct RadioContext &rcContext, char *cData, int &nLength);
+  void adaptRetransmit(bool bAck, int nRetries);
+
+  long submitData(void *vdData, int nLength);
+  bool collectACK(long lSequence, int nTimeoutMilliseconds, CCRTPView &cvReply);
+  void slotCompleted(struct AsyncSlot *asSlot, libusb_transfer *ltTransfer);
+  static void LIBUSB_CALL transferCallback(libusb_transfer *ltTransfer);
+
+ protected:
+  bool transmitData(char *cData, int nLength, CCRTPView &cvReply);
 
 public:
   /*! \brief Constructor for the radio communication class
 
     \param strRadioIdentifier URI for the radio to be opened,
-    e.g. "radio://<dongle-no>/<channel-no>/<datarate>". */
+    e.g. "radio://<dongle-no>/<channel-no>/<datarate>", optionally
+    followed by "/<address>" with the address given as 10 hex
+    digits. */
   CCrazyRadio(std::string strRadioIdentifier);
   /*! \brief Destructor for the radio communication class */
   ~CCrazyRadio();
 
   /*! \brief Function to start the radio communication
 
-    The first available USB dongle will be opened and claimed for
-    communication. The connection will be maintained and used to
+    The USB dongle denoted by the dongle number in the radio URI will
+    be opened and claimed for communication. Dongles are numbered by
+    their position on the USB bus (see CRadioRegistry). The connection will be maintained and used to
     communicate with a Crazyflie Nano quadcopter in range.
 
     \return Returns 'true' if the connection could successfully be
@@ -135,6 +300,32 @@ public:
     \return Value denoting the current power settings reserved for
     communication */
   enum Power power();
+
+  /*! \brief Enables adaptive auto-retransmit control
+
+    The dongle retransmits packets that weren't acknowledged up to
+    ARC times, waiting ARD between tries. Instead of keeping these
+    fixed, the radio can watch the ACKs of every
+    RADIO_ADAPT_WINDOW packets and adjust them: on a noisy link, ARC
+    is raised (and, once at its maximum, ARD time); on a clean link,
+    both are lowered again to keep latency down.
+
+    Takes effect for settings made in startRadio() when called
+    before it, and immediately otherwise.
+
+    \param bAdaptive Whether to adjust ARC and ARD at runtime
+    \param nARCMin Smallest ARC to use (0 - 15)
+    \param nARCMax Largest ARC to use (0 - 15)
+    \param nARDTimeMax Longest ARD time in microseconds; 0 keeps ARD
+    at the time needed for 32 bytes of ACK payload */
+  void setAdaptiveRetransmit(bool bAdaptive, int nARCMin = 1, int nARCMax = 15, int nARDTimeMax = 1500);
+  /*! \brief Whether adaptive auto-retransmit control is enabled */
+  bool adaptiveRetransmit();
+  /*! \brief The current auto-retransmit count */
+  int arc();
+  /*! \brief The current auto-retransmit delay in microseconds, or 0
+      if the delay is given in ACK payload bytes */
+  int ardTime();
   /*! \brief Set the power level to be used for communication purposes
 
     \param enumPower The level of power that is being used for
@@ -142,74 +333,66 @@ public:
     Power enum. */
   void setPower(enum Power enumPower);
 
-  /*! \brief Sends the given packet's payload to the copter
-
-    \param crtpSend The packet which supplied header and payload
-    information to send to the copter */
-  CCRTPPacket *sendPacket(CCRTPPacket *crtpSend, bool bDeleteAfterwards = false);
-
-  /*! \brief Sends the given packet and waits for a reply.
-
-    Internally, this function calls the more elaborate
-    sendAndReceive() function supplying parameters for retrying and
-    waiting. Convenience function signature.
-
-    \param crtpSend Packet to send
-    \param bDeleteAfterwards Whether or not the packet to send is
-    deleted internally after sending it
-
-    \return Packet containing the reply or NULL if no reply was
-    received (after retrying). */
-  CCRTPPacket *sendAndReceive(CCRTPPacket *crtpSend, bool bDeleteAfterwards = false);
-
-  /*! \brief Sends the given packet and waits for a reply.
-
-    Sends out the CCRTPPacket instance denoted by crtpSend on the
-    given port and channel. Retries a number of times and waits
-    between each retry whether or not an answer was received (in this
-    case, dummy packets are sent in order to receive replies).
+  /*! \brief Creates a target for another copter on this radio
+
+    Several copters on different channels, datarates or addresses
+    can share one dongle. Each target is a transport of its own that
+    can be handed to a CCrazyflie instance. Before every packet, the
+    radio switches to the settings of the target the packet is for;
+    control transfers are only issued for settings that differ from
+    the previous packet's. Replies, logging and console data are
+    kept apart per target.
+
+    Targets belong to the radio and are deleted along with it. All
+    targets and the radio itself must be used from the same thread.
+
+    \param nChannel Radio channel of the copter
+    \param strDataRate Datarate of the copter ("250K", "1M" or "2M")
+    \param ullAddress 5 byte radio address of the copter
+    \return The new target */
+  CRadioTarget *createTarget(int nChannel, std::string strDataRate, unsigned long long ullAddress = 0xe7e7e7e7e7ULL);
+  /*! \brief Returns the targets of this radio in round-robin order
+
+    Every call returns the target following the one returned by the
+    previous call, which makes it easy to serve all copters on a
+    dongle equally.
+
+    \return The next target, or NULL if no targets were created */
+  CRadioTarget *nextTarget();
+  /*! \brief Number of targets created on this radio */
+  int targetCount();
+
+  /*! \brief Sends encoded CRTP data using the given radio settings
+
+    Switches the dongle to the given context (if necessary) and
+    exchanges the data. The reply is not processed any further;
+    this is left to the transport the context belongs to.
+
+    \param rcContext Settings to use for this packet
+    \param cData CRTP data to send, with TRANSPORT_HEADROOM bytes of
+    writable space in front of it
+    \param nLength Number of bytes to send
+    \param cvReply View to point to the raw reply, valid until the
+    radio's next exchange
+    \return Returns 'false' if the exchange failed */
+  bool transmitDataTo(struct RadioContext &rcContext, char *cData, int nLength, CCRTPView &cvReply);
+
+  /*! \brief Number of control transfers issued since the dongle was
+      opened
+
+    Useful for checking how much reconfiguration traffic several
+    copters on one dongle cause. */
+  unsigned long controlTransfers();
+
+  /*! \brief Whether the dongle uses inline radio settings
+
+    Dongles from version RADIO_INLINE_SETTINGS_VERSION on accept
+    channel, datarate and address in a header in front of every
+    packet. When this mode is active, switching between copters
+    (see createTarget()) costs no control transfers at all. It is
+    enabled automatically in startRadio() when available. */
+  bool inlineSettings();
 
-    \param crtpSend Packet to send
-
-    \param nPort Port number on which to send this packet (and where
-    to wait for the reply)
-    \param nChannel Channel number on which to send this packet (and
-    where to wait for the reply)
-    \param bDeletAfterwards Whether or not the packet to send is
-    deleted internally after sending it
-    \param nRetries Number of retries (re-sending) before giving up on
-    an answer
-    \param nMicrosecondsWait Microseconds to wait between two re-sends
-
-    \return Packet containing the reply or NULL if no reply was
-    received (after retrying). */
-  CCRTPPacket *sendAndReceive(CCRTPPacket *crtpSend, int nPort, int nChannel, bool bDeleteAfterwards = true, int nRetries = 10, int nMicrosecondsWait = 100);
-
-  /*! \brief Sends out an empty dummy packet
-
-    Only contains the payload `0xff`, as used for empty packet
-    requests. Mostly used for waiting or keepalive.
-
-    \return Boolean value denoting whether sending the dummy packet
-    worked or not. */
-  bool sendDummyPacket();
-
-  /*! \brief Waits for the next non-empty packet.
-
-    Sends out dummy packets until a reply is non-empty and then
-    returns this reply.
-
-    \return Packet contaning a non-empty reply. */
-  CCRTPPacket *waitForPacket();
-
-  /*! \brief Whether or not the copter is answering sent packets.
-
-    Returns whether the copter is actually answering sent packets with
-    a set ACK flag. If this is not the case, it is either switched off
-    or out of range.
-
-    \return Returns true if the copter is returning the ACK flag properly, false otherwise. */
-  bool ackReceived();
   /*! \brief Whether or not the USB connection is still operational.
 
     Checks if the USB read/write calls yielded any errors.
@@ -218,15 +401,62 @@ public:
     false otherwise. */
   bool usbOK();
 
-  /*! \brief Extracting all logging related packets
+  /*! \brief Switches the radio to asynchronous transfer mode
+
+    Allocates nTransfersInFlight pairs of OUT/IN bulk transfers and
+    registers with the libusb event handling thread shared by all
+    radios. From then on, packets
+    are written using libusb_submit_transfer() and up to
+    nTransfersInFlight packets can be on their way at the same
+    time. The blocking sendPacket() keeps working on top of this
+    mode; it submits its packet and waits for the matching ACK.
+
+    The radio must have been started using startRadio() before.
+
+    \param nTransfersInFlight Maximum number of packets in flight
+    \return Returns 'true' if the asynchronous mode is active */
+  bool startAsync(int nTransfersInFlight = 4);
+  /*! \brief Leaves asynchronous transfer mode
 
-    Returns a list of all collected logging related (i.e. originating
-    from port 5) packets. This is called by the CCrazyflie class
-    automatically when performing cycle().
+    Cancels all transfers still in flight, frees the transfers and
+    releases this radio's hold on the shared event handling thread
+    (see CRadioRegistry::stopEvents()), which only stops once no
+    radio needs it anymore. ACKs not collected yet are dropped. */
+  void stopAsync();
+  /*! \brief Whether or not the radio is in asynchronous mode */
+  bool asyncMode();
 
-    \return List of CCRTPPacket instances collected from port 5
-    (logging). */
-  std::list<CCRTPPacket*> popLoggingPackets();
+  /*! \brief Submits a packet without waiting for its ACK
+
+    Only available in asynchronous mode. If all transfer slots are in
+    flight, this function waits for one of them to become free.
+
+    \param crtpSend Packet to send
+    \param bDeleteAfterwards Whether or not the packet to send is
+    deleted internally after submitting it
+    \return Sequence number identifying the packet when collecting
+    its ACK using waitForACK(), or -1 if submitting failed. */
+  long submitPacket(CCRTPPacket *crtpSend, bool bDeleteAfterwards = false);
+  /*! \brief Waits for the ACK of a submitted packet
+
+    ACKs are handed out in the order their packets were
+    submitted. ACKs of earlier packets that were not collected yet
+    are processed (logging and console data is extracted) and
+    dropped while waiting.
+
+    \param lSequence Sequence number returned by submitPacket()
+    \param nTimeoutMilliseconds Maximum time to wait for the ACK
+    \return Packet containing the reply or NULL if no ACK arrived in
+    time or the transfer failed. */
+  CCRTPPacket *waitForACK(long lSequence, int nTimeoutMilliseconds = 1000);
+  /*! \brief Processes all ACKs received so far without waiting
+
+    Logging and console data contained in the ACKs is extracted as
+    it would be by sendPacket(). Useful when packets are only
+    submitted and their replies are of no interest.
+
+    \return Number of ACKs processed */
+  int processACKs();
 };
 
 
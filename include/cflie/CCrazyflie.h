@@ -41,18 +41,50 @@
 
 // Private
 #include "CCrazyRadio.h"
+#include "CRadioIOThread.h"
+#include "CSetpointStreamer.h"
 #include "CTOC.h"
+#include "CTOCFetcher.h"
 
 
 enum State {
   STATE_ZERO = 0,
+  /*! \brief Reading the parameter and logs TOCs side by side */
   STATE_READ_PARAMETERS_TOC = 1,
+  /*! \brief Not entered anymore; the logs TOC is read along with
+      the parameter TOC */
   STATE_READ_LOGS_TOC = 2,
   STATE_START_LOGGING = 3,
   STATE_ZERO_MEASUREMENTS = 4,
   STATE_NORMAL_OPERATION = 5
 };
 
+/*! \brief Log variables read by the convenience getters such as
+    roll() or gyroX() */
+enum Sensor {
+  SENSOR_THRUST = 0,
+  SENSOR_ROLL,
+  SENSOR_PITCH,
+  SENSOR_YAW,
+  SENSOR_GYRO_X,
+  SENSOR_GYRO_Y,
+  SENSOR_GYRO_Z,
+  SENSOR_ACC_X,
+  SENSOR_ACC_Y,
+  SENSOR_ACC_Z,
+  SENSOR_ACC_ZW,
+  SENSOR_BATTERY_LEVEL,
+  SENSOR_BATTERY_STATE,
+  SENSOR_MAG_X,
+  SENSOR_MAG_Y,
+  SENSOR_MAG_Z,
+  SENSOR_ASL,
+  SENSOR_ASL_LONG,
+  SENSOR_PRESSURE,
+  SENSOR_TEMPERATURE,
+  SENSOR_COUNT
+};
+
 /*! \brief Crazyflie Nano convenience controller class
 
   The class containing the mechanisms for starting sensor readings,
@@ -63,9 +95,14 @@ class CCrazyflie {
   // Variables
   int m_nAckMissTolerance;
   int m_nAckMissCounter;
-  /*! \brief Internal pointer to the initialized CCrazyRadio radio
-      interface instance. */
-  CCrazyRadio *m_crRadio;
+  /*! \brief ACK rate below which the copter counts as out of
+      range */
+  double m_dMinAckRate;
+  /*! \brief Time spent in cycle() */
+  CMetricHistogram *m_mhCycleTime;
+  /*! \brief Internal pointer to the initialized transport (usually
+      a CCrazyRadio radio interface instance). */
+  CTransport *m_crRadio;
   /*! \brief The current thrust to send as a set point to the
       copter. */
   int m_nThrust;
@@ -98,11 +135,39 @@ class CCrazyflie {
   bool m_bSendsSetpoints;
   CTOC *m_tocParameters;
   CTOC *m_tocLogs;
+  /*! \brief Downloads both TOCs while initializing, NULL
+      otherwise */
+  CTOCFetcher *m_tfFetcher;
+  /*! \brief Handles of the variables behind the convenience
+      getters, resolved once the logs TOC was read */
+  struct TOCHandle m_thSensors[SENSOR_COUNT];
   enum State m_enumState;
+  /*! \brief Whether the radio traffic is handled by a dedicated I/O
+      thread once the copter is initialized */
+  bool m_bThreadedIO;
+  /*! \brief The I/O thread owning the radio in threaded I/O mode */
+  CRadioIOThread *m_rioThread;
+  /*! \brief Whether setpoints are streamed at a fixed rate instead
+      of being sent from cycle() */
+  bool m_bSetpointStreaming;
+  /*! \brief Setpoints per second in streaming mode */
+  double m_dStreamingFrequency;
+  /*! \brief The thread streaming setpoints in streaming mode */
+  CSetpointStreamer *m_ssStreamer;
 
   // Functions
-  bool readTOCParameters();
-  bool readTOCLogs();
+  /*! \brief Advances the download of both TOCs by one step
+
+    \return Returns 'true' once both TOCs are complete */
+  bool readTOCs();
+  /*! \brief Resolves m_thSensors from the logs TOC */
+  void resolveSensorHandles();
+  /*! \brief Current value of one of the convenience getters'
+      variables */
+  double sensorValue(enum Sensor enumSensor);
+  /*! \brief Encodes a set point into a CRTP payload of
+      3 * sizeof(float) + sizeof(short) bytes */
+  int encodeSetpoint(char *cBuffer, float fRoll, float fPitch, float fYaw, short sThrust);
 
   /*! \brief Send a set point to the copter controller
 
@@ -143,16 +208,22 @@ class CCrazyflie {
 
   double currentTime();
 
+  /*! \brief Decodes the logging frames collected by the transport
+      into the logs TOC */
+  void drainLogging();
+  bool ackReceived();
+
  public:
   /*! \brief Constructor for the copter convenience class
 
     Constructor for the CCrazyflie class, taking a CCrazyRadio radio
-    interface instance as a parameter.
+    interface instance (or any other CTransport, such as a
+    CSimulatedCopter) as a parameter.
 
     \param crRadio Initialized (and started) instance of the
     CCrazyRadio class, denoting the USB dongle to communicate
     with. */
-  CCrazyflie(CCrazyRadio *crRadio);
+  CCrazyflie(CTransport *crRadio);
   /*! \brief Destructor for the copter convenience class
 
     Destructor, deleting all internal variables (except for the
@@ -230,12 +301,23 @@ class CCrazyflie {
   /*! \brief Signals whether the copter is in range or not
 
     Returns whether the radio connection to the copter is currently
-    active.
+    active. This is the case as long as not too many packets in a
+    row went unacknowledged and the ACK rate over the last packets
+    (see linkQuality()) is acceptable.
 
     \return Returns 'true' is the copter is in range and radio
     communication works, and 'false' if the copter is either out of
     range or is switched off. */
   bool copterInRange();
+  /*! \brief Statistics about the radio link to the copter
+
+    ACK rate, retransmission histogram and power detector ratio over
+    the last packets, as decoded from the ACK status the dongle
+    reports. A falling ACK rate or rising retransmission count is an
+    early sign of a degrading link.
+
+    \return Snapshot of the current link quality */
+  struct LinkQuality linkQuality();
 
   /*! \brief Whether or not the copter was initialized successfully.
 
@@ -262,6 +344,62 @@ class CCrazyflie {
     is sent to the copter while performing cycle(). */
   bool sendsSetpoints();
 
+  /*! \brief Set whether the radio is driven by a dedicated I/O thread
+
+    In threaded I/O mode, a library-owned thread takes over all
+    traffic on the radio as soon as the copter is initialized. It
+    keeps the link alive and collects logging data on its own, while
+    cycle() only exchanges packets with it through lock-free
+    queues. A stalling main loop then doesn't starve the radio link
+    anymore. The transport instance must not be used directly while
+    the thread is running.
+
+    Default value: `false`
+
+    \param bThreadedIO When set to `true`, the I/O thread is used. */
+  void setThreadedIO(bool bThreadedIO);
+
+  /*! \brief Whether or not threaded I/O mode is enabled */
+  bool threadedIO();
+
+  /*! \brief Set the directory the parameter and logging TOCs are
+      cached in
+
+    When connecting to a copter whose TOCs were seen before (as
+    identified by the CRCs the copter reports), the TOCs are loaded
+    from there instead of being downloaded item by item. See
+    CTOC::setCacheDirectory().
+
+    Default value: empty, i.e. no caching
+
+    \param strDirectory An existing, writable directory */
+  void setTOCCacheDirectory(std::string strDirectory);
+
+  /*! \brief Set whether setpoints are streamed at a fixed rate
+
+    Normally, cycle() sends a setpoint when the setpoint period has
+    passed, so the actual rate depends on how often cycle() is
+    called. In streaming mode, a dedicated thread sleeps until
+    absolute deadlines and sends the latest setpoint exactly once
+    per period instead; cycle() only updates the setpoint to
+    send. Streaming implies threaded I/O mode (see setThreadedIO())
+    and only takes place while setpoints are sent at all (see
+    setSendSetpoints()).
+
+    Default value: `false`
+
+    \param bStreaming When set to `true`, setpoints are streamed.
+    \param dFrequency Setpoints per second, at most
+    SETPOINT_STREAM_MAX_FREQUENCY */
+  void setSetpointStreaming(bool bStreaming, double dFrequency = 100);
+
+  /*! \brief Whether or not setpoint streaming is enabled */
+  bool setpointStreaming();
+
+  /*! \brief Timing statistics of the setpoint stream, see
+      CSetpointStreamer::statistics() */
+  struct StreamStatistics setpointStreamStatistics();
+
   /*! \brief Read back a sensor value you subscribed to
 
     Possible sensor values might be:
@@ -274,10 +412,48 @@ class CCrazyflie {
     don't know what to do with this, just use the convience functions
     like roll(), pitch(), yaw(), and batteryLevel().
 
+    Every call looks the name up again; use sensorHandle() for
+    values read repeatedly.
+
     \return Double value denoting the current value of the requested
     log variable. */
   double sensorDoubleValue(std::string strName);
 
+  /*! \brief Resolves a log variable name into a handle
+
+    The handle is valid once the copter is initialized (see
+    isInitialized()) and makes reading the value through
+    sensorDoubleValue(const struct TOCHandle&) a plain array access.
+
+    \param strName Full name of the variable, such as
+    `stabilizer.roll`
+    \return The handle; its nIndex is -1 if the variable is
+    unknown */
+  struct TOCHandle sensorHandle(std::string strName);
+
+  /*! \brief Read back a sensor value through a resolved handle */
+  double sensorDoubleValue(const struct TOCHandle &thHandle);
+
+  /*! \brief Keeps a timestamped history of a sensor value
+
+    Every value received for the variable is recorded, at the rate
+    the copter logs it, not just the one cycle() happens to leave
+    behind. The variable must be part of a logging block, and the
+    logs TOC must have been read (see isInitialized()).
+
+    \param strName Full name of the variable, such as
+    `stabilizer.roll`
+    \param unCapacity Number of samples kept; 0 stops keeping a
+    history
+    \return Returns 'false' if the variable is unknown */
+  bool setSensorHistory(std::string strName, unsigned int unCapacity);
+
+  /*! \brief The history of a sensor value, see CTimeSeries
+
+    \return The time series, or NULL if no history is kept for the
+    variable */
+  CTimeSeries *sensorHistory(std::string strName);
+
   /*! \brief Report the current battery level
 
     \return Double value denoting the battery level as reported by the
@@ -0,0 +1,187 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_DIAGNOSTICS_H__
+#define __C_DIAGNOSTICS_H__
+
+
+// System
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <functional>
+
+// Private
+#include "CMPMCQueue.h"
+
+
+/*! \brief Maximum length of a single diagnostic message (longer text
+    is cut off) */
+#define DIAGNOSTICS_MESSAGE_LENGTH 128
+/*! \brief Number of messages that can wait for delivery */
+#define DIAGNOSTICS_QUEUE_SIZE 256
+/*! \brief Default number of messages accepted per second */
+#define DIAGNOSTICS_DEFAULT_RATE_LIMIT 200
+
+
+enum Severity {
+  SEVERITY_DEBUG = 0,
+  SEVERITY_INFO = 1,
+  /*! \brief Text printed by a copter's firmware */
+  SEVERITY_CONSOLE = 2,
+  SEVERITY_WARNING = 3,
+  SEVERITY_ERROR = 4
+};
+
+/*! \brief A single diagnostic message */
+struct DiagnosticMessage {
+  enum Severity enumSeverity;
+  /*! \brief Transport the message is about (see
+      CTransport::diagnosticsSource()), or -1 for the library in
+      general */
+  int nSource;
+  /*! \brief Time the message was posted, in seconds since the
+      diagnostics sink was created */
+  double dTime;
+  /*! \brief Zero-terminated message text */
+  char cText[DIAGNOSTICS_MESSAGE_LENGTH];
+};
+
+
+/*! \brief Library-wide sink for diagnostic output
+
+  Instead of writing to the terminal from the radio path, the
+  library posts its messages here. Posting never blocks: messages
+  are copied into a lock-free ring buffer and delivered later,
+  either by a background writer thread or by calling deliver()
+  manually. Messages below the minimum severity are dropped right
+  away, and a rate limit keeps chatty firmware or a flaky link from
+  flooding the sink; the number of suppressed messages is reported
+  once the limit allows again.
+
+  By default, the writer thread prints messages to stdout. Install
+  a callback with setCallback() to route them elsewhere. */
+class CDiagnostics {
+ private:
+  // Variables
+  CMPMCQueue<struct DiagnosticMessage, DIAGNOSTICS_QUEUE_SIZE> m_mpmcMessages;
+  std::atomic<int> m_nMinSeverity;
+  std::atomic<int> m_nRateLimit;
+  /*! \brief Second the current rate limiting window started at */
+  std::atomic<long> m_lRateWindow;
+  /*! \brief Messages accepted in the current rate limiting window */
+  std::atomic<int> m_nRateCount;
+  std::atomic<unsigned long> m_ulSuppressed;
+  std::atomic<unsigned long> m_ulDropped;
+  std::chrono::steady_clock::time_point m_tpStart;
+
+  /*! \brief Guards the callback and serializes delivery */
+  std::mutex m_mtxDelivery;
+  std::function<void(const struct DiagnosticMessage&)> m_fncCallback;
+  /*! \brief Number of suppressed messages already reported */
+  unsigned long m_ulReportedSuppressed;
+
+  std::thread m_thrdWriter;
+  std::atomic<bool> m_bWriterRunning;
+
+  // Functions
+  CDiagnostics();
+  ~CDiagnostics();
+
+  bool admit();
+  void deliverMessage(const struct DiagnosticMessage &dmMessage);
+  void runWriter();
+
+ public:
+  /*! \brief The diagnostics sink shared by the whole library */
+  static CDiagnostics *instance();
+
+  /*! \brief Posts a message
+
+    Never blocks. If the queue is full or the rate limit is
+    exceeded, the message is dropped.
+
+    \param enumSeverity Severity of the message
+    \param cText Message text (need not be zero-terminated)
+    \param nLength Length of the text
+    \param nSource Transport the message is about, or -1 */
+  void post(enum Severity enumSeverity, const char *cText, int nLength, int nSource = -1);
+  /*! \brief Convenience version of post() for std::string text */
+  void post(enum Severity enumSeverity, std::string strText, int nSource = -1);
+
+  /*! \brief Sets the lowest severity that is posted
+
+    Default value: SEVERITY_INFO */
+  void setMinSeverity(enum Severity enumSeverity);
+  /*! \brief Sets the maximum number of messages accepted per second
+
+    \param nMessagesPerSecond Limit; 0 disables rate limiting */
+  void setRateLimit(int nMessagesPerSecond);
+
+  /*! \brief Routes delivered messages to the given callback instead
+      of stdout
+
+    The callback is called from the thread delivering messages (the
+    writer thread, or the caller of deliver()), never from the radio
+    path.
+
+    \param fncCallback The callback; an empty function restores
+    printing to stdout */
+  void setCallback(std::function<void(const struct DiagnosticMessage&)> fncCallback);
+
+  /*! \brief Starts the background writer thread (running by
+      default) */
+  void startWriter();
+  /*! \brief Stops the background writer thread
+
+    Messages then have to be picked up by calling deliver(). */
+  void stopWriter();
+
+  /*! \brief Delivers all queued messages on the calling thread
+
+    \return Number of messages delivered */
+  int deliver();
+
+  /*! \brief Number of messages suppressed by the rate limit so
+      far */
+  unsigned long suppressedMessages();
+  /*! \brief Number of messages dropped because the queue was full */
+  unsigned long droppedMessages();
+};
+
+
+#endif /* __C_DIAGNOSTICS_H__ */
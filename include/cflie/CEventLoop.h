@@ -0,0 +1,309 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_EVENT_LOOP_H__
+#define __C_EVENT_LOOP_H__
+
+
+// Private
+#include "CTask.h"
+
+#ifdef CFLIE_HAS_COROUTINES
+
+
+// System
+#include <list>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
+
+// Private
+#include "CTransport.h"
+#include "CTOC.h"
+
+
+class CEventLoop;
+
+
+/*! \brief Awaitable reply to a request
+
+  Returned by CEventLoop::request(). co_await yields the reply (to
+  be deleted by the caller), or NULL if the request expired. */
+class CRequestAwaitable {
+ private:
+  CEventLoop *m_elLoop;
+  CRequestFuture m_rfFuture;
+
+ public:
+  CRequestAwaitable(CEventLoop *elLoop, CRequestFuture &&rfFuture) : m_elLoop(elLoop), m_rfFuture(std::move(rfFuture)) {
+  }
+
+  bool await_ready() {
+    return m_rfFuture.poll() != REQUEST_PENDING;
+  }
+
+  void await_suspend(std::coroutine_handle<> chAwaiting);
+
+  CCRTPPacket *await_resume() {
+    return m_rfFuture.reply();
+  }
+};
+
+
+/*! \brief Cooperative scheduler for coroutines talking to copters
+
+  Runs any number of coroutines on the calling thread. A coroutine
+  awaiting a request is parked until the request was answered or
+  expired; in the meantime, the loop drives the transports with
+  outstanding requests by one exchange per round, so the setup
+  sequences of many copters (e.g. CRadioTarget instances sharing a
+  dongle, or simulated copters) progress side by side without a
+  thread per copter.
+
+  Transports aren't thread-safe; while the loop runs, nothing else
+  may use the transports its coroutines talk to. */
+class CEventLoop {
+ private:
+  struct Waiter {
+    CRequestFuture *rfFuture;
+    CTransport *ctTransport;
+    std::coroutine_handle<> chCoroutine;
+  };
+
+  // Variables
+  std::list<struct Waiter> m_lstWaiters;
+  std::list<std::unique_ptr<CTask<bool> > > m_lstTasks;
+  /*! \brief Microseconds to wait between two rounds */
+  int m_nMicrosecondsWait;
+
+ public:
+  CEventLoop(int nMicrosecondsWait = 100) : m_nMicrosecondsWait(nMicrosecondsWait) {
+  }
+
+  /*! \brief Sends a request; the reply can be co_await'ed
+
+    \param crtpRequest Packet to send; stays with the caller
+    \param nTimeoutMilliseconds Time the reply may take
+    \param nMatchLength Number of leading payload bytes to match the
+    reply on (see CTransport::submitRequest())
+    \return Awaitable yielding the reply or NULL */
+  CRequestAwaitable request(CTransport *ctTransport, CCRTPPacket *crtpRequest, int nTimeoutMilliseconds = TRANSPORT_DEFAULT_REQUEST_TIMEOUT, int nMatchLength = 2) {
+    std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMilliseconds);
+
+    return CRequestAwaitable(this, ctTransport->request(crtpRequest, tpDeadline, nMatchLength));
+  }
+
+  /*! \brief Parks a coroutine until the given request is settled */
+  void park(CRequestFuture *rfFuture, CTransport *ctTransport, std::coroutine_handle<> chCoroutine) {
+    struct Waiter wtWaiter = {rfFuture, ctTransport, chCoroutine};
+    m_lstWaiters.push_back(wtWaiter);
+  }
+
+  /*! \brief Starts a coroutine on the loop
+
+    The loop owns the task from now on; the returned pointer stays
+    valid as long as the loop exists. */
+  CTask<bool> *spawn(CTask<bool> &&tTask) {
+    m_lstTasks.push_back(std::unique_ptr<CTask<bool> >(new CTask<bool>(std::move(tTask))));
+
+    CTask<bool> *tSpawned = m_lstTasks.back().get();
+    tSpawned->resume();
+
+    return tSpawned;
+  }
+
+  /*! \brief Runs a single round
+
+    Performs one exchange on every transport a parked coroutine
+    waits on and resumes the coroutines whose requests were
+    answered or expired.
+
+    \return Number of coroutines still parked */
+  int runOnce() {
+    std::list<CTransport*> lstTransports;
+
+    for(std::list<struct Waiter>::iterator itWaiter = m_lstWaiters.begin();
+	itWaiter != m_lstWaiters.end();
+	itWaiter++) {
+      if(std::find(lstTransports.begin(), lstTransports.end(), (*itWaiter).ctTransport) == lstTransports.end()) {
+	lstTransports.push_back((*itWaiter).ctTransport);
+      }
+    }
+
+    for(std::list<CTransport*>::iterator itTransport = lstTransports.begin();
+	itTransport != lstTransports.end();
+	itTransport++) {
+      (*itTransport)->pumpRequests();
+    }
+
+    // Resuming may park coroutines again; pick the settled ones
+    // first.
+    std::list<std::coroutine_handle<> > lstReady;
+    std::list<struct Waiter>::iterator itWaiter = m_lstWaiters.begin();
+
+    while(itWaiter != m_lstWaiters.end()) {
+      if((*itWaiter).rfFuture->poll() != REQUEST_PENDING) {
+	lstReady.push_back((*itWaiter).chCoroutine);
+	itWaiter = m_lstWaiters.erase(itWaiter);
+      } else {
+	itWaiter++;
+      }
+    }
+
+    for(std::list<std::coroutine_handle<> >::iterator itReady = lstReady.begin();
+	itReady != lstReady.end();
+	itReady++) {
+      (*itReady).resume();
+    }
+
+    return m_lstWaiters.size();
+  }
+
+  /*! \brief Runs rounds until no coroutine is parked anymore */
+  void run() {
+    while(!m_lstWaiters.empty()) {
+      if(this->runOnce() > 0 && m_nMicrosecondsWait > 0) {
+	usleep(m_nMicrosecondsWait);
+      }
+    }
+  }
+};
+
+
+inline void CRequestAwaitable::await_suspend(std::coroutine_handle<> chAwaiting) {
+  m_elLoop->park(&m_rfFuture, m_rfFuture.transport(), chAwaiting);
+}
+
+
+// Awaitable TOC operations. Each is the coroutine counterpart of
+// the blocking CTOC function of the same name.
+
+/*! \brief Awaitable CTOC::requestMetaData() */
+inline CTask<bool> requestMetaData(CEventLoop &elLoop, CTOC *tocTOC) {
+  CCRTPPacket *crtpRequest = tocTOC->metaDataRequest();
+  CCRTPPacket *crtpReply = co_await elLoop.request(tocTOC->transport(), crtpRequest, TRANSPORT_DEFAULT_REQUEST_TIMEOUT, 1);
+  delete crtpRequest;
+
+  bool bOK = (crtpReply && tocTOC->processMetaData(crtpReply));
+  delete crtpReply;
+
+  co_return bOK;
+}
+
+/*! \brief Awaitable CTOC::requestItems()
+
+  Just like the blocking version, a cached TOC is used if there is
+  one and a downloaded one is cached.
+
+  \return Returns 'false' if any item didn't arrive */
+inline CTask<bool> requestItems(CEventLoop &elLoop, CTOC *tocTOC) {
+  if(tocTOC->loadCache()) {
+    co_return true;
+  }
+
+  bool bOK = true;
+
+  for(int nI = 0; nI < tocTOC->itemCount(); nI++) {
+    CCRTPPacket *crtpRequest = tocTOC->itemRequest(nI);
+    CCRTPPacket *crtpReply = co_await elLoop.request(tocTOC->transport(), crtpRequest);
+    delete crtpRequest;
+
+    bOK = (crtpReply && tocTOC->processItem(crtpReply)) && bOK;
+    delete crtpReply;
+  }
+
+  if(bOK) {
+    tocTOC->saveCache();
+  }
+
+  co_return bOK;
+}
+
+/*! \brief Awaitable CTOC::registerLoggingBlock() (which also
+    starts the block) */
+inline CTask<bool> registerLoggingBlock(CEventLoop &elLoop, CTOC *tocTOC, std::string strName, double dFrequency) {
+  if(dFrequency <= 0) {
+    co_return false;
+  }
+
+  int nID = tocTOC->freeLoggingBlockID();
+
+  CCRTPPacket *crtpRequest = tocTOC->deleteBlockRequest(nID);
+  delete co_await elLoop.request(tocTOC->transport(), crtpRequest);
+  delete crtpRequest;
+
+  crtpRequest = tocTOC->createBlockRequest(nID, dFrequency);
+  CCRTPPacket *crtpReply = co_await elLoop.request(tocTOC->transport(), crtpRequest);
+  delete crtpRequest;
+
+  bool bOK = (crtpReply && tocTOC->processCreateBlock(crtpReply, strName, nID, dFrequency));
+  delete crtpReply;
+
+  if(bOK) {
+    bool bFound;
+    crtpRequest = tocTOC->startBlockRequest(tocTOC->loggingBlockForName(strName, bFound));
+    crtpReply = co_await elLoop.request(tocTOC->transport(), crtpRequest);
+    delete crtpRequest;
+
+    bOK = (crtpReply != NULL);
+    delete crtpReply;
+  }
+
+  co_return bOK;
+}
+
+/*! \brief Awaitable CTOC::startLogging() */
+inline CTask<bool> startLogging(CEventLoop &elLoop, CTOC *tocTOC, std::string strName, std::string strBlockName) {
+  bool bFoundBlock, bFoundElement;
+  struct LoggingBlock lbBlock = tocTOC->loggingBlockForName(strBlockName, bFoundBlock);
+  struct TOCElement teElement = tocTOC->elementForName(strName, bFoundElement);
+
+  if(!bFoundBlock || !bFoundElement) {
+    co_return false;
+  }
+
+  CCRTPPacket *crtpRequest = tocTOC->appendVariableRequest(lbBlock, teElement);
+  CCRTPPacket *crtpReply = co_await elLoop.request(tocTOC->transport(), crtpRequest);
+  delete crtpRequest;
+
+  bool bOK = (crtpReply && tocTOC->processAppendVariable(crtpReply, lbBlock, teElement));
+  delete crtpReply;
+
+  co_return bOK;
+}
+
+
+#endif /* CFLIE_HAS_COROUTINES */
+
+#endif /* __C_EVENT_LOOP_H__ */
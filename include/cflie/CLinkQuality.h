@@ -0,0 +1,108 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_LINK_QUALITY_H__
+#define __C_LINK_QUALITY_H__
+
+
+// System
+#include <atomic>
+
+
+/*! \brief Number of packets the link quality is calculated over */
+#define LINK_QUALITY_WINDOW 128
+
+
+/*! \brief Snapshot of the link quality over the last packets */
+struct LinkQuality {
+  /*! \brief Number of packets the values are based on (up to
+      LINK_QUALITY_WINDOW) */
+  int nPackets;
+  /*! \brief Share of packets that were acknowledged, 0.0 - 1.0 */
+  double dAckRate;
+  /*! \brief Share of packets for which the dongle's power detector
+      reported a strong signal, 0.0 - 1.0 */
+  double dPowerDetectorRatio;
+  /*! \brief Average number of retransmissions per packet */
+  double dMeanRetries;
+  /*! \brief Number of packets per retransmission count (0 - 15) */
+  int nRetryHistogram[16];
+};
+
+
+/*! \brief Rolling link statistics decoded from ACK status bytes
+
+  The Crazyradio reports a status byte with every ACK: bit 0 is the
+  ACK flag, bit 1 the power detector and the upper four bits the
+  number of retransmissions needed. This class keeps the status of
+  the last LINK_QUALITY_WINDOW packets and maintains the aggregate
+  values incrementally, so both recording a status and reading the
+  link quality are cheap.
+
+  One thread may record while others read. */
+class CLinkQuality {
+ private:
+  // Variables
+  /*! \brief The last status bytes recorded (ring buffer) */
+  unsigned char m_ucStatus[LINK_QUALITY_WINDOW];
+  /*! \brief Number of status bytes recorded so far */
+  unsigned long m_ulRecorded;
+  std::atomic<int> m_nPackets;
+  std::atomic<int> m_nAcks;
+  std::atomic<int> m_nPowerDetector;
+  std::atomic<int> m_nRetries;
+  std::atomic<int> m_nRetryHistogram[16];
+
+  // Functions
+  void count(unsigned char ucStatus, int nDirection);
+
+ public:
+  CLinkQuality();
+
+  /*! \brief Records the status byte of one packet
+
+    \param ucStatus The status byte as reported by the dongle */
+  void record(unsigned char ucStatus);
+  /*! \brief Forgets all recorded packets */
+  void reset();
+
+  /*! \brief Returns the link quality over the last packets */
+  struct LinkQuality snapshot();
+  /*! \brief Share of the last packets that were acknowledged
+
+    Returns 1.0 if nothing was recorded yet. */
+  double ackRate();
+};
+
+
+#endif /* __C_LINK_QUALITY_H__ */
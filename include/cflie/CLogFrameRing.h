@@ -0,0 +1,283 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_LOG_FRAME_RING_H__
+#define __C_LOG_FRAME_RING_H__
+
+
+// System
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <ctime>
+
+// Private
+#include "CCRTPPacket.h"
+#include "CCRTPView.h"
+
+
+/*! \brief What a full ring does with a new frame */
+enum OverflowPolicy {
+  /*! \brief Discard the oldest frame to make room; the consumer
+      always sees the most recent data */
+  OVERFLOW_DROP_OLDEST = 0,
+  /*! \brief Discard the new frame; frames already queued are
+      kept */
+  OVERFLOW_DROP_NEWEST = 1
+};
+
+/*! \brief Outcome of CLogFrameRing::push() */
+enum RingPushResult {
+  RING_STORED = 0,
+  /*! \brief The frame was stored after the oldest one was
+      dropped */
+  RING_DROPPED_OLDEST = 1,
+  /*! \brief The frame itself was dropped */
+  RING_DROPPED_NEWEST = 2
+};
+
+
+/*! \brief Bounded, lock-free ring of received logging frames
+
+  Frames are copied into fixed slots inside the ring, so pushing
+  doesn't allocate and memory use doesn't depend on how long the
+  consumer takes to come around. drain() hands the frames to a
+  consumer as views of their slots, so they are decoded in place.
+  Every frame is stamped when pushed, and its view carries that
+  receive time (see CCRTPView::receiveTime()), so frames drained in
+  a batch still tell when each of them arrived.
+
+  Slots are claimed through per-slot sequence numbers just like in
+  CMPMCQueue, so one thread may push while another one drains. When
+  the ring is full, the overflow policy decides whether the oldest
+  or the new frame is dropped; either way is counted.
+
+  \tparam N Capacity of the ring in frames, must be a power of two */
+template<unsigned int N>
+class CLogFrameRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Ring capacity must be a power of two");
+
+ private:
+  /*! \brief One frame and its sequence number */
+  struct Slot {
+    std::atomic<unsigned int> unSequence;
+    /*! \brief Frame data, header byte included */
+    char cFrame[1 + CRTP_MAX_DATA_LENGTH];
+    int nLength;
+    /*! \brief Seconds on CLOCK_MONOTONIC at push() */
+    double dReceived;
+  };
+
+  /*! \brief Frame storage */
+  struct Slot m_slSlots[N];
+  /*! \brief Number of frames that claimed a slot for writing */
+  std::atomic<unsigned int> m_unHead;
+  /*! \brief Number of frames that claimed a slot for reading */
+  std::atomic<unsigned int> m_unTail;
+  std::atomic<int> m_nPolicy;
+  std::atomic<unsigned long> m_ulDroppedOldest;
+  std::atomic<unsigned long> m_ulDroppedNewest;
+
+  /*! \brief Claims the slot for the next frame, if there is a free
+      one
+
+    \return The slot, or NULL if the ring is full */
+  struct Slot *claimWrite(unsigned int &unPosition) {
+    unPosition = m_unHead.load(std::memory_order_relaxed);
+
+    while(true) {
+      struct Slot &slSlot = m_slSlots[unPosition & (N - 1)];
+      int nDiff = (int)(slSlot.unSequence.load(std::memory_order_acquire) - unPosition);
+
+      if(nDiff == 0) {
+	if(m_unHead.compare_exchange_weak(unPosition, unPosition + 1, std::memory_order_relaxed)) {
+	  return &slSlot;
+	}
+      } else if(nDiff < 0) {
+	return NULL;
+      } else {
+	unPosition = m_unHead.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /*! \brief Claims the slot holding the oldest frame, if any
+
+    \return The slot, or NULL if the ring is empty */
+  struct Slot *claimRead(unsigned int &unPosition) {
+    unPosition = m_unTail.load(std::memory_order_relaxed);
+
+    while(true) {
+      struct Slot &slSlot = m_slSlots[unPosition & (N - 1)];
+      int nDiff = (int)(slSlot.unSequence.load(std::memory_order_acquire) - (unPosition + 1));
+
+      if(nDiff == 0) {
+	if(m_unTail.compare_exchange_weak(unPosition, unPosition + 1, std::memory_order_relaxed)) {
+	  return &slSlot;
+	}
+      } else if(nDiff < 0) {
+	return NULL;
+      } else {
+	unPosition = m_unTail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+ public:
+  CLogFrameRing() : m_unHead(0), m_unTail(0), m_nPolicy(OVERFLOW_DROP_OLDEST), m_ulDroppedOldest(0), m_ulDroppedNewest(0) {
+    for(unsigned int unI = 0; unI < N; unI++) {
+      m_slSlots[unI].unSequence.store(unI, std::memory_order_relaxed);
+      m_slSlots[unI].nLength = 0;
+      m_slSlots[unI].dReceived = 0;
+    }
+  }
+
+  /*! \brief Copies a frame into the ring
+
+    \param cvFrame The frame to store
+    \return Whether the frame was stored, and whether a frame was
+    dropped for it */
+  enum RingPushResult push(const CCRTPView &cvFrame) {
+    enum RingPushResult enumResult = RING_STORED;
+    unsigned int unPosition;
+    struct Slot *slSlot = this->claimWrite(unPosition);
+
+    if(slSlot == NULL) {
+      if(m_nPolicy.load(std::memory_order_relaxed) == OVERFLOW_DROP_OLDEST) {
+	unsigned int unOldest;
+	struct Slot *slOldest = this->claimRead(unOldest);
+
+	if(slOldest) {
+	  slOldest->unSequence.store(unOldest + N, std::memory_order_release);
+	  m_ulDroppedOldest++;
+	  enumResult = RING_DROPPED_OLDEST;
+
+	  slSlot = this->claimWrite(unPosition);
+	}
+      }
+
+      // Still full (the consumer might hold the slot in question);
+      // the new frame has to go.
+      if(slSlot == NULL) {
+	m_ulDroppedNewest++;
+
+	return RING_DROPPED_NEWEST;
+      }
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+
+    slSlot->nLength = std::min(cvFrame.dataLength(), 1 + CRTP_MAX_DATA_LENGTH);
+    memcpy(slSlot->cFrame, cvFrame.data(), slSlot->nLength);
+    slSlot->dReceived = tsNow.tv_sec + tsNow.tv_nsec / 1e9;
+    slSlot->unSequence.store(unPosition + 1, std::memory_order_release);
+
+    return enumResult;
+  }
+
+  /*! \brief Hands the queued frames to a consumer, oldest first
+
+    The consumer is given views of the slots themselves; a slot is
+    released once the consumer returns.
+
+    \param ccConsumer The consumer decoding the frames, or NULL to
+    just discard them
+    \param unMaximum Maximum number of frames to drain
+    \return The number of frames drained */
+  unsigned int drain(CCRTPConsumer *ccConsumer, unsigned int unMaximum = N) {
+    unsigned int unDrained = 0;
+    unsigned int unPosition;
+    struct Slot *slSlot;
+
+    while(unDrained < unMaximum && (slSlot = this->claimRead(unPosition)) != NULL) {
+      if(ccConsumer) {
+	CCRTPView cvFrame(slSlot->cFrame, slSlot->nLength);
+	cvFrame.setReceiveTime(slSlot->dReceived);
+
+	ccConsumer->consumeFrame(cvFrame);
+      }
+
+      slSlot->unSequence.store(unPosition + N, std::memory_order_release);
+      unDrained++;
+    }
+
+    return unDrained;
+  }
+
+  /*! \brief Discards all queued frames */
+  void clear() {
+    this->drain(NULL);
+  }
+
+  /*! \brief Set what happens to new frames while the ring is full
+
+    Default value: `OVERFLOW_DROP_OLDEST` */
+  void setOverflowPolicy(enum OverflowPolicy enumPolicy) {
+    m_nPolicy = enumPolicy;
+  }
+
+  enum OverflowPolicy overflowPolicy() {
+    return (enum OverflowPolicy)m_nPolicy.load();
+  }
+
+  /*! \brief Number of frames currently queued
+
+    Only a snapshot when called while the other side is active. */
+  unsigned int size() {
+    unsigned int unHead = m_unHead.load(std::memory_order_acquire);
+    unsigned int unTail = m_unTail.load(std::memory_order_acquire);
+
+    return (unHead - unTail > N ? 0 : unHead - unTail);
+  }
+
+  /*! \brief Maximum number of frames the ring can hold */
+  unsigned int capacity() {
+    return N;
+  }
+
+  /*! \brief Number of queued frames dropped to make room for new
+      ones */
+  unsigned long droppedOldest() {
+    return m_ulDroppedOldest;
+  }
+
+  /*! \brief Number of new frames dropped because the ring was
+      full */
+  unsigned long droppedNewest() {
+    return m_ulDroppedNewest;
+  }
+};
+
+
+#endif /* __C_LOG_FRAME_RING_H__ */
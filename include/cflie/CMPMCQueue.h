@@ -0,0 +1,147 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_MPMC_QUEUE_H__
+#define __C_MPMC_QUEUE_H__
+
+
+// System
+#include <atomic>
+
+
+/*! \brief Bounded, lock-free multi-producer/multi-consumer queue
+
+  Any number of threads may push() and pop() concurrently. Every
+  slot carries a sequence number telling whether it is ready for
+  the next producer or the next consumer, so neither operation
+  blocks or allocates; push() fails when the queue is full and pop()
+  fails when it is empty.
+
+  \tparam T Element type, copied in and out
+  \tparam N Capacity of the queue, must be a power of two */
+template<typename T, unsigned int N>
+class CMPMCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Queue capacity must be a power of two");
+
+ private:
+  /*! \brief One element and its sequence number */
+  struct Slot {
+    std::atomic<unsigned int> unSequence;
+    T tElement;
+  };
+
+  /*! \brief Element storage */
+  struct Slot m_slSlots[N];
+  /*! \brief Number of push() calls that claimed a slot so far */
+  std::atomic<unsigned int> m_unHead;
+  /*! \brief Number of pop() calls that claimed a slot so far */
+  std::atomic<unsigned int> m_unTail;
+
+ public:
+  CMPMCQueue() : m_unHead(0), m_unTail(0) {
+    for(unsigned int unI = 0; unI < N; unI++) {
+      m_slSlots[unI].unSequence.store(unI, std::memory_order_relaxed);
+    }
+  }
+
+  /*! \brief Appends an element to the queue
+
+    \param tElement The element to append
+    \return Returns 'false' if the queue was full */
+  bool push(const T &tElement) {
+    unsigned int unHead = m_unHead.load(std::memory_order_relaxed);
+
+    while(true) {
+      struct Slot &slSlot = m_slSlots[unHead & (N - 1)];
+      int nDiff = (int)(slSlot.unSequence.load(std::memory_order_acquire) - unHead);
+
+      if(nDiff == 0) {
+	// The slot is free; try to claim it.
+	if(m_unHead.compare_exchange_weak(unHead, unHead + 1, std::memory_order_relaxed)) {
+	  slSlot.tElement = tElement;
+	  slSlot.unSequence.store(unHead + 1, std::memory_order_release);
+
+	  return true;
+	}
+      } else if(nDiff < 0) {
+	// The slot still holds an element from the last round.
+	return false;
+      } else {
+	unHead = m_unHead.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /*! \brief Removes the oldest element from the queue
+
+    \param tElement Receives the element removed
+    \return Returns 'false' if the queue was empty */
+  bool pop(T &tElement) {
+    unsigned int unTail = m_unTail.load(std::memory_order_relaxed);
+
+    while(true) {
+      struct Slot &slSlot = m_slSlots[unTail & (N - 1)];
+      int nDiff = (int)(slSlot.unSequence.load(std::memory_order_acquire) - (unTail + 1));
+
+      if(nDiff == 0) {
+	// The slot holds an element; try to claim it.
+	if(m_unTail.compare_exchange_weak(unTail, unTail + 1, std::memory_order_relaxed)) {
+	  tElement = slSlot.tElement;
+	  slSlot.unSequence.store(unTail + N, std::memory_order_release);
+
+	  return true;
+	}
+      } else if(nDiff < 0) {
+	// Nothing was pushed into this slot yet.
+	return false;
+      } else {
+	unTail = m_unTail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /*! \brief Whether the queue is currently empty
+
+    Only a snapshot when called while other threads are active. */
+  bool empty() {
+    return m_unHead.load(std::memory_order_acquire) == m_unTail.load(std::memory_order_acquire);
+  }
+
+  /*! \brief Maximum number of elements the queue can hold */
+  unsigned int capacity() {
+    return N;
+  }
+};
+
+
+#endif /* __C_MPMC_QUEUE_H__ */
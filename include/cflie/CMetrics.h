@@ -0,0 +1,214 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_METRICS_H__
+#define __C_METRICS_H__
+
+
+// System
+#include <list>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+/*! \brief Number of finite buckets in every histogram */
+#define METRICS_HISTOGRAM_BUCKETS 12
+
+
+enum MetricType {
+  METRIC_COUNTER = 0,
+  METRIC_GAUGE = 1,
+  METRIC_HISTOGRAM = 2
+};
+
+/*! \brief A single value as rendered for Prometheus */
+struct MetricSample {
+  /*! \brief Sample name, including suffixes such as `_bucket' */
+  std::string strName;
+  /*! \brief Label set without braces, e.g. `port="3"' */
+  std::string strLabels;
+  double dValue;
+};
+
+
+/*! \brief Common base for all metrics */
+class CMetric {
+ protected:
+  // Variables
+  std::string m_strName;
+  std::string m_strHelp;
+  std::string m_strLabels;
+  enum MetricType m_enumType;
+
+ public:
+  CMetric(std::string strName, std::string strHelp, std::string strLabels, enum MetricType enumType);
+  virtual ~CMetric();
+
+  std::string name();
+  std::string help();
+  std::string labels();
+  enum MetricType type();
+
+  /*! \brief Appends the metric's current values to the list */
+  virtual void sample(std::list<struct MetricSample> &lstSamples) = 0;
+};
+
+/*! \brief Monotonically increasing counter */
+class CMetricCounter : public CMetric {
+ private:
+  std::atomic<unsigned long> m_ulValue;
+
+ public:
+  CMetricCounter(std::string strName, std::string strHelp, std::string strLabels);
+
+  /*! \brief Increases the counter; a single relaxed atomic add */
+  void increment(unsigned long ulBy = 1) {
+    m_ulValue.fetch_add(ulBy, std::memory_order_relaxed);
+  }
+  unsigned long value();
+
+  void sample(std::list<struct MetricSample> &lstSamples);
+};
+
+/*! \brief Value that can go up and down */
+class CMetricGauge : public CMetric {
+ private:
+  std::atomic<long> m_lValue;
+
+ public:
+  CMetricGauge(std::string strName, std::string strHelp, std::string strLabels);
+
+  void set(long lValue) {
+    m_lValue.store(lValue, std::memory_order_relaxed);
+  }
+  long value();
+
+  void sample(std::list<struct MetricSample> &lstSamples);
+};
+
+/*! \brief Distribution of durations over fixed buckets
+
+  Buckets range from 50 microseconds to 250 milliseconds, which
+  covers everything from a single USB transfer to a stalled main
+  loop. Recording is a bucket search over a dozen values plus three
+  relaxed atomic adds. */
+class CMetricHistogram : public CMetric {
+ private:
+  std::atomic<unsigned long> m_ulBuckets[METRICS_HISTOGRAM_BUCKETS + 1];
+  std::atomic<unsigned long> m_ulCount;
+  /*! \brief Sum of all observations in nanoseconds */
+  std::atomic<unsigned long long> m_ullSumNanoseconds;
+
+ public:
+  CMetricHistogram(std::string strName, std::string strHelp, std::string strLabels);
+
+  /*! \brief Upper bounds of the finite buckets, in seconds */
+  static const double s_dBounds[METRICS_HISTOGRAM_BUCKETS];
+
+  /*! \brief Records a duration in seconds */
+  void observe(double dSeconds);
+  /*! \brief Records the time passed since the given point in time */
+  void observeSince(std::chrono::steady_clock::time_point tpStart);
+  unsigned long count();
+
+  void sample(std::list<struct MetricSample> &lstSamples);
+};
+
+
+/*! \brief Registry of all metrics the library maintains
+
+  Metrics are registered once (usually when the instrumented object
+  is created) and then updated through the returned pointer with
+  relaxed atomic operations only, so instrumenting hot paths costs
+  next to nothing. Registering a name and label set that exists
+  already returns the existing metric. Per-link metrics are told
+  apart by a `transport` label (see CTransport::metricLabels()).
+
+  snapshot() returns all current values, renderPrometheus() the
+  Prometheus text exposition format, which can also be written to a
+  file (for the node exporter's textfile collector) or a local
+  socket. */
+class CMetrics {
+ private:
+  // Variables
+  std::mutex m_mtxMetrics;
+  /*! \brief All metrics, ordered by name so that every family is
+      one contiguous group; never shrinks, so pointers handed out
+      stay valid */
+  std::list<CMetric*> m_lstMetrics;
+
+  // Functions
+  CMetrics();
+  ~CMetrics();
+
+  CMetric *find(std::string strName, std::string strLabels);
+  CMetric *add(CMetric *mtMetric);
+
+ public:
+  /*! \brief The registry shared by the whole library */
+  static CMetrics *instance();
+
+  CMetricCounter *counter(std::string strName, std::string strHelp, std::string strLabels = "");
+  CMetricGauge *gauge(std::string strName, std::string strHelp, std::string strLabels = "");
+  CMetricHistogram *histogram(std::string strName, std::string strHelp, std::string strLabels = "");
+
+  /*! \brief Current values of all metrics */
+  std::list<struct MetricSample> snapshot();
+  /*! \brief All metrics in the Prometheus text exposition format */
+  std::string renderPrometheus();
+
+  /*! \brief Writes renderPrometheus() to a file
+
+    The text is written to a temporary file first and then renamed,
+    so readers never see a partially written file.
+
+    \param strPath Path of the file
+    \return Returns 'true' on success */
+  bool writeToFile(std::string strPath);
+  /*! \brief Writes renderPrometheus() to a Unix domain socket
+
+    \param strPath Path of the socket to connect to
+    \return Returns 'true' on success */
+  bool writeToSocket(std::string strPath);
+};
+
+
+#endif /* __C_METRICS_H__ */
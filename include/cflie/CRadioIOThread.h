@@ -0,0 +1,200 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+#ifndef __C_RADIO_IO_THREAD_H__
+#define __C_RADIO_IO_THREAD_H__
+
+
+// System
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+// Private
+#include "CTransport.h"
+#include "CCRTPPacket.h"
+#include "CSPSCQueue.h"
+#include "CUplinkScheduler.h"
+
+
+/*! \brief Capacity of the queues between the I/O thread and the
+    application */
+#define RADIO_IO_QUEUE_SIZE 256
+/*! \brief Milliseconds sendAndReceive() waits for a reply before
+    submitting its request again */
+#define RADIO_IO_RESEND_INTERVAL 20
+
+
+/*! \brief Library-owned thread performing all traffic of one
+    transport (usually a CCrazyRadio)
+
+  While the thread is running it is the only user of the transport
+  instance: CCrazyflie and CTOC (see CTOC::setIOThread()) forward
+  their traffic to the thread instead of using the transport, and
+  code using the transport on its own must do the same. Application
+  threads hand packets to send over through
+  sendPacket(), which passes them to a CUplinkScheduler by traffic
+  class, so setpoints and emergency packets overtake configuration
+  traffic and stale setpoints are replaced instead of queued. Any
+  number of threads may send. Replies are picked up through
+  receivedPacket(), which uses a bounded single-producer/single-consumer
+  queue, so exactly one application thread may receive;
+  sendAndReceive() combines both for request/reply traffic such as
+  TOC and logging configuration. Logging frames
+  stay in the transport's lock-free logging ring and are decoded from
+  there through drainLogging().
+
+  When nothing is queued for sending, dummy packets are sent to keep
+  the link alive and to give the copter the chance to send data
+  back. That way, the radio link doesn't depend on how often the
+  application gets to run. */
+class CRadioIOThread {
+ private:
+  // Variables
+  /*! \brief The transport owned by the thread while it is
+      running */
+  CTransport *m_crRadio;
+  /*! \brief The thread itself */
+  std::thread m_thrdIO;
+  /*! \brief Keeps the thread alive while true */
+  std::atomic<bool> m_bRunning;
+  /*! \brief ACK state of the last packet sent */
+  std::atomic<bool> m_bAckReceived;
+  /*! \brief USB state as of the last packet sent */
+  std::atomic<bool> m_bUSBOK;
+  /*! \brief Number of packets dropped because a queue was full */
+  std::atomic<unsigned long> m_ulDroppedPackets;
+  /*! \brief The transport's logging consumer, set aside while the
+      thread is running */
+  CCRTPConsumer *m_ccLoggingConsumer;
+  /*! \brief Packets waiting to be sent (application -> thread) */
+  CUplinkScheduler m_usScheduler;
+  /*! \brief Non-logging replies received (thread -> application) */
+  CSPSCQueue<CCRTPPacket*, RADIO_IO_QUEUE_SIZE> m_spscIncoming;
+
+  // Functions
+  void run();
+  void handleReply(CCRTPPacket *crtpReceived);
+  void clearQueues();
+
+ public:
+  /*! \brief Constructor for the I/O thread class
+
+    The thread is not started yet.
+
+    \param crRadio Started radio (or other transport) instance the
+    thread will work with */
+  CRadioIOThread(CTransport *crRadio);
+  /*! \brief Destructor, stops the thread if it is still running and
+      deletes all packets still queued */
+  ~CRadioIOThread();
+
+  /*! \brief Starts the I/O thread
+
+    From now on, the transport must not be used directly anymore until
+    stop() was called.
+
+    \return Returns 'true' if the thread is running */
+  bool start();
+  /*! \brief Stops the I/O thread and waits for it to finish
+
+    Packets still queued for sending are dropped. */
+  void stop();
+  /*! \brief Whether or not the I/O thread is running */
+  bool running();
+
+  /*! \brief Set the minimum time between keepalive packets
+
+    \param dSeconds Period in seconds; 0 keeps the link as busy as
+    possible */
+  void setKeepalivePeriod(double dSeconds);
+  /*! \brief The scheduler deciding which packet goes out next, e.g.
+      for setting rate limits */
+  CUplinkScheduler *scheduler();
+
+  /*! \brief Queues a packet for sending
+
+    The thread takes ownership of the packet and deletes it after
+    sending.
+
+    \param crtpSend The packet to send
+    \param enumClass Traffic class of the packet
+    \return Returns 'false' if the queue is full. The packet is
+    deleted in this case, too. */
+  bool sendPacket(CCRTPPacket *crtpSend, enum TrafficClass enumClass = TRAFFIC_CONFIGURATION);
+  /*! \brief Takes the next non-logging reply received
+
+    \return The received packet, which must be deleted by the caller,
+    or NULL if nothing was received. */
+  CCRTPPacket *receivedPacket();
+  /*! \brief Sends a request as configuration traffic and waits for
+      its reply
+
+    The counterpart of CTransport::sendAndReceive() while the thread
+    is running. The request is submitted again every
+    RADIO_IO_RESEND_INTERVAL milliseconds until a reply on its port
+    and channel arrives whose payload starts with the first
+    nMatchLength payload bytes of the request, or the transport's
+    request timeout passes. Other replies taken from the receiving
+    queue in the meantime are dropped, so this must be called from
+    the thread that receives.
+
+    \param crtpSend The request; stays with the caller unless
+    bDeleteAfterwards is set
+    \param bDeleteAfterwards Whether to delete the request when
+    done
+    \param nMatchLength Number of leading payload bytes to match
+    the reply on
+    \return The reply (to be deleted by the caller), or NULL if
+    none arrived in time */
+  CCRTPPacket *sendAndReceive(CCRTPPacket *crtpSend, bool bDeleteAfterwards = true, int nMatchLength = 0);
+  /*! \brief Decodes the logging frames received so far
+
+    \param ccConsumer The consumer the frames are handed to
+    \return The number of frames decoded */
+  unsigned int drainLogging(CCRTPConsumer *ccConsumer);
+
+  /*! \brief Whether the last packet sent by the thread was
+      acknowledged */
+  bool ackReceived();
+  /*! \brief Whether the USB connection was operational when the
+      thread sent its last packet */
+  bool usbOK();
+  /*! \brief Number of replies dropped because the application
+      didn't empty the receiving queue in time */
+  unsigned long droppedPackets();
+};
+
+
+#endif /* __C_RADIO_IO_THREAD_H__ */
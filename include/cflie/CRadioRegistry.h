@@ -0,0 +1,150 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_RADIO_REGISTRY_H__
+#define __C_RADIO_REGISTRY_H__
+
+
+// System
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <libusb-1.0/libusb.h>
+
+
+/*! \brief A CrazyRadio dongle found on the USB bus */
+struct DongleInfo {
+  /*! \brief The referenced libusb device */
+  libusb_device *devDevice;
+  /*! \brief Bus number the dongle is attached to */
+  int nBus;
+  /*! \brief Port numbers from the root hub to the dongle */
+  std::vector<int> vecPorts;
+  /*! \brief Human readable bus path, e.g. "1-2.4" */
+  std::string strBusPath;
+};
+
+
+/*! \brief Process-wide registry of CrazyRadio dongles
+
+  All CCrazyRadio instances share one libusb context, one list of
+  attached dongles and one thread handling libusb events for their
+  asynchronous transfers. The registry is created by the first radio
+  and destroyed when the last one goes away (see acquire() and
+  release()).
+
+  Dongles are numbered by their position on the USB bus (bus number
+  first, then the port path), so "radio://1/..." keeps referring to
+  the same physical port across runs and replugging. */
+class CRadioRegistry {
+ private:
+  // Variables
+  /*! \brief The single instance, if any */
+  static CRadioRegistry *s_rrInstance;
+  /*! \brief Number of users of the single instance */
+  static int s_nUsers;
+  /*! \brief Guards s_rrInstance and s_nUsers */
+  static std::mutex s_mtxInstance;
+
+  /*! \brief The shared libusb context */
+  libusb_context *m_ctxContext;
+  /*! \brief The dongles found during the last enumeration, in
+      dongle number order */
+  std::vector<struct DongleInfo> m_vecDongles;
+  /*! \brief Guards m_vecDongles */
+  std::mutex m_mtxDongles;
+  /*! \brief Thread running the shared libusb event loop */
+  std::thread m_thrdEvents;
+  /*! \brief Number of radios currently needing the event loop */
+  int m_nEventUsers;
+  /*! \brief Keeps the event handling thread alive while true */
+  std::atomic<bool> m_bEventsRunning;
+  /*! \brief Guards m_nEventUsers and the event thread */
+  std::mutex m_mtxEvents;
+
+  // Functions
+  CRadioRegistry();
+  ~CRadioRegistry();
+
+  void clearDongles();
+  void eventLoop();
+  static bool dongleBefore(const struct DongleInfo &diA, const struct DongleInfo &diB);
+
+ public:
+  /*! \brief Returns the registry, creating it if necessary
+
+    Every call must be matched by a call to release(). */
+  static CRadioRegistry *acquire();
+  /*! \brief Gives up one reference to the registry
+
+    The libusb context is freed when the last reference is gone. */
+  static void release();
+
+  /*! \brief The libusb context shared by all radios */
+  libusb_context *context();
+
+  /*! \brief Scans the USB bus for CrazyRadio dongles
+
+    Replaces the list of known dongles. This is done automatically
+    the first time a dongle is requested and whenever a requested
+    dongle number isn't known (e.g. after replugging).
+
+    \return Number of dongles found */
+  int enumerate();
+  /*! \brief Number of dongles known from the last enumeration */
+  int dongleCount();
+  /*! \brief Bus path of the given dongle, empty if unknown */
+  std::string dongleBusPath(int nDongle);
+  /*! \brief Returns the device for the given dongle number
+
+    \param nDongle Dongle number as used in radio URIs
+    \return Referenced libusb device (to be unreferenced by the
+    caller) or NULL if there is no such dongle */
+  libusb_device *deviceForDongle(int nDongle);
+
+  /*! \brief Registers a user of the shared event loop
+
+    Starts the event handling thread if it isn't running yet. */
+  void startEvents();
+  /*! \brief Unregisters a user of the shared event loop
+
+    Stops the event handling thread when nobody needs it anymore. */
+  void stopEvents();
+};
+
+
+#endif /* __C_RADIO_REGISTRY_H__ */
@@ -0,0 +1,80 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_RADIO_TARGET_H__
+#define __C_RADIO_TARGET_H__
+
+
+// Private
+#include "CTransport.h"
+#include "CCrazyRadio.h"
+
+
+/*! \brief One of several copters sharing a CCrazyRadio dongle
+
+  A target is the transport for a single copter reached through a
+  shared radio. It carries the copter's channel, datarate and
+  address and asks the radio to switch to them for every packet it
+  sends. Since each target processes its own replies, logging and
+  console packets are separated per copter.
+
+  Targets are created by CCrazyRadio::createTarget() and belong to
+  the radio. */
+class CRadioTarget : public CTransport {
+ private:
+  // Variables
+  /*! \brief The radio this target sends through */
+  CCrazyRadio *m_crRadio;
+  /*! \brief The settings needed to reach this target's copter */
+  struct RadioContext m_rcContext;
+
+ protected:
+  bool transmitData(char *cData, int nLength, CCRTPView &cvReply);
+
+ public:
+  /*! \brief Constructor for a radio target
+
+    \param crRadio The radio the target sends through
+    \param rcContext Settings needed to reach the copter */
+  CRadioTarget(CCrazyRadio *crRadio, struct RadioContext rcContext);
+  ~CRadioTarget();
+
+  /*! \brief The settings needed to reach this target's copter */
+  struct RadioContext context();
+
+  /*! \brief Whether the radio's USB connection is operational */
+  bool usbOK();
+};
+
+
+#endif /* __C_RADIO_TARGET_H__ */
@@ -0,0 +1,129 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_REQUEST_FUTURE_H__
+#define __C_REQUEST_FUTURE_H__
+
+
+// System
+#include <unistd.h>
+
+// Private
+#include "CCRTPPacket.h"
+
+
+class CTransport;
+
+
+/*! \brief State of a request submitted to a transport */
+enum RequestState {
+  /*! \brief Waiting for the reply */
+  REQUEST_PENDING = 0,
+  /*! \brief The reply arrived */
+  REQUEST_ANSWERED = 1,
+  /*! \brief The deadline passed before the reply arrived */
+  REQUEST_EXPIRED = 2,
+  /*! \brief The request was cancelled, or the handle is empty */
+  REQUEST_CANCELLED = 3
+};
+
+
+/*! \brief Handle to the reply of a request
+
+  Returned by CTransport::request(). The handle can be polled,
+  waited on or cancelled; once the request was answered, the reply
+  can be taken from it. Expiry is reported as a state of its own, so
+  a copter out of range shows up as REQUEST_EXPIRED instead of a
+  hang.
+
+  Transports aren't thread-safe: somebody has to drive the exchanges
+  that bring in replies, either by calling wait() or
+  CTransport::pumpRequests(), from the thread that uses the
+  transport.
+
+  Handles can be moved but not copied. A handle going away cancels
+  its request and deletes a reply that wasn't taken. Handles must
+  not outlive their transport. */
+class CRequestFuture {
+ private:
+  // Variables
+  CTransport *m_ctTransport;
+  long m_lID;
+  /*! \brief Final state once known, REQUEST_PENDING before */
+  enum RequestState m_enumState;
+  /*! \brief The reply once answered and not taken yet */
+  CCRTPPacket *m_crtpReply;
+
+  // Functions
+  void release();
+
+ public:
+  /*! \brief Creates an empty handle (state REQUEST_CANCELLED) */
+  CRequestFuture();
+  CRequestFuture(CTransport *ctTransport, long lID);
+  CRequestFuture(CRequestFuture &&rfOther);
+  ~CRequestFuture();
+
+  CRequestFuture &operator=(CRequestFuture &&rfOther);
+  CRequestFuture(const CRequestFuture &rfOther) = delete;
+  CRequestFuture &operator=(const CRequestFuture &rfOther) = delete;
+
+  /*! \brief Checks the state of the request without exchanging any
+      data
+
+    \return The current state of the request */
+  enum RequestState poll();
+  /*! \brief Exchanges data until the request is answered or
+      expired
+
+    \param nMicrosecondsWait Microseconds to wait between two
+    exchanges
+    \return The final state of the request */
+  enum RequestState wait(int nMicrosecondsWait = 100);
+  /*! \brief Cancels the request; its reply will be routed as
+      unsolicited if it arrives later */
+  void cancel();
+
+  /*! \brief Takes the reply
+
+    \return The reply (to be deleted by the caller), or NULL if the
+    request wasn't answered or the reply was taken before */
+  CCRTPPacket *reply();
+  /*! \brief ID of the request within its transport */
+  long id();
+  /*! \brief The transport the request was sent through */
+  CTransport *transport();
+};
+
+
+#endif /* __C_REQUEST_FUTURE_H__ */
@@ -0,0 +1,121 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+#ifndef __C_SPSC_QUEUE_H__
+#define __C_SPSC_QUEUE_H__
+
+
+// System
+#include <atomic>
+
+
+/*! \brief Bounded, lock-free single-producer/single-consumer queue
+
+  Exactly one thread may call push() and exactly one (other) thread
+  may call pop(). Neither operation blocks or allocates; push()
+  fails when the queue is full and pop() fails when it is empty.
+
+  \tparam T Element type, usually a pointer
+  \tparam N Capacity of the queue, must be a power of two */
+template<typename T, unsigned int N>
+class CSPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "Queue capacity must be a power of two");
+
+ private:
+  /*! \brief Element storage */
+  T m_tElements[N];
+  /*! \brief Number of elements pushed so far (written by the
+      producer only) */
+  std::atomic<unsigned int> m_unHead;
+  /*! \brief Number of elements popped so far (written by the
+      consumer only) */
+  std::atomic<unsigned int> m_unTail;
+
+ public:
+  CSPSCQueue() : m_unHead(0), m_unTail(0) {
+  }
+
+  /*! \brief Appends an element to the queue (producer side)
+
+    \param tElement The element to append
+    \return Returns 'false' if the queue was full */
+  bool push(const T &tElement) {
+    unsigned int unHead = m_unHead.load(std::memory_order_relaxed);
+
+    if(unHead - m_unTail.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+
+    m_tElements[unHead & (N - 1)] = tElement;
+    m_unHead.store(unHead + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /*! \brief Removes the oldest element from the queue (consumer
+      side)
+
+    \param tElement Receives the element removed
+    \return Returns 'false' if the queue was empty */
+  bool pop(T &tElement) {
+    unsigned int unTail = m_unTail.load(std::memory_order_relaxed);
+
+    if(m_unHead.load(std::memory_order_acquire) == unTail) {
+      return false;
+    }
+
+    tElement = m_tElements[unTail & (N - 1)];
+    m_unTail.store(unTail + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /*! \brief Number of elements currently queued
+
+    Only a snapshot when called while the other side is active. */
+  unsigned int size() {
+    return m_unHead.load(std::memory_order_acquire) - m_unTail.load(std::memory_order_acquire);
+  }
+
+  /*! \brief Whether or not the queue is currently empty */
+  bool empty() {
+    return this->size() == 0;
+  }
+
+  /*! \brief Maximum number of elements the queue can hold */
+  unsigned int capacity() {
+    return N;
+  }
+};
+
+
+#endif /* __C_SPSC_QUEUE_H__ */
@@ -0,0 +1,161 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_SETPOINT_STREAMER_H__
+#define __C_SETPOINT_STREAMER_H__
+
+
+// System
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+// Private
+#include "CCRTPPacket.h"
+#include "CRadioIOThread.h"
+#include "CMetrics.h"
+
+
+#ifndef NSEC_PER_SEC
+#define NSEC_PER_SEC 1000000000L
+#endif
+
+/*! \brief Highest rate setpoints can be streamed at, in Hz */
+#define SETPOINT_STREAM_MAX_FREQUENCY 1000
+
+
+/*! \brief Timing statistics of a setpoint stream */
+struct StreamStatistics {
+  /*! \brief Number of periods the stream woke up for */
+  unsigned long ulPeriods;
+  /*! \brief Number of periods skipped because the thread woke up
+      too late to make their deadline */
+  unsigned long ulOverruns;
+  /*! \brief Mean delay between a deadline and the actual wakeup,
+      in seconds */
+  double dMeanJitter;
+  /*! \brief Largest delay between a deadline and the actual wakeup,
+      in seconds */
+  double dMaxJitter;
+};
+
+
+/*! \brief Thread sending the latest setpoint at a fixed rate
+
+  Instead of depending on how often the application calls
+  CCrazyflie::cycle(), the streamer sleeps until absolute deadlines
+  on CLOCK_MONOTONIC (`clock_nanosleep()` with `TIMER_ABSTIME`), so
+  that sleeping doesn't accumulate drift. Every period, the most
+  recent setpoint handed over through setSetpoint() is passed to the
+  I/O thread as setpoint traffic, where it overtakes configuration
+  packets and replaces a setpoint that wasn't sent yet.
+
+  The delay between each deadline and the actual wakeup is recorded
+  as jitter. When the thread wakes up a whole period late or more,
+  the missed deadlines are counted as overruns and skipped instead
+  of being caught up in a burst. */
+class CSetpointStreamer {
+ private:
+  // Variables
+  /*! \brief The transport the packets are allocated from */
+  CTransport *m_crRadio;
+  /*! \brief The I/O thread the setpoints are handed to */
+  CRadioIOThread *m_rioThread;
+  /*! \brief The streaming thread itself */
+  std::thread m_thrdStream;
+  /*! \brief Keeps the thread alive while true */
+  std::atomic<bool> m_bRunning;
+  /*! \brief Period between two setpoints in nanoseconds */
+  long m_lPeriod;
+  /*! \brief Guards the setpoint payload */
+  std::mutex m_mtxSetpoint;
+  /*! \brief Payload of the latest setpoint */
+  char m_cSetpoint[CRTP_MAX_DATA_LENGTH];
+  /*! \brief Length of the latest setpoint; 0 while there is none */
+  int m_nSetpointLength;
+  /*! \brief Guards the statistics */
+  std::mutex m_mtxStatistics;
+  struct StreamStatistics m_ssStatistics;
+  /*! \brief Sum of all jitter values, for the mean */
+  double m_dJitterSum;
+  CMetricHistogram *m_mhJitter;
+  CMetricCounter *m_mcOverruns;
+
+  // Functions
+  void run();
+  bool sendSetpoint();
+  void recordPeriod(double dJitter, unsigned long ulOverruns);
+
+ public:
+  /*! \brief Constructor for the streamer class
+
+    The thread is not started yet.
+
+    \param crRadio The transport packets are allocated for
+    \param rioThread The I/O thread driving the transport */
+  CSetpointStreamer(CTransport *crRadio, CRadioIOThread *rioThread);
+  /*! \brief Destructor, stops the thread if it is still running */
+  ~CSetpointStreamer();
+
+  /*! \brief Starts streaming
+
+    \param dFrequency Setpoints per second, at most
+    SETPOINT_STREAM_MAX_FREQUENCY
+    \return Returns 'false' if the frequency isn't positive */
+  bool start(double dFrequency);
+  /*! \brief Stops streaming and waits for the thread to finish */
+  void stop();
+  /*! \brief Whether or not the stream is running */
+  bool running();
+  /*! \brief Period between two setpoints in seconds */
+  double period();
+
+  /*! \brief Set the setpoint sent from the next period on
+
+    \param cPayload The CRTP payload of a setpoint packet (port 3)
+    \param nLength Length of the payload in bytes */
+  void setSetpoint(const char *cPayload, int nLength);
+
+  /*! \brief Timing statistics since the stream was started or the
+      statistics were reset */
+  struct StreamStatistics statistics();
+  /*! \brief Sets all timing statistics back to zero */
+  void resetStatistics();
+};
+
+
+#endif /* __C_SETPOINT_STREAMER_H__ */
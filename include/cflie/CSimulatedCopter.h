@@ -0,0 +1,199 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_SIMULATED_COPTER_H__
+#define __C_SIMULATED_COPTER_H__
+
+
+// System
+#include <list>
+#include <deque>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <ctime>
+#include <stdint.h>
+
+// Private
+#include "CTransport.h"
+
+
+/*! \brief A variable advertised in one of the simulated TOCs */
+struct SimulatedVariable {
+  /*! \brief The string group name of the variable */
+  std::string strGroup;
+  /*! \brief The string identifier of the variable */
+  std::string strIdentifier;
+  /*! \brief The (ref) type of the variable, as used by CTOC */
+  int nType;
+  /*! \brief The current value of the variable */
+  double dValue;
+};
+
+/*! \brief A logging block configured on the simulated copter */
+struct SimulatedLogBlock {
+  int nID;
+  /*! \brief Period between two logging packets in seconds */
+  double dPeriod;
+  bool bStarted;
+  /*! \brief Point in time at which the next packet is due */
+  double dNextDue;
+  /*! \brief Indices of the variables contained in the block */
+  std::list<int> lstVariables;
+};
+
+
+/*! \brief In-process simulation of a Crazyflie Nano behind a radio
+
+  Implements the CTransport interface without any hardware. The
+  simulated copter answers TOC requests for the parameter (port 2)
+  and logging (port 5) TOCs, handles creating, filling, starting and
+  stopping logging blocks, accepts setpoints and sends logging
+  packets at the rates requested by the logging blocks.
+
+  Just like on the real copter, data can only travel back inside
+  ACKs. Replies and logging packets are kept in a bounded downlink
+  queue which is emptied one packet per exchange; packets that don't
+  fit are dropped.
+
+  Per-exchange latency and packet loss can be configured to mimic
+  real radio links. This allows benchmarking and load-testing the
+  whole library stack on machines without a dongle and copter. */
+class CSimulatedCopter : public CTransport {
+ private:
+  // Variables
+  /*! \brief Contents of the logging TOC */
+  std::vector<struct SimulatedVariable> m_vecLogVariables;
+  /*! \brief Contents of the parameter TOC */
+  std::vector<struct SimulatedVariable> m_vecParameters;
+  /*! \brief Logging blocks currently configured */
+  std::list<struct SimulatedLogBlock> m_lstLogBlocks;
+  /*! \brief Packets waiting to be sent back inside an ACK (header
+      byte included) */
+  std::deque<std::string> m_dqDownlink;
+  /*! \brief Holds the reply of the last exchange */
+  char m_cReceiveBuffer[TRANSPORT_BUFFER_SIZE];
+  unsigned int m_unDownlinkCapacity;
+  /*! \brief Packet counters, readable while an I/O thread drives
+      the simulation */
+  std::atomic<unsigned long> m_ulDownlinkOverflows;
+  std::atomic<unsigned long> m_ulPacketsReceived;
+  std::atomic<unsigned long> m_ulPacketsLost;
+  /*! \brief Time spent in every exchange, in microseconds */
+  int m_nLatency;
+  /*! \brief Probability of a packet getting lost, 0.0 - 1.0 */
+  double m_dLossRate;
+  std::mt19937 m_mtRandom;
+  std::uniform_real_distribution<double> m_urdLoss;
+  double m_dStartTime;
+
+  // Functions
+  void addDefaultVariables();
+  double currentTime();
+  int typeSize(int nType);
+  void encodeValue(char *cBuffer, int nType, double dValue);
+  int indexForName(std::vector<struct SimulatedVariable> &vecVariables, std::string strName);
+  uint32_t tocCRC(std::vector<struct SimulatedVariable> &vecVariables);
+  struct SimulatedLogBlock *logBlockForID(int nID);
+  int logBlockSize(struct SimulatedLogBlock *slbBlock);
+
+  void queueDownlink(int nPort, int nChannel, const char *cData, int nLength);
+  void handlePacket(int nPort, int nChannel, char *cData, int nLength);
+  void handleTOC(std::vector<struct SimulatedVariable> &vecVariables, int nPort, char *cData, int nLength);
+  void handleLogControl(char *cData, int nLength);
+  void handleSetpoint(char *cData, int nLength);
+  void emitLogPackets(double dNow);
+
+ protected:
+  bool transmitData(char *cData, int nLength, CCRTPView &cvReply);
+
+ public:
+  /*! \brief Constructor for the simulated copter
+
+    The TOCs are populated with the variables CCrazyflie uses by
+    default (stabilizer, gyroscope, accelerometer, battery,
+    magnetometer and altimeter). */
+  CSimulatedCopter();
+  ~CSimulatedCopter();
+
+  /*! \brief Set the time every packet exchange takes
+
+    \param nMicroseconds Latency per exchange in microseconds */
+  void setLatency(int nMicroseconds);
+  /*! \brief Set the probability of packets getting lost
+
+    A lost packet is neither processed by the copter nor
+    acknowledged.
+
+    \param dLossRate Loss probability between 0.0 and 1.0 */
+  void setLossRate(double dLossRate);
+  /*! \brief Set the number of packets the copter can hold back
+      before dropping new ones
+
+    \param unCapacity Capacity of the downlink queue */
+  void setDownlinkCapacity(unsigned int unCapacity);
+
+  /*! \brief Adds a variable to the logging TOC
+
+    \return The ID of the new variable */
+  int addLogVariable(std::string strGroup, std::string strIdentifier, int nType, double dValue = 0);
+  /*! \brief Adds a variable to the parameter TOC
+
+    \return The ID of the new parameter */
+  int addParameter(std::string strGroup, std::string strIdentifier, int nType, double dValue = 0);
+  /*! \brief Set the value reported for a logging variable
+
+    \param strName Full name (`group.identifier`) of the variable
+    \param dValue The value to report from now on
+    \return Returns 'false' if there is no such variable */
+  bool setLogValue(std::string strName, double dValue);
+
+  /*! \brief The simulated link never fails */
+  bool usbOK();
+
+  /*! \brief Number of packets that reached the copter */
+  unsigned long packetsReceived();
+  /*! \brief Number of packets lost on the way to the copter */
+  unsigned long packetsLost();
+  /*! \brief Number of downlink packets dropped because the host
+      didn't pick them up in time */
+  unsigned long downlinkOverflows();
+};
+
+
+#endif /* __C_SIMULATED_COPTER_H__ */
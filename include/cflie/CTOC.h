@@ -35,13 +35,58 @@
 
 // System
 #include <list>
+#include <vector>
 #include <string>
+#include <unordered_map>
 #include <cstdlib>
+#include <ctime>
+#include <cstdio>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iostream>
 
 // Private
-#include "CCrazyRadio.h"
+#include "CTransport.h"
+#include "CRadioIOThread.h"
 #include "CCRTPPacket.h"
+#include "CCRTPView.h"
+#include "CTimeSeries.h"
+
+
+/*! \brief Identifies TOC cache files ("CFTC") */
+#define TOC_CACHE_MAGIC 0x43544643
+/*! \brief Layout version of TOC cache files */
+#define TOC_CACHE_VERSION 1
+/*! \brief Room for an element's group and identifier in a TOC cache
+    file, both NUL-terminated just like in the copter's replies */
+#define TOC_CACHE_NAME_LENGTH 28
+
+
+/*! \brief Header of a TOC cache file */
+struct TOCCacheHeader {
+  uint32_t u32Magic;
+  uint32_t u32Version;
+  /*! \brief The port of the TOC (2 for parameters, 5 for logging) */
+  uint32_t u32Port;
+  /*! \brief The CRC the copter reported for the TOC */
+  uint32_t u32CRC;
+  /*! \brief Number of records following the header */
+  uint32_t u32Count;
+};
+
+/*! \brief One element in a TOC cache file
+
+  Records have a fixed size, so a mapped cache file is read in place
+  without any parsing. */
+struct TOCCacheRecord {
+  int32_t n32ID;
+  int32_t n32Type;
+  /*! \brief Group and identifier, each NUL-terminated */
+  char cNames[TOC_CACHE_NAME_LENGTH];
+};
 
 
 /*! \brief Storage element for logged variable identities */
@@ -56,43 +101,213 @@ struct TOCElement {
   /*! \brief The string identifier of the log element */
   std::string strIdentifier;
   bool bIsLogging;
+  /*! \brief The value of the element at the time it was looked
+      up */
   double dValue;
 };
 
+/*! \brief Resolved reference to a TOC element
+
+  Resolving a name once through CTOC::handleForName() and reading
+  through the handle afterwards avoids building and comparing names
+  for every read; a read is an index into the TOC's value array. */
+struct TOCHandle {
+  /*! \brief Index of the element in its TOC, -1 if the name wasn't
+      found */
+  int nIndex;
+  /*! \brief The (ref) type of the element */
+  int nType;
+};
+
 
 struct LoggingBlock {
   std::string strName;
   int nID;
   double dFrequency;
   std::list<int> lstElementIDs;
+  /*! \brief Logging frames decoded for this block */
+  CMetricCounter *mcDecoded;
+};
+
+
+/*! \brief Where one variable's value is found in a logging frame */
+struct DecodeStep {
+  /*! \brief Offset of the value behind the frame's header (header
+      byte, block ID and timestamp) */
+  int nOffset;
+  /*! \brief The (ref) type the value is sent as */
+  int nType;
+  /*! \brief Number of bytes the value takes up */
+  int nLength;
+  /*! \brief Index of the variable in the TOC's value array */
+  int nIndex;
 };
 
+/*! \brief Decode plan of one logging block
 
-class CTOC {
+  Compiled while variables are added to the block, so decoding a
+  frame is a single pass over the steps without any lookups. */
+struct DecodePlan {
+  /*! \brief One step per variable, in the order they are sent */
+  std::vector<struct DecodeStep> vecSteps;
+  /*! \brief Length of the block's values in bytes */
+  int nLength;
+  /*! \brief Logging frames decoded for the block */
+  CMetricCounter *mcDecoded;
+};
+
+
+class CTOC : public CCRTPConsumer {
  private:
   int m_nPort;
-  CCrazyRadio *m_crRadio;
+  CTransport *m_crRadio;
+  /*! \brief Takes over the requests while it is running, NULL if
+      there is none */
+  CRadioIOThread *m_rioThread;
   int m_nItemCount;
-  std::list<struct TOCElement> m_lstTOCElements;
+  /*! \brief The CRC the copter reported for its TOC */
+  uint32_t m_u32CRC;
+  /*! \brief Whether the copter reported a CRC at all */
+  bool m_bHasCRC;
+  /*! \brief Directory TOC cache files are kept in; empty if
+      caching is disabled */
+  std::string m_strCacheDirectory;
+  /*! \brief The TOC elements in the order they were received */
+  std::vector<struct TOCElement> m_vecTOCElements;
+  /*! \brief Current values of the elements, same order as
+      m_vecTOCElements */
+  std::vector<double> m_vecValues;
+  /*! \brief Maps full names (`group.identifier`) to element
+      indices */
+  std::unordered_map<std::string, int> m_mapNameIndex;
+  /*! \brief Maps element IDs to element indices */
+  std::unordered_map<int, int> m_mapIDIndex;
+  /*! \brief Sample histories of the elements, same order as
+      m_vecTOCElements; NULL for elements without one */
+  std::vector<CTimeSeries*> m_vecHistories;
+  /*! \brief Decode plans of the logging blocks, by block ID */
+  std::unordered_map<int, struct DecodePlan> m_mapDecodePlans;
   std::list<struct LoggingBlock> m_lstLoggingBlocks;
 
   bool requestInitialItem();
   bool requestItem(int nID, bool bInitial);
   bool requestItem(int nID);
-  bool processItem(CCRTPPacket* crtpItem);
 
   CCRTPPacket* sendAndReceive(CCRTPPacket* crtpSend, int nChannel);
+  /*! \brief Sends a request and waits for its reply, through the
+      I/O thread if it is running and directly otherwise
+
+    \param crtpRequest The request, deleted afterwards
+    \param nMatchLength Number of leading payload bytes to match the
+    reply on
+    \return The reply (to be deleted by the caller), or NULL */
+  CCRTPPacket* exchangeRequest(CCRTPPacket* crtpRequest, int nMatchLength);
+
+  /*! \brief Number of bytes a value of the given (ref) type takes
+      up in a logging frame */
+  static int typeLength(int nType);
+  /*! \brief Decodes a single value sent as the given (ref) type */
+  static float decodeValue(const char* cLogdata, int nType);
+  /*! \brief Seconds on CLOCK_MONOTONIC, used to timestamp
+      samples */
+  static double currentTime();
+
+  /*! \brief Adds an element, or replaces the one with the same ID */
+  void addElement(int nID, int nType, std::string strGroup, std::string strIdentifier);
+  /*! \brief Path of the cache file for this TOC's current CRC */
+  std::string cachePath();
 
  public:
-  CTOC(CCrazyRadio* crRadio, int nPort);
+  CTOC(CTransport* crRadio, int nPort);
   ~CTOC();
 
   bool sendTOCPointerReset();
   bool requestMetaData();
+  /*! \brief Downloads all items once the metadata is known
+
+    Several item requests are kept in flight at a time (see
+    CTOCFetcher); to download more than one TOC at once, use a
+    CTOCFetcher directly.
+
+    \return Returns 'false' if an item didn't arrive even after
+    retrying */
   bool requestItems();
 
+  /*! \brief Set the I/O thread that owns the transport while it
+      is running
+
+    While the thread runs, TOC and logging configuration requests go
+    through it as configuration traffic (see
+    CRadioIOThread::sendAndReceive()) instead of using the transport
+    directly. requestItems() then requests one item after the other,
+    as CTOCFetcher needs the transport to itself.
+
+    \param rioThread The I/O thread, or NULL */
+  void setIOThread(CRadioIOThread* rioThread);
+  /*! \brief The transport this TOC talks through */
+  CTransport* transport();
+  /*! \brief Number of items the copter reported for this TOC */
+  int itemCount();
+  /*! \brief The CRC the copter reported for this TOC */
+  uint32_t crc();
+
+  /*! \brief Set the directory downloaded TOCs are cached in
+
+    The copter reports a CRC of its TOC along with the metadata
+    (see requestMetaData()). With a cache directory set,
+    requestItems() first looks for a cache file of the TOC with that
+    CRC and only downloads the items if there is none; downloaded
+    TOCs are then stored for the next connection. Cache files are
+    named after the port and the CRC, so any number of firmwares can
+    share a directory.
+
+    Default value: empty, i.e. no caching
+
+    \param strDirectory An existing, writable directory */
+  void setCacheDirectory(std::string strDirectory);
+  std::string cacheDirectory();
+  /*! \brief Loads the items from the cache file matching the CRC
+
+    \return Returns 'false' if caching is disabled, the copter
+    didn't report a CRC or there is no valid cache file for it */
+  bool loadCache();
+  /*! \brief Stores the items in the cache file matching the CRC
+
+    \return Returns 'false' if caching is disabled, the copter
+    didn't report a CRC, not all items are known or writing failed */
+  bool saveCache();
+
+  // Request packets and reply processing for the TOC protocol. The
+  // blocking functions above and below are built from these; they
+  // can be used to run the protocol through CTransport::request()
+  // (or co_await) instead. Requests are allocated from the
+  // transport's pool and must be deleted by the caller. Replies are
+  // matched on their first two payload bytes (command and ID).
+  CCRTPPacket* metaDataRequest();
+  bool processMetaData(CCRTPPacket* crtpReply);
+  CCRTPPacket* itemRequest(int nID);
+  bool processItem(CCRTPPacket* crtpItem);
+  /*! \brief Lowest logging block ID not in use */
+  int freeLoggingBlockID();
+  CCRTPPacket* createBlockRequest(int nID, double dFrequency);
+  /*! \brief Adds the logging block if the copter created it */
+  bool processCreateBlock(CCRTPPacket* crtpReply, std::string strName, int nID, double dFrequency);
+  CCRTPPacket* appendVariableRequest(struct LoggingBlock lbBlock, struct TOCElement teElement);
+  /*! \brief Adds the variable to the logging block if the copter
+      accepted it */
+  bool processAppendVariable(CCRTPPacket* crtpReply, struct LoggingBlock lbBlock, struct TOCElement teElement);
+  CCRTPPacket* startBlockRequest(struct LoggingBlock lbBlock);
+  CCRTPPacket* deleteBlockRequest(int nID);
+
   struct TOCElement elementForName(std::string strName, bool& bFound);
   struct TOCElement elementForID(int nID, bool &bFound);
+  /*! \brief Index of the element with the given ID, -1 if there is
+      none */
+  int indexForID(int nID);
+  /*! \brief Resolves a full name (`group.identifier`) into a handle
+
+    Handles stay valid until the TOC is downloaded again. */
+  struct TOCHandle handleForName(std::string strName);
   int idForName(std::string strName);
   int typeForName(std::string strName);
 
@@ -107,13 +322,46 @@ class CTOC {
   bool isLogging(std::string strName);
 
   double doubleValue(std::string strName);
+  /*! \brief The current value of a resolved element
+
+    \return The value, or 0 for a handle that wasn't resolved */
+  double doubleValue(const struct TOCHandle &thHandle);
+
+  /*! \brief Keeps a history of the values received for an element
+
+    From now on, every value decoded for the element is also
+    appended to a time series together with its receive time, so
+    samples arriving faster than they are read aren't lost. Frames
+    that waited in the transport's logging ring (e.g. in threaded
+    I/O mode) are stamped with the time they were received, not
+    the time they were decoded. Enabling
+    the history again changes its capacity and drops the samples
+    collected so far.
+
+    \param strName Full name (`group.identifier`) of the element
+    \param unCapacity Number of samples kept
+    \return Returns 'false' if there is no such element */
+  bool enableHistory(std::string strName, unsigned int unCapacity);
+  /*! \brief Stops keeping a history for an element and drops it */
+  void disableHistory(std::string strName);
+  /*! \brief The history of an element
+
+    \return The time series, or NULL if no history is kept for the
+    element. It stays owned by the TOC and valid until the history
+    is disabled or enabled again. */
+  CTimeSeries* history(const struct TOCHandle &thHandle);
+  CTimeSeries* history(std::string strName);
 
   bool enableLogging(std::string strBlockName);
 
-  void processPackets(std::list<CCRTPPacket*> lstPackets);
+  /*! \brief Decodes a single logging frame
+
+    Works on the frame in place along the block's decode plan;
+    nothing is looked up, copied or allocated. */
+  void processPacket(const CCRTPView &cvPacket);
+  /*! \brief Decodes logging frames handed over by the transport */
+  void consumeFrame(const CCRTPView &cvFrame);
 
-  int elementIDinBlock(int nBlockID, int nElementIndex);
-  bool setFloatValueForElementID(int nElementID, float fValue);
   bool addElementToBlock(int nBlockID, int nElementID);
   bool unregisterLoggingBlockID(int nID);
 };
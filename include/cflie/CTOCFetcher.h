@@ -0,0 +1,160 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+
+#ifndef __C_TOC_FETCHER_H__
+#define __C_TOC_FETCHER_H__
+
+
+// System
+#include <list>
+#include <vector>
+#include <chrono>
+
+// Private
+#include "CTransport.h"
+#include "CRequestFuture.h"
+
+
+class CTOC;
+
+
+/*! \brief Default number of TOC requests kept in flight at a time */
+#define TOC_FETCH_DEFAULT_WINDOW 8
+/*! \brief Number of times a TOC request is submitted before the
+    whole TOC is given up on */
+#define TOC_FETCH_ATTEMPTS 3
+
+
+/*! \brief Download state of one TOC */
+struct TOCFetch {
+  CTOC *tocTOC;
+  /*! \brief Whether the metadata still has to be requested */
+  bool bMetaData;
+  /*! \brief Lowest item ID not requested yet */
+  int nNextID;
+  /*! \brief Items whose request has to be submitted again */
+  std::list<int> lstRetries;
+  /*! \brief Submissions so far, per item */
+  std::vector<int> vecAttempts;
+  /*! \brief Number of attempts spent on the metadata */
+  int nMetaDataAttempts;
+  /*! \brief Requests of this TOC currently in flight */
+  int nInFlight;
+  bool bDone;
+  bool bFailed;
+};
+
+/*! \brief A TOC request in flight */
+struct FetchRequest {
+  /*! \brief Index of the TOC in the fetcher */
+  int nTOC;
+  /*! \brief The requested item's ID, -1 for the metadata */
+  int nID;
+  CRequestFuture rfReply;
+};
+
+
+/*! \brief Downloads TOCs with several requests in flight
+
+  Instead of requesting one item after the other and waiting for
+  each reply, up to a window of item requests is kept outstanding.
+  Replies are matched to their requests by TOC port, command and
+  item ID (see CTransport::request()), so they can arrive in any
+  order. A request that isn't answered is resent on its own by the
+  transport; one that expires is submitted again, up to
+  TOC_FETCH_ATTEMPTS times, without touching the others.
+
+  Any number of TOCs of the same copter can be fetched at once. Their
+  requests are interleaved, so the parameter and logging TOCs are
+  downloaded side by side instead of back to back. TOCs with a cache
+  file matching their CRC (see CTOC::setCacheDirectory()) aren't
+  downloaded at all, and downloaded ones are cached.
+
+  Fetching is driven either by calling step() regularly (e.g. once
+  per cycle) or by run(), which blocks until all TOCs are done. */
+class CTOCFetcher {
+ private:
+  // Variables
+  CTransport *m_crRadio;
+  int m_nWindow;
+  std::vector<struct TOCFetch> m_vecFetches;
+  std::list<struct FetchRequest> m_lstInFlight;
+  /*! \brief TOC to submit the next request for, so that all TOCs
+      get their turn */
+  int m_nNextTOC;
+
+  // Functions
+  /*! \brief Submits the next request of a TOC, if it has one due
+
+    \return Returns 'false' if the TOC has nothing to request */
+  bool submitNext(int nTOC);
+  void handleReply(struct FetchRequest &frRequest, enum RequestState enumState);
+  /*! \brief Counts an attempt that failed and schedules the next
+      one, or gives up on the TOC */
+  void retry(int nTOC, int nID);
+  void checkDone(int nTOC);
+
+ public:
+  /*! \brief Constructor for the fetcher class
+
+    \param crRadio The transport the TOCs talk through
+    \param nWindow Maximum number of requests in flight */
+  CTOCFetcher(CTransport *crRadio, int nWindow = TOC_FETCH_DEFAULT_WINDOW);
+
+  /*! \brief Adds a TOC to download
+
+    \param tocTOC The TOC; it must use the fetcher's transport
+    \param bMetaData Whether the metadata (item count and CRC) has to
+    be requested first; pass 'false' if requestMetaData() was
+    called already */
+  void addTOC(CTOC *tocTOC, bool bMetaData = true);
+
+  /*! \brief Submits due requests and performs at most one exchange
+      to pick up replies
+
+    \return Returns 'false' once all TOCs are done or failed */
+  bool step();
+  /*! \brief Steps until all TOCs are done or failed
+
+    \return Returns 'true' if all TOCs were fetched completely */
+  bool run();
+
+  /*! \brief Whether all TOCs are done or failed */
+  bool finished();
+  /*! \brief Whether all TOCs were fetched completely */
+  bool succeeded();
+};
+
+
+#endif /* __C_TOC_FETCHER_H__ */
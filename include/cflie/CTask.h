@@ -0,0 +1,164 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_TASK_H__
+#define __C_TASK_H__
+
+
+/*! \file CTask.h
+  \brief Coroutine type for the awaitable API (C++20 only)
+
+  Only available when compiling with coroutine support (C++20),
+  e.g. by configuring with -DCFLIE_COROUTINES=ON. The rest of the
+  library keeps building as C++11. */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#define CFLIE_HAS_COROUTINES 1
+
+
+// System
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+
+/*! \brief Coroutine producing a single value of type T
+
+  Tasks start suspended. They run when awaited from another
+  coroutine (which resumes once the task finished) or when handed to
+  CEventLoop::spawn(). A task owns its coroutine frame and destroys
+  it when going away; it can be moved but not copied.
+
+  \tparam T Type of the value given to co_return */
+template<typename T>
+class CTask {
+ public:
+  struct promise_type {
+    T tValue;
+    /*! \brief Coroutine awaiting this task, resumed when done */
+    std::coroutine_handle<> chContinuation;
+
+    CTask get_return_object() {
+      return CTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept {
+	return false;
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> chTask) noexcept {
+	std::coroutine_handle<> chContinuation = chTask.promise().chContinuation;
+
+	return (chContinuation ? chContinuation : std::noop_coroutine());
+      }
+
+      void await_resume() noexcept {
+      }
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+      return {};
+    }
+
+    void return_value(T tReturn) {
+      tValue = std::move(tReturn);
+    }
+
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+
+ private:
+  std::coroutine_handle<promise_type> m_chHandle;
+
+  explicit CTask(std::coroutine_handle<promise_type> chHandle) : m_chHandle(chHandle) {
+  }
+
+ public:
+  CTask(CTask &&tOther) : m_chHandle(tOther.m_chHandle) {
+    tOther.m_chHandle = nullptr;
+  }
+
+  CTask(const CTask &tOther) = delete;
+  CTask &operator=(const CTask &tOther) = delete;
+
+  ~CTask() {
+    if(m_chHandle) {
+      m_chHandle.destroy();
+    }
+  }
+
+  /*! \brief Whether the coroutine ran to completion */
+  bool done() {
+    return !m_chHandle || m_chHandle.done();
+  }
+
+  /*! \brief The value the coroutine returned; only valid once done */
+  T result() {
+    return m_chHandle.promise().tValue;
+  }
+
+  /*! \brief Starts or continues the coroutine */
+  void resume() {
+    if(!this->done()) {
+      m_chHandle.resume();
+    }
+  }
+
+  // Awaiting a task runs it and continues the awaiting coroutine
+  // once it is done.
+  bool await_ready() {
+    return this->done();
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> chAwaiting) {
+    m_chHandle.promise().chContinuation = chAwaiting;
+
+    return m_chHandle;
+  }
+
+  T await_resume() {
+    return this->result();
+  }
+};
+
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* __C_TASK_H__ */
@@ -0,0 +1,123 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_TIME_SERIES_H__
+#define __C_TIME_SERIES_H__
+
+
+// System
+#include <vector>
+#include <algorithm>
+
+
+/*! \brief Fixed-capacity history of one log variable
+
+  Samples are kept as two parallel columns, receive times and
+  values, each a ring buffer of the same capacity. Once the rings
+  are full, every new sample replaces the oldest one. Memory is
+  allocated once, when the series is created.
+
+  Times are seconds on CLOCK_MONOTONIC (the clock
+  CCrazyflie::currentTime() reads) and never decrease, so range
+  queries are binary searches. Query results are written to vectors
+  passed in by the caller, oldest sample first; reusing the same
+  vectors avoids allocations.
+
+  A series is filled while logging frames are decoded and must only
+  be queried from that same thread. */
+class CTimeSeries {
+ private:
+  // Variables
+  /*! \brief Receive time column: when the radio received the
+      frame carrying the sample, not when it was decoded */
+  std::vector<double> m_vecTimes;
+  /*! \brief Value column */
+  std::vector<double> m_vecValues;
+  unsigned int m_unCapacity;
+  /*! \brief Number of samples ever appended */
+  unsigned long m_ulAppended;
+
+  // Functions
+  /*! \brief Ring position of the n-th oldest sample still held */
+  unsigned int position(unsigned int unAge);
+  /*! \brief Copies the samples [unFirst, unFirst + unCount) (by age,
+      oldest first) into the given columns */
+  void copyOut(unsigned int unFirst, unsigned int unCount, std::vector<double> &vecTimes, std::vector<double> &vecValues);
+
+ public:
+  /*! \brief Constructor for the time series class
+
+    \param unCapacity Number of samples held at most */
+  CTimeSeries(unsigned int unCapacity);
+
+  /*! \brief Appends a sample, replacing the oldest one if the series
+      is full
+
+    \param dTime Receive time of the sample, not before the previous
+    one
+    \param dValue The sample's value */
+  void append(double dTime, double dValue);
+  /*! \brief Drops all samples */
+  void clear();
+
+  /*! \brief Number of samples currently held */
+  unsigned int size();
+  /*! \brief Number of samples held at most */
+  unsigned int capacity();
+  /*! \brief Number of samples appended since the series was created
+      or cleared, including the ones replaced since
+
+    Comparing this with an earlier reading tells how many samples
+    arrived in between, and whether some were missed. */
+  unsigned long samplesAppended();
+
+  /*! \brief The most recent samples
+
+    \param unCount Number of samples wanted
+    \param vecTimes Receives the samples' times
+    \param vecValues Receives the samples' values
+    \return The number of samples returned, less than unCount if not
+    as many are held */
+  unsigned int latest(unsigned int unCount, std::vector<double> &vecTimes, std::vector<double> &vecValues);
+  /*! \brief The samples received within a time range
+
+    \param dFrom Start of the range (inclusive)
+    \param dTo End of the range (inclusive)
+    \param vecTimes Receives the samples' times
+    \param vecValues Receives the samples' values
+    \return The number of samples returned */
+  unsigned int range(double dFrom, double dTo, std::vector<double> &vecTimes, std::vector<double> &vecValues);
+};
+
+
+#endif /* __C_TIME_SERIES_H__ */
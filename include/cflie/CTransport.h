@@ -0,0 +1,531 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_TRANSPORT_H__
+#define __C_TRANSPORT_H__
+
+
+// System
+#include <list>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+#include <chrono>
+
+// Private
+#include "CCRTPPacket.h"
+#include "CCRTPPacketPool.h"
+#include "CCRTPView.h"
+#include "CLinkQuality.h"
+#include "CDiagnostics.h"
+#include "CMetrics.h"
+#include "CRequestFuture.h"
+#include "CLogFrameRing.h"
+
+
+/*! \brief Bytes reserved in front of every outgoing frame
+
+  Transports may put a header of their own in front of the CRTP data
+  (such as the Crazyradio's inline settings) without copying it. */
+#define TRANSPORT_HEADROOM 8
+/*! \brief Size of a transport's send buffer */
+#define TRANSPORT_BUFFER_SIZE (TRANSPORT_HEADROOM + 1 + CRTP_MAX_DATA_LENGTH)
+/*! \brief Default time sendAndReceive() and waitForPacket() wait
+    for a reply, in milliseconds */
+#define TRANSPORT_DEFAULT_REQUEST_TIMEOUT 1000
+/*! \brief Default number of extra pings per exchange in drain
+    mode */
+#define TRANSPORT_DEFAULT_DRAIN_BUDGET 8
+/*! \brief Number of logging frames held back for
+    drainLoggingFrames() before the overflow policy kicks in */
+#define TRANSPORT_LOG_RING_SIZE 256
+
+
+/*! \brief A request waiting for its reply */
+struct PendingRequest {
+  long lID;
+  /*! \brief The encoded request (header byte and payload), kept for
+      resending */
+  char cFrame[1 + CRTP_MAX_DATA_LENGTH];
+  int nFrameLength;
+  /*! \brief Port the reply is expected on */
+  int nPort;
+  /*! \brief Channel the reply is expected on */
+  int nChannel;
+  /*! \brief Number of leading payload bytes the reply has to repeat
+      from the request (command and, e.g., TOC element or block ID) */
+  int nMatchLength;
+  /*! \brief Exchanges to wait for a reply before resending */
+  int nRetries;
+  /*! \brief Exchanges left until the request is resent */
+  int nResendCounter;
+  /*! \brief The reply once it arrived, NULL before */
+  CCRTPPacket *crtpReply;
+  /*! \brief Point in time after which the reply isn't waited for
+      anymore */
+  std::chrono::steady_clock::time_point tpDeadline;
+  /*! \brief Whether the deadline passed without a reply */
+  bool bExpired;
+};
+
+
+/*! \brief Abstract link to a Crazyflie Nano copter
+
+  A transport delivers CRTP packets to a copter and hands back what
+  the copter sent in reply. Everything above the raw packet exchange
+  (waiting for replies, keepalive packets, extracting logging and
+  console data) is implemented here and thus shared by all
+  transports. Implementations only provide transmitData() and
+  usbOK().
+
+  Outgoing data is encoded straight into a send buffer owned by the
+  transport, either from a CCRTPPacket or in place by the caller
+  (see beginPacket()).
+
+  CCrazyRadio implements this interface for the USB dongle,
+  CSimulatedCopter for an in-process simulation. CCrazyflie and CTOC
+  work with either. */
+class CTransport {
+ protected:
+  // Variables
+  /*! \brief Whether the last packet sent was acknowledged */
+  bool m_bAckReceived;
+  /*! \brief Logging frames received and not drained yet */
+  CLogFrameRing<TRANSPORT_LOG_RING_SIZE> m_lfrLogging;
+  /*! \brief Pool replies and internally used packets are taken
+      from */
+  CCRTPPacketPool *m_ppPool;
+  /*! \brief Reusable buffer outgoing frames are encoded into
+
+    The CRTP data starts at TRANSPORT_HEADROOM. */
+  char m_cSendBuffer[TRANSPORT_BUFFER_SIZE];
+  /*! \brief Decodes logging frames directly if set */
+  CCRTPConsumer *m_ccLoggingConsumer;
+  /*! \brief Statistics over the ACK status of the last packets */
+  CLinkQuality m_lqLinkQuality;
+  /*! \brief ACK status byte of the last exchange */
+  unsigned char m_ucLastStatus;
+  /*! \brief Identifies this transport's diagnostic messages */
+  int m_nDiagnosticsSource;
+  /*! \brief Console text received since the last line break */
+  char m_cConsoleLine[DIAGNOSTICS_MESSAGE_LENGTH];
+  int m_nConsoleLength;
+  /*! \brief Frames sent, one counter per CRTP port */
+  CMetricCounter *m_mcPacketsSent[16];
+  /*! \brief Resends and pings sendAndReceive() needed for replies */
+  CMetricCounter *m_mcSendRetries;
+  /*! \brief Current fill level of m_lfrLogging */
+  CMetricGauge *m_mgLoggingQueueDepth;
+  /*! \brief Logging frames dropped by m_lfrLogging, one counter per
+      overflow policy */
+  CMetricCounter *m_mcLoggingDropped[2];
+  /*! \brief Requests submitted and not taken back yet, oldest
+      first */
+  std::list<struct PendingRequest> m_lstPendingRequests;
+  long m_lNextRequestID;
+  /*! \brief Consumers for replies no request is waiting for, one
+      per port */
+  CCRTPConsumer *m_ccPortConsumers[16];
+  /*! \brief Timeout for sendAndReceive() and waitForPacket() in
+      milliseconds, 0 for none */
+  int m_nRequestTimeout;
+  /*! \brief Requests whose deadline passed without a reply */
+  CMetricCounter *m_mcRequestsExpired;
+  /*! \brief Maximum number of pings sent to drain the downlink
+      after an exchange; 0 disables drain mode */
+  int m_nDrainBudget;
+  /*! \brief Pings sent to drain the downlink */
+  CMetricCounter *m_mcDrainPings;
+
+  // Functions
+  /*! \brief Exchanges one encoded frame with the copter
+
+    Sends the given CRTP data (header byte and payload) and points
+    the given view to the raw reply, which starts with the CRTP
+    header byte. The reply may be empty if the copter acknowledged
+    without sending data. It must stay valid until the next
+    exchange. m_bAckReceived must be updated to reflect whether the
+    frame was acknowledged.
+
+    \param cData The data to send. TRANSPORT_HEADROOM bytes in front
+    of it may be overwritten.
+    \param nLength Number of bytes to send
+    \param cvReply View to point to the reply
+    \return Returns 'false' if the exchange failed */
+  virtual bool transmitData(char *cData, int nLength, CCRTPView &cvReply) = 0;
+
+  /*! \brief Records the ACK status byte of an exchange
+
+    Updates m_bAckReceived and the link quality statistics.
+
+    \param ucStatus Status byte: bit 0 is the ACK flag, bit 1 the
+    power detector and the upper four bits the number of
+    retransmissions */
+  void recordStatus(unsigned char ucStatus);
+
+  /*! \brief Exchanges encoded data and processes the reply
+
+    \return Reply packet for the caller, or NULL if the exchange
+    failed */
+  CCRTPPacket *exchangeData(char *cData, int nLength);
+
+  /*! \brief Picks up data the copter still holds back
+
+    Sends pings as long as their ACKs carry data, up to the drain
+    budget. The replies are handled by handleReply(); those no
+    request or consumer claims are dropped. */
+  void drainDownlink();
+
+  /*! \brief Collects console text until a line is complete and
+      posts it to the diagnostics sink */
+  void appendConsoleText(const char *cText, int nLength);
+
+  /*! \brief Processes a received reply
+
+    Hands replies to the pending request they answer, reassembles
+    console text into lines and hands logging frames to the logging
+    consumer, or stores them in the logging ring for
+    drainLoggingFrames() if there is none. Other replies go to the consumer registered for
+    their port, if any.
+
+    \return Returns 'true' if the reply was handed to a request or
+    consumer */
+  bool handleReply(const CCRTPView &cvReply);
+  /*! \brief Stores a reply with the oldest pending request it
+      answers
+
+    \return Returns 'true' if a request was waiting for the reply */
+  bool matchReply(const CCRTPView &cvReply);
+  struct PendingRequest *pendingRequest(long lID);
+  /*! \brief Marks the request expired if its deadline passed
+
+    \return Returns 'true' if the request is expired */
+  bool checkDeadline(struct PendingRequest &prRequest, std::chrono::steady_clock::time_point tpNow);
+  /*! \brief Deadline for a request made now, given the request
+      timeout */
+  std::chrono::steady_clock::time_point requestDeadline();
+
+ public:
+  CTransport();
+  /*! \brief Destructor, deletes all logging packets not picked up */
+  virtual ~CTransport();
+
+  /*! \brief Sends the given packet's payload to the copter
+
+    Logging replies handed to the logging consumer come back without
+    data, carrying their port and channel only.
+
+    \param crtpSend The packet which supplied header and payload
+    information to send to the copter */
+  CCRTPPacket *sendPacket(CCRTPPacket *crtpSend, bool bDeleteAfterwards = false);
+
+  /*! \brief Starts encoding a packet in place
+
+    Writes the CRTP header for the given port and channel into the
+    transport's send buffer and returns where the payload goes. The
+    caller writes up to 32 bytes of payload there and sends it with
+    commitPacket(). No packet object is needed and nothing is
+    copied; this is meant for packets sent at high rates, such as
+    setpoints.
+
+    \param nPort Port to send the payload to
+    \param nChannel Channel to send the payload to
+    \return Pointer to the payload area of the send buffer */
+  char *beginPacket(int nPort, int nChannel);
+  /*! \brief Sends the packet encoded since beginPacket()
+
+    \param nLength Number of payload bytes written
+    \return The reply received (to be deleted by the caller) or NULL
+    if the exchange failed. */
+  CCRTPPacket *commitPacket(int nLength);
+
+  /*! \brief Sends the given packet and waits for a reply.
+
+    Internally, this function calls the more elaborate
+    sendAndReceive() function supplying parameters for retrying and
+    waiting. Convenience function signature.
+
+    \param crtpSend Packet to send
+    \param bDeleteAfterwards Whether or not the packet to send is
+    deleted internally after sending it
+
+    \return Packet containing the reply or NULL if no reply was
+    received (after retrying). */
+  CCRTPPacket *sendAndReceive(CCRTPPacket *crtpSend, bool bDeleteAfterwards = false, int nMatchLength = 0);
+
+  /*! \brief Sends the given packet and waits for a reply.
+
+    Sends out the CCRTPPacket instance denoted by crtpSend on the
+    given port and channel. Retries a number of times and waits
+    between each retry whether or not an answer was received (in this
+    case, dummy packets are sent in order to receive replies). Gives
+    up once the request timeout (see setRequestTimeout()) passed.
+
+    \param crtpSend Packet to send
+
+    \param nPort Port number on which to send this packet (and where
+    to wait for the reply)
+    \param nChannel Channel number on which to send this packet (and
+    where to wait for the reply)
+    \param bDeletAfterwards Whether or not the packet to send is
+    deleted internally after sending it
+    \param nRetries Number of retries (re-sending) before giving up on
+    an answer
+    \param nMicrosecondsWait Microseconds to wait between two re-sends
+    \param nMatchLength Number of leading payload bytes the reply has
+    to repeat from the request; see submitRequest()
+
+    \return Packet containing the reply or NULL if no reply was
+    received (after retrying). */
+  CCRTPPacket *sendAndReceive(CCRTPPacket *crtpSend, int nPort, int nChannel, bool bDeleteAfterwards = true, int nRetries = 10, int nMicrosecondsWait = 100, int nMatchLength = 0);
+
+  /*! \brief Sends a request without waiting for its reply
+
+    Any number of requests can be outstanding at a time. Replies are
+    matched to requests on port, channel and the first nMatchLength
+    payload bytes, which the copter repeats from the request (such
+    as the command byte and the TOC element or logging block ID).
+    Matching happens on every exchange, whoever triggers it; replies
+    no request is waiting for are routed as usual (see
+    setPortConsumer()).
+
+    The request is sent once right away; pumpRequests() resends it
+    until answered. The packet itself is not needed afterwards and
+    stays with the caller.
+
+    \param crtpRequest The packet to send; the reply is expected on
+    its port and channel
+    \param nMatchLength Number of leading payload bytes to match on;
+    limited to the request's payload length
+    \param nRetries Number of exchanges to wait for the reply before
+    resending the request
+    \return ID to collect the reply with takeReply() */
+  long submitRequest(CCRTPPacket *crtpRequest, int nMatchLength = 0, int nRetries = 10);
+  /*! \brief Sends a request expecting the reply on the given port
+      and channel
+
+    \sa submitRequest(CCRTPPacket*, int, int) */
+  long submitRequest(CCRTPPacket *crtpRequest, int nPort, int nChannel, int nMatchLength, int nRetries, std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::time_point::max());
+  /*! \brief Sends a request that has to be answered by the given
+      point in time
+
+    Like submitRequest(), but returns a handle that reports the
+    request's state, including expiry, and hands out the reply.
+
+    \param crtpRequest The packet to send; the reply is expected on
+    its port and channel
+    \param tpDeadline Absolute point in time after which the reply
+    isn't waited for anymore
+    \param nMatchLength Number of leading payload bytes to match on
+    \param nRetries Number of exchanges to wait for the reply before
+    resending the request
+    \return Handle to the request */
+  CRequestFuture request(CCRTPPacket *crtpRequest, std::chrono::steady_clock::time_point tpDeadline, int nMatchLength = 0, int nRetries = 10);
+  /*! \brief Sends a request expecting the reply on the given port
+      and channel by the given point in time */
+  CRequestFuture request(CCRTPPacket *crtpRequest, int nPort, int nChannel, std::chrono::steady_clock::time_point tpDeadline, int nMatchLength = 0, int nRetries = 10);
+  /*! \brief The state of a request
+
+    \param lID ID returned by submitRequest()
+    \return REQUEST_CANCELLED for requests unknown or forgotten */
+  enum RequestState requestState(long lID);
+  /*! \brief Sets how long sendAndReceive() and waitForPacket() wait
+      for a reply
+
+    \param nMilliseconds Timeout in milliseconds, 0 to wait forever
+    (which hangs the caller if the copter is out of range) */
+  void setRequestTimeout(int nMilliseconds);
+  int requestTimeout();
+  /*! \brief Drives outstanding requests by a single exchange
+
+    Resends the oldest request that waited nRetries exchanges for
+    its reply, or sends a ping to pick up replies otherwise. Expired
+    requests aren't resent.
+
+    \return Returns 'false' if the exchange failed */
+  bool pumpRequests();
+  /*! \brief Takes the reply to a request
+
+    Once a reply is returned, the request is forgotten.
+
+    \param lID ID returned by submitRequest()
+    \return The reply (to be deleted by the caller) or NULL if it
+    didn't arrive yet */
+  CCRTPPacket *takeReply(long lID);
+  /*! \brief Whether the reply to a request arrived */
+  bool requestAnswered(long lID);
+  /*! \brief Forgets a request; a reply arriving later is routed as
+      unsolicited */
+  void cancelRequest(long lID);
+  /*! \brief Number of requests submitted and not taken back yet */
+  int pendingRequests();
+
+  /*! \brief Sets the consumer for replies on a port that no request
+      is waiting for
+
+    Without a consumer, such replies are handed back to whoever
+    triggered the exchange. Console and logging frames are handled
+    separately.
+
+    \param nPort The CRTP port (0 - 15)
+    \param ccConsumer The consumer, or NULL to remove it */
+  void setPortConsumer(int nPort, CCRTPConsumer *ccConsumer);
+
+  /*! \brief Enables draining the copter's downlink queue
+
+    The copter can only send data inside ACKs, i.e. once per packet
+    the host sends. When an ACK carries data, the copter likely has
+    more queued (such as logging frames of fast logging blocks). In
+    drain mode, every exchange that brought back data is followed by
+    pings until an ACK comes back empty or the budget is used up;
+    after that, pacing returns to normal.
+
+    \param bDrain Whether to drain the downlink
+    \param nBudget Maximum number of pings per exchange */
+  void setDrainMode(bool bDrain, int nBudget = TRANSPORT_DEFAULT_DRAIN_BUDGET);
+  /*! \brief Whether drain mode is enabled */
+  bool drainMode();
+
+  /*! \brief Sends out an empty dummy packet
+
+    Only contains the payload `0xff`, as used for empty packet
+    requests. Mostly used for waiting or keepalive.
+
+    \return Boolean value denoting whether sending the dummy packet
+    worked or not. */
+  bool sendDummyPacket();
+
+  /*! \brief Waits for the next non-empty packet.
+
+    Sends out dummy packets until a reply is non-empty and then
+    returns this reply.
+
+    \return Packet contaning a non-empty reply, or NULL if the
+    request timeout passed first. */
+  CCRTPPacket *waitForPacket();
+
+  /*! \brief Whether or not the copter is answering sent packets.
+
+    Returns whether the copter is actually answering sent packets with
+    a set ACK flag. If this is not the case, it is either switched off
+    or out of range.
+
+    \return Returns true if the copter is returning the ACK flag properly, false otherwise. */
+  bool ackReceived();
+  /*! \brief Whether or not the connection to the copter's link is
+      still operational.
+
+    For the CrazyRadio, this checks if the USB read/write calls
+    yielded any errors.
+
+    \return Returns true if the connection is working properly and
+    false otherwise. */
+  virtual bool usbOK() = 0;
+
+  /*! \brief Link quality over the last packets exchanged
+
+    Based on the ACK status the dongle reports for every packet:
+    ACK rate, retransmission histogram and power detector ratio over
+    the last LINK_QUALITY_WINDOW packets. Cheap enough to be called
+    every cycle, also while an I/O thread uses the transport.
+
+    \return Snapshot of the current link quality */
+  struct LinkQuality linkQuality();
+  /*! \brief The ACK status byte reported for the last exchange */
+  unsigned char lastStatus();
+
+  /*! \brief Number identifying this transport's messages in the
+      diagnostics sink (see DiagnosticMessage::nSource) */
+  int diagnosticsSource();
+  /*! \brief Labels of this transport's metrics
+
+    Per-link metrics carry a `transport` label with the
+    diagnostics source number, so several copters don't add up in
+    the same series.
+
+    \param strLabels Further labels to append, e.g. `port="2"`
+    \return The label set, e.g. `transport="0",port="2"` */
+  std::string metricLabels(std::string strLabels = "");
+
+  /*! \brief Hands the collected logging frames to a consumer
+
+    Logging frames (port 5, channel 2) received while no logging
+    consumer is set are kept in a fixed-size ring. They are decoded
+    straight from the ring here, oldest first, and nothing is copied
+    or allocated. This is called by the CCrazyflie class
+    automatically when performing cycle().
+
+    The ring is lock-free, so this may be called from one thread
+    while another one (such as a CRadioIOThread) uses the transport.
+
+    \param ccConsumer The consumer decoding the frames, or NULL to
+    discard them
+    \return The number of frames drained */
+  unsigned int drainLoggingFrames(CCRTPConsumer *ccConsumer);
+
+  /*! \brief Set what happens to logging frames while the ring is
+      full
+
+    Default value: `OVERFLOW_DROP_OLDEST`
+
+    \param enumPolicy Whether the oldest frame or the new one is
+    dropped */
+  void setLoggingOverflowPolicy(enum OverflowPolicy enumPolicy);
+  /*! \brief Number of logging frames dropped because the ring was
+      full, under either policy */
+  unsigned long loggingFramesDropped();
+
+  /*! \brief Sets a consumer decoding logging frames directly
+
+    When set, logging frames are handed to the consumer straight
+    from the receive buffer instead of being stored for
+    drainLoggingFrames(). The consumer is called from whichever thread
+    uses the transport.
+
+    \param ccConsumer The consumer, or NULL to collect logging
+    packets again */
+  void setLoggingConsumer(CCRTPConsumer *ccConsumer);
+  /*! \brief The currently set logging consumer, if any */
+  CCRTPConsumer *loggingConsumer();
+
+  /*! \brief The pool this transport allocates its packets from
+
+    Packets sent through this transport should be taken from here as
+    well (`new(crRadio->packetPool()) CCRTPPacket(...)`), so that
+    steady-state traffic doesn't allocate from the heap. */
+  CCRTPPacketPool *packetPool();
+};
+
+
+#endif /* __C_TRANSPORT_H__ */
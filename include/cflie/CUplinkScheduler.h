@@ -0,0 +1,175 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+/* \author Jan Winkler */
+
+
+
+
+#ifndef __C_UPLINK_SCHEDULER_H__
+#define __C_UPLINK_SCHEDULER_H__
+
+
+// System
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+// Private
+#include "CCRTPPacket.h"
+#include "CMPMCQueue.h"
+#include "CMetrics.h"
+
+
+/*! \brief Capacity of the configuration queue */
+#define UPLINK_QUEUE_SIZE 256
+/*! \brief Capacity of the emergency queue */
+#define UPLINK_EMERGENCY_QUEUE_SIZE 16
+/*! \brief Number of times a setpoint that wasn't acknowledged is
+    sent again, unless a newer one replaced it */
+#define UPLINK_SETPOINT_RETRIES 3
+
+
+/*! \brief Traffic classes, highest priority first */
+enum TrafficClass {
+  /*! \brief Must go out before anything else, e.g. stopping the
+      motors */
+  TRAFFIC_EMERGENCY = 0,
+  /*! \brief Control setpoints; only the latest one counts */
+  TRAFFIC_SETPOINT = 1,
+  /*! \brief TOC, logging and parameter traffic */
+  TRAFFIC_CONFIGURATION = 2,
+  /*! \brief Pings keeping the link alive and picking up replies */
+  TRAFFIC_KEEPALIVE = 3
+};
+
+#define UPLINK_TRAFFIC_CLASSES 4
+
+
+/*! \brief Decides which packet goes out next on an uplink
+
+  Application threads submit packets by traffic class; the thread
+  driving the transport (see CRadioIOThread) asks for the next
+  packet to send with next() and reports back with completed().
+
+  Classes are served by strict priority. Emergency and
+  configuration packets are queued in order. Setpoints are kept in a
+  single-slot mailbox: a new setpoint replaces one that wasn't sent
+  yet, so a burst of configuration traffic never makes setpoints
+  pile up and go out stale. A setpoint that wasn't acknowledged is
+  sent again (unless a newer one arrived), up to
+  UPLINK_SETPOINT_RETRIES times. Keepalive pings are generated when
+  nothing else is due.
+
+  Each class can be rate-limited by a token bucket; a class out of
+  tokens is skipped until it has one again. By default, only
+  keepalive pings are limited (to 1000 per second).
+
+  submit() may be called from any number of threads; next() and
+  completed() only from the single sending thread. */
+class CUplinkScheduler {
+ private:
+  /*! \brief Token bucket limiting the rate of one class */
+  struct RateLimit {
+    /*! \brief Tokens added per second; 0 means unlimited */
+    double dRate;
+    /*! \brief Maximum number of tokens */
+    double dBurst;
+    double dTokens;
+    std::chrono::steady_clock::time_point tpRefilled;
+  };
+
+  // Variables
+  CMPMCQueue<CCRTPPacket*, UPLINK_EMERGENCY_QUEUE_SIZE> m_mpmcEmergency;
+  CMPMCQueue<CCRTPPacket*, UPLINK_QUEUE_SIZE> m_mpmcConfiguration;
+  /*! \brief The latest setpoint not sent yet, or NULL */
+  std::atomic<CCRTPPacket*> m_crtpSetpoint;
+  /*! \brief Unacknowledged setpoint waiting to be sent again, or
+      NULL; only touched by the sending thread */
+  CCRTPPacket *m_crtpRetried;
+  /*! \brief Number of times the current setpoint was retried */
+  int m_nRetries;
+  /*! \brief Ping sent for keepalive traffic */
+  CCRTPPacket *m_crtpPing;
+  struct RateLimit m_rlLimits[UPLINK_TRAFFIC_CLASSES];
+  CMetricCounter *m_mcSent[UPLINK_TRAFFIC_CLASSES];
+  CMetricCounter *m_mcSetpointsReplaced;
+  CMetricCounter *m_mcDropped;
+
+  // Functions
+  bool takeToken(enum TrafficClass enumClass, std::chrono::steady_clock::time_point tpNow);
+
+ public:
+  /*! \brief Constructor for the uplink scheduler
+
+    \param strLabels Labels of the scheduler's metrics, usually the
+    transport's (see CTransport::metricLabels()) */
+  CUplinkScheduler(std::string strLabels = "");
+  /*! \brief Destructor, deletes all packets still queued */
+  ~CUplinkScheduler();
+
+  /*! \brief Hands a packet over for sending
+
+    The scheduler takes ownership of the packet.
+
+    \param crtpSend The packet to send
+    \param enumClass Traffic class of the packet; keepalive packets
+    are generated internally and can't be submitted
+    \return Returns 'false' if the packet was dropped because its
+    queue was full (it is deleted in this case) */
+  bool submit(CCRTPPacket *crtpSend, enum TrafficClass enumClass);
+
+  /*! \brief Picks the packet to send next
+
+    \param crtpSend Receives the packet. It stays owned by the
+    scheduler and must be handed back through completed().
+    \param enumClass Receives the traffic class of the packet
+    \return Returns 'false' if nothing may be sent right now */
+  bool next(CCRTPPacket *&crtpSend, enum TrafficClass &enumClass);
+  /*! \brief Reports how sending a packet obtained from next() went
+
+    \param crtpSend The packet returned by next()
+    \param enumClass Its traffic class
+    \param bAcknowledged Whether the copter acknowledged it */
+  void completed(CCRTPPacket *crtpSend, enum TrafficClass enumClass, bool bAcknowledged);
+
+  /*! \brief Sets the rate limit of a traffic class
+
+    \param enumClass The class to limit
+    \param dPacketsPerSecond Sustained rate; 0 removes the limit
+    \param dBurst Number of packets that may go out back to back */
+  void setRateLimit(enum TrafficClass enumClass, double dPacketsPerSecond, double dBurst = 1);
+
+  /*! \brief Deletes all packets still waiting
+
+    Must not be called while the sending thread is active. */
+  void clear();
+};
+
+
+#endif /* __C_UPLINK_SCHEDULER_H__ */
@@ -27,6 +27,7 @@
 
 
 #include <cflie/CCRTPPacket.h>
+#include <cflie/CCRTPPacketPool.h>
 
 
 CCRTPPacket::CCRTPPacket(int nPort) {
@@ -52,8 +53,23 @@ CCRTPPacket::~CCRTPPacket() {
   this->clearData();
 }
 
+void *CCRTPPacket::operator new(std::size_t szSize) {
+  return CCRTPPacketPool::allocate(NULL, szSize);
+}
+
+void *CCRTPPacket::operator new(std::size_t szSize, CCRTPPacketPool *ppPool) {
+  return CCRTPPacketPool::allocate(ppPool, szSize);
+}
+
+void CCRTPPacket::operator delete(void *vdPacket) {
+  CCRTPPacketPool::deallocate(vdPacket);
+}
+
+void CCRTPPacket::operator delete(void *vdPacket, CCRTPPacketPool *) {
+  CCRTPPacketPool::deallocate(vdPacket);
+}
+
 void CCRTPPacket::basicSetup() {
-  m_cData = NULL;
   m_nDataLength = 0;
   m_nPort = 0;
   m_nChannel = 0;
@@ -63,7 +79,10 @@ void CCRTPPacket::basicSetup() {
 void CCRTPPacket::setData(char *cData, int nDataLength) {
   this->clearData();
 
-  m_cData = new char[nDataLength]();
+  if(nDataLength > CRTP_MAX_DATA_LENGTH) {
+    nDataLength = CRTP_MAX_DATA_LENGTH;
+  }
+
   std::memcpy(m_cData, cData, nDataLength);
   m_nDataLength = nDataLength;
 }
@@ -77,29 +96,30 @@ int CCRTPPacket::dataLength() {
 }
 
 void CCRTPPacket::clearData() {
-  if(m_cData != NULL) {
-    delete[] m_cData;
-    m_cData = NULL;
-    m_nDataLength = 0;
-  }
+  m_nDataLength = 0;
 }
 
-char *CCRTPPacket::sendableData() {
-  char *cSendable = new char[this->sendableDataLength()]();
-
+int CCRTPPacket::writeSendableData(char *cBuffer) {
   if(m_bIsPingPacket) {
-    cSendable[0] = 0xff;
+    cBuffer[0] = 0xff;
   } else {
     // Header byte
-    cSendable[0] = (m_nPort << 4) | 0b00001100 | (m_nChannel & 0x03);
+    cBuffer[0] = (m_nPort << 4) | 0b00001100 | (m_nChannel & 0x03);
 
     // Payload
-    std::memcpy(&cSendable[1], m_cData, m_nDataLength);
+    std::memcpy(&cBuffer[1], m_cData, m_nDataLength);
 
     // Finishing byte
-    //cSendable[m_nDataLength + 1] = 0x27;
+    //cBuffer[m_nDataLength + 1] = 0x27;
   }
 
+  return this->sendableDataLength();
+}
+
+char *CCRTPPacket::sendableData() {
+  char *cSendable = new char[this->sendableDataLength()]();
+  this->writeSendableData(cSendable);
+
   return cSendable;
 }
 
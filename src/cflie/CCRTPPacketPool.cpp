@@ -0,0 +1,144 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CCRTPPacketPool.h>
+#include <cflie/CCRTPPacket.h>
+
+
+CCRTPPacketPool::CCRTPPacketPool(unsigned int unInitialSize) {
+  m_bhFree = NULL;
+  m_unBlocks = 0;
+  m_unOutstanding = 0;
+  m_bReleased = false;
+
+  for(unsigned int unI = 0; unI < unInitialSize; unI++) {
+    BlockHeader *bhBlock = CCRTPPacketPool::newBlock();
+    bhBlock->ppPool = this;
+    bhBlock->bhNext = m_bhFree;
+    m_bhFree = bhBlock;
+
+    m_unBlocks++;
+  }
+}
+
+CCRTPPacketPool::~CCRTPPacketPool() {
+  while(m_bhFree) {
+    BlockHeader *bhBlock = m_bhFree;
+    m_bhFree = bhBlock->bhNext;
+
+    ::operator delete(bhBlock);
+  }
+}
+
+void CCRTPPacketPool::release() {
+  bool bDelete = false;
+
+  {
+    std::lock_guard<std::mutex> lgLock(m_mtxPool);
+
+    m_bReleased = true;
+    bDelete = (m_unOutstanding == 0);
+  }
+
+  if(bDelete) {
+    delete this;
+  }
+}
+
+unsigned int CCRTPPacketPool::blocksAllocated() {
+  std::lock_guard<std::mutex> lgLock(m_mtxPool);
+
+  return m_unBlocks;
+}
+
+unsigned int CCRTPPacketPool::packetsInUse() {
+  std::lock_guard<std::mutex> lgLock(m_mtxPool);
+
+  return m_unOutstanding;
+}
+
+CCRTPPacketPool::BlockHeader *CCRTPPacketPool::newBlock() {
+  return (BlockHeader*)::operator new(sizeof(BlockHeader) + sizeof(CCRTPPacket));
+}
+
+void *CCRTPPacketPool::take() {
+  std::lock_guard<std::mutex> lgLock(m_mtxPool);
+  BlockHeader *bhBlock = m_bhFree;
+
+  if(bhBlock) {
+    m_bhFree = bhBlock->bhNext;
+  } else {
+    bhBlock = CCRTPPacketPool::newBlock();
+    bhBlock->ppPool = this;
+
+    m_unBlocks++;
+  }
+
+  m_unOutstanding++;
+
+  return bhBlock + 1;
+}
+
+bool CCRTPPacketPool::give(BlockHeader *bhBlock) {
+  std::lock_guard<std::mutex> lgLock(m_mtxPool);
+
+  bhBlock->bhNext = m_bhFree;
+  m_bhFree = bhBlock;
+  m_unOutstanding--;
+
+  return m_bReleased && m_unOutstanding == 0;
+}
+
+void *CCRTPPacketPool::allocate(CCRTPPacketPool *ppPool, std::size_t szSize) {
+  if(ppPool && szSize == sizeof(CCRTPPacket)) {
+    return ppPool->take();
+  }
+
+  BlockHeader *bhBlock = (BlockHeader*)::operator new(sizeof(BlockHeader) + szSize);
+  bhBlock->ppPool = NULL;
+
+  return bhBlock + 1;
+}
+
+void CCRTPPacketPool::deallocate(void *vdMemory) {
+  if(vdMemory == NULL) {
+    return;
+  }
+
+  BlockHeader *bhBlock = (BlockHeader*)vdMemory - 1;
+  CCRTPPacketPool *ppPool = bhBlock->ppPool;
+
+  if(ppPool) {
+    if(ppPool->give(bhBlock)) {
+      delete ppPool;
+    }
+  } else {
+    ::operator delete(bhBlock);
+  }
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CCRTPView.h>
+
+
+CCRTPView::CCRTPView() {
+  this->set(NULL, 0);
+}
+
+CCRTPView::CCRTPView(const char *cData, int nLength) {
+  this->set(cData, nLength);
+}
+
+void CCRTPView::set(const char *cData, int nLength) {
+  m_cData = cData;
+  m_nLength = nLength;
+  m_dReceived = 0;
+}
+
+void CCRTPView::setReceiveTime(double dReceived) {
+  m_dReceived = dReceived;
+}
+
+double CCRTPView::receiveTime() const {
+  return m_dReceived;
+}
+
+const char *CCRTPView::data() const {
+  return m_cData;
+}
+
+int CCRTPView::dataLength() const {
+  return m_nLength;
+}
+
+bool CCRTPView::empty() const {
+  return m_nLength <= 0;
+}
+
+int CCRTPView::port() const {
+  return (m_nLength > 0 ? (m_cData[0] & 0xf0) >> 4 : 0);
+}
+
+int CCRTPView::channel() const {
+  return (m_nLength > 0 ? m_cData[0] & 0b00000011 : 0);
+}
+
+const char *CCRTPView::payload() const {
+  return m_cData + 1;
+}
+
+int CCRTPView::payloadLength() const {
+  return (m_nLength > 1 ? m_nLength - 1 : 0);
+}
+
+CCRTPPacket *CCRTPView::copy(CCRTPPacketPool *ppPool) const {
+  CCRTPPacket *crtpPacket = new(ppPool) CCRTPPacket(0);
+
+  if(m_nLength > 0) {
+    crtpPacket->setData((char*)m_cData, m_nLength);
+    crtpPacket->setPort(this->port());
+    crtpPacket->setChannel(this->channel());
+  }
+
+  return crtpPacket;
+}
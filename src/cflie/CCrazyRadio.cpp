@@ -27,33 +27,49 @@
 
 
 #include <cflie/CCrazyRadio.h>
+#include <cflie/CRadioTarget.h>
 
 
 CCrazyRadio::CCrazyRadio(std::string strRadioIdentifier) {
   m_strRadioIdentifier = strRadioIdentifier;
   m_enumPower = P_M18DBM;
 
-  m_ctxContext = NULL;
   m_hndlDevice = NULL;
+  m_devDevice = NULL;
 
-  m_bAckReceived = false;
+  m_bAsyncMode = false;
+  m_lNextSequence = 0;
+
+  m_unNextTarget = 0;
+  this->invalidateSettings();
+  this->setAdaptiveRetransmit(false);
 
-  /*int nReturn = */libusb_init(&m_ctxContext);
+  m_rcDefault.nChannel = 2;
+  m_rcDefault.strDataRate = "2M";
+  std::memset(m_rcDefault.cAddress, 0xe7, 5);
 
-  // Do error checking here.
+  m_rrRegistry = CRadioRegistry::acquire();
+  m_ctxContext = m_rrRegistry->context();
+
+  m_mcUSBTimeouts = CMetrics::instance()->counter("cflie_usb_timeouts_total", "USB bulk transfers to or from the dongle that timed out", this->metricLabels());
+  m_mhBulkLatency = CMetrics::instance()->histogram("cflie_bulk_transfer_seconds", "Time from writing a frame to the dongle until its ACK was read", this->metricLabels());
 }
 
 CCrazyRadio::~CCrazyRadio() {
   this->closeDevice();
 
-  // TODO(winkler): Free all remaining packets in m_lstLoggingPackets.
-
-  if(m_ctxContext) {
-    libusb_exit(m_ctxContext);
+  for(std::vector<CRadioTarget*>::iterator itTarget = m_vecTargets.begin();
+      itTarget != m_vecTargets.end();
+      itTarget++) {
+    delete *itTarget;
   }
+
+  CRadioRegistry::release();
 }
 
 void CCrazyRadio::closeDevice() {
+  this->stopAsync();
+
   if(m_hndlDevice) {
     libusb_close(m_hndlDevice);
     libusb_unref_device(m_devDevice);
@@ -63,60 +79,37 @@ void CCrazyRadio::closeDevice() {
   }
 }
 
-std::list<libusb_device*> CCrazyRadio::listDevices(int nVendorID, int nProductID) {
-  std::list<libusb_device*> lstDevices;
-  ssize_t szCount;
-  libusb_device **ptDevices;
-
-  szCount = libusb_get_device_list(m_ctxContext, &ptDevices);
-  for(unsigned int unI = 0; unI < szCount; unI++) {
-    libusb_device *devCurrent = ptDevices[unI];
-    libusb_device_descriptor ddDescriptor;
-
-    libusb_get_device_descriptor(devCurrent, &ddDescriptor);
-
-    if(ddDescriptor.idVendor == nVendorID && ddDescriptor.idProduct == nProductID) {
-      libusb_ref_device(devCurrent);
-      lstDevices.push_back(devCurrent);
-    }
-  }
-
-  if(szCount > 0) {
-    libusb_free_device_list(ptDevices, 1);
-  }
-
-  return lstDevices;
-}
-
 bool CCrazyRadio::openUSBDongle() {
   this->closeDevice();
-  std::list<libusb_device*> lstDevices = this->listDevices(0x1915, 0x7777);
 
-  if(lstDevices.size() > 0) {
-    // For now, just take the first device. Give it a second to
-    // initialize the system permissions.
+  int nDongleNBR = 0;
+  std::sscanf(m_strRadioIdentifier.c_str(), "radio://%d", &nDongleNBR);
+
+  libusb_device *devDongle = m_rrRegistry->deviceForDongle(nDongleNBR);
+
+  if(devDongle) {
+    // Give it a second to initialize the system permissions.
     sleep(1.0);
 
-    libusb_device *devFirst = lstDevices.front();
-    int nError = libusb_open(devFirst, &m_hndlDevice);
+    int nError = libusb_open(devDongle, &m_hndlDevice);
 
     if(nError == 0) {
-      // Opening device OK. Don't free the first device just yet.
-      lstDevices.pop_front();
-      m_devDevice = devFirst;
-    }
+      // Opening device OK. Keep the reference. Nothing is known
+      // about the dongle's settings yet.
+      m_devDevice = devDongle;
+      this->invalidateSettings();
 
-    for(std::list<libusb_device*>::iterator itDevice = lstDevices.begin();
-	itDevice != lstDevices.end();
-	itDevice++) {
-      libusb_device *devCurrent = *itDevice;
-
-      libusb_unref_device(devCurrent);
+      return true;
     }
 
-    return !nError;
+    m_hndlDevice = NULL;
+    libusb_unref_device(devDongle);
   }
 
+  // The dongle may have been (re)plugged since the last enumeration;
+  // pick up the current state of the bus for the next attempt.
+  m_rrRegistry->enumerate();
+
   return false;
 }
 
@@ -126,17 +119,31 @@ bool CCrazyRadio::startRadio() {
     int nRadioChannel;
     int nDataRate;
     char cDataRateType;
+    unsigned long long ullAddress;
 
-    if(std::sscanf(m_strRadioIdentifier.c_str(), "radio://%d/%d/%d%c",
-		   &nDongleNBR, &nRadioChannel, &nDataRate,
-		   &cDataRateType) != EOF) {
-      std::cout << "Opening radio " << nDongleNBR << "/" << nRadioChannel << "/" << nDataRate << cDataRateType << std::endl;
+    int nParsed = std::sscanf(m_strRadioIdentifier.c_str(), "radio://%d/%d/%d%c/%llx",
+			      &nDongleNBR, &nRadioChannel, &nDataRate,
+			      &cDataRateType, &ullAddress);
+
+    if(nParsed != EOF) {
+      std::stringstream stsMessage;
+      stsMessage << "Opening radio " << nDongleNBR << "/" << nRadioChannel << "/" << nDataRate << cDataRateType;
+      CDiagnostics::instance()->post(SEVERITY_INFO, stsMessage.str(), m_nDiagnosticsSource);
 
       std::stringstream sts;
       sts << nDataRate;
       sts << cDataRateType;
       std::string strDataRate = sts.str();
 
+      m_rcDefault.nChannel = nRadioChannel;
+      m_rcDefault.strDataRate = strDataRate;
+
+      if(nParsed == 5) {
+	for(int nI = 0; nI < 5; nI++) {
+	  m_rcDefault.cAddress[nI] = (ullAddress >> (8 * (4 - nI))) & 0xff;
+	}
+      }
+
       // Read device version
       libusb_device_descriptor ddDescriptor;
       libusb_get_device_descriptor(m_devDevice, &ddDescriptor);
@@ -147,7 +154,9 @@ bool CCrazyRadio::startRadio() {
       sts << (ddDescriptor.bcdDevice & 0x0ff);
       std::sscanf(sts.str().c_str(), "%f", &m_fDeviceVersion);
 
-      std::cout << "Got device version " << m_fDeviceVersion << std::endl;
+      stsMessage.str(std::string());
+      stsMessage << "Got device version " << m_fDeviceVersion;
+      CDiagnostics::instance()->post(SEVERITY_INFO, stsMessage.str(), m_nDiagnosticsSource);
       if(m_fDeviceVersion < 0.3) {
 	return false;
       }
@@ -177,11 +186,21 @@ bool CCrazyRadio::startRadio() {
 
 	// Initialize device
 	if(m_fDeviceVersion >= 0.4) {
-	  this->setARC(10);
+	  this->setARC(m_bAdaptiveRetransmit ? m_nARCMin : 10);
 	}
 
-	this->setChannel(nRadioChannel);
-	this->setDataRate(strDataRate);
+	// Newer dongles take channel, datarate and address in front
+	// of every packet. Stay with control transfers if switching
+	// to that mode fails.
+	if(m_fDeviceVersion >= RADIO_INLINE_SETTINGS_VERSION) {
+	  m_bInlineSettings = this->writeControl(NULL, 0, 0x23, 1, 0);
+	}
+
+	if(m_bInlineSettings) {
+	  CDiagnostics::instance()->post(SEVERITY_INFO, "Using inline radio settings", m_nDiagnosticsSource);
+	}
+
+	this->selectContext(m_rcDefault);
 
 	return true;
       }
@@ -191,17 +210,35 @@ bool CCrazyRadio::startRadio() {
   return false;
 }
 
-CCRTPPacket *CCrazyRadio::writeData(void *vdData, int nLength) {
-  CCRTPPacket *crtpPacket = NULL;
+bool CCrazyRadio::writeData(void *vdData, int nLength, CCRTPView &cvReply) {
+  std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+
+  if(m_bAsyncMode) {
+    long lSequence = this->submitData(vdData, nLength);
+
+    if(lSequence >= 0 && this->collectACK(lSequence, 1000, cvReply)) {
+      m_mhBulkLatency->observeSince(tpStart);
+
+      return true;
+    }
+
+    return false;
+  }
 
   int nActuallyWritten;
   int nReturn = libusb_bulk_transfer(m_hndlDevice, (0x01 | LIBUSB_ENDPOINT_OUT), (unsigned char*)vdData, nLength, &nActuallyWritten, 1000);
 
-  if(nReturn == 0 && nActuallyWritten == nLength) {
-    crtpPacket = this->readACK();
+  if(nReturn == LIBUSB_ERROR_TIMEOUT) {
+    m_mcUSBTimeouts->increment();
   }
 
-  return crtpPacket;
+  if(nReturn == 0 && nActuallyWritten == nLength && this->readACK(cvReply)) {
+    m_mhBulkLatency->observeSince(tpStart);
+
+    return true;
+  }
+
+  return false;
 }
 
 bool CCrazyRadio::readData(void *vdData, int &nMaxLength) {
@@ -215,7 +252,10 @@ bool CCrazyRadio::readData(void *vdData, int &nMaxLength) {
   } else {
     switch(nReturn) {
     case LIBUSB_ERROR_TIMEOUT:
-      std::cout << "USB timeout" << std::endl;
+      // Timeouts are the normal case on an idle link; the counter
+      // tracks them, the message is for debugging only.
+      m_mcUSBTimeouts->increment();
+      CDiagnostics::instance()->post(SEVERITY_DEBUG, "USB timeout", m_nDiagnosticsSource);
       break;
 
     default:
@@ -229,39 +269,64 @@ bool CCrazyRadio::readData(void *vdData, int &nMaxLength) {
 bool CCrazyRadio::writeControl(void *vdData, int nLength, uint8_t u8Request, uint16_t u16Value, uint16_t u16Index) {
   int nTimeout = 1000;
 
-  /*int nReturn = */libusb_control_transfer(m_hndlDevice, LIBUSB_REQUEST_TYPE_VENDOR, u8Request, u16Value, u16Index, (unsigned char*)vdData, nLength, nTimeout);
+  m_ulControlTransfers++;
 
-  // if(nReturn == 0) {
-  //   return true;
-  // }
+  int nReturn = libusb_control_transfer(m_hndlDevice, LIBUSB_REQUEST_TYPE_VENDOR, u8Request, u16Value, u16Index, (unsigned char*)vdData, nLength, nTimeout);
 
-  // Hack.
-  return true;
+  // On success, the number of bytes transferred is returned.
+  return nReturn >= 0;
+}
+
+void CCrazyRadio::invalidateSettings() {
+  m_nARC = -1;
+  m_nChannel = -1;
+  m_strDataRate = "";
+  m_nARDTime = -1;
+  m_nARDBytes = -1;
+  m_nARDValue = -1;
+  m_bPowerKnown = false;
+  m_bAddressKnown = false;
+  m_bContCarrier = -1;
+  m_ulControlTransfers = 0;
+  m_bInlineSettings = false;
 }
 
 void CCrazyRadio::setARC(int nARC) {
-  m_nARC = nARC;
-  this->writeControl(NULL, 0, 0x06, nARC, 0);
+  if(nARC != m_nARC) {
+    m_nARC = nARC;
+    this->writeControl(NULL, 0, 0x06, nARC, 0);
+  }
 }
 
 void CCrazyRadio::setChannel(int nChannel) {
-  m_nChannel = nChannel;
-  this->writeControl(NULL, 0, 0x01, nChannel, 0);
+  if(nChannel != m_nChannel) {
+    m_nChannel = nChannel;
+    this->writeControl(NULL, 0, 0x01, nChannel, 0);
+  }
 }
 
 void CCrazyRadio::setDataRate(std::string strDataRate) {
+  if(strDataRate == m_strDataRate) {
+    return;
+  }
+
   m_strDataRate = strDataRate;
+
+  this->writeControl(NULL, 0, 0x03, this->dataRateCode(strDataRate), 0);
+}
+
+int CCrazyRadio::dataRateCode(std::string strDataRate) {
   int nDataRate = -1;
 
-  if(m_strDataRate == "250K") {
+  if(strDataRate == "250K") {
     nDataRate = 0;
-  } else if(m_strDataRate == "1M") {
+  } else if(strDataRate == "1M") {
     nDataRate = 1;
-  } else if(m_strDataRate == "2M") {
+  } else if(strDataRate == "2M") {
     nDataRate = 2;
   }
 
-  this->writeControl(NULL, 0, 0x03, nDataRate, 0);
+  return nDataRate;
 }
 
 void CCrazyRadio::setARDTime(int nARDTime) { // in uSec
@@ -274,13 +339,90 @@ void CCrazyRadio::setARDTime(int nARDTime) { // in uSec
     nT = 0xf;
   }
 
-  this->writeControl(NULL, 0, 0x05, nT, 0);
+  if(nT != m_nARDValue) {
+    m_nARDValue = nT;
+    this->writeControl(NULL, 0, 0x05, nT, 0);
+  }
 }
 
 void CCrazyRadio::setARDBytes(int nARDBytes) {
   m_nARDBytes = nARDBytes;
 
-  this->writeControl(NULL, 0, 0x05, 0x80 | nARDBytes, 0);
+  if((0x80 | nARDBytes) != m_nARDValue) {
+    m_nARDValue = 0x80 | nARDBytes;
+    this->writeControl(NULL, 0, 0x05, 0x80 | nARDBytes, 0);
+  }
+}
+
+void CCrazyRadio::setAdaptiveRetransmit(bool bAdaptive, int nARCMin, int nARCMax, int nARDTimeMax) {
+  m_bAdaptiveRetransmit = bAdaptive;
+  m_nARCMin = std::max(0, std::min(nARCMin, 15));
+  m_nARCMax = std::max(m_nARCMin, std::min(nARCMax, 15));
+  m_nARDTimeMax = nARDTimeMax;
+
+  m_nAdaptPackets = 0;
+  m_nAdaptFailures = 0;
+  m_nAdaptRetries = 0;
+}
+
+bool CCrazyRadio::adaptiveRetransmit() {
+  return m_bAdaptiveRetransmit;
+}
+
+int CCrazyRadio::arc() {
+  return m_nARC;
+}
+
+int CCrazyRadio::ardTime() {
+  return (m_nARDValue & 0x80 ? 0 : m_nARDTime);
+}
+
+void CCrazyRadio::adaptRetransmit(bool bAck, int nRetries) {
+  m_nAdaptPackets++;
+  m_nAdaptRetries += nRetries;
+
+  if(!bAck) {
+    m_nAdaptFailures++;
+  }
+
+  if(m_nAdaptPackets < RADIO_ADAPT_WINDOW || m_nARC < 0) {
+    return;
+  }
+
+  double dFailureRate = (double)m_nAdaptFailures / m_nAdaptPackets;
+  double dMeanRetries = (double)m_nAdaptRetries / m_nAdaptPackets;
+  bool bTimeBasedARD = !(m_nARDValue & 0x80);
+
+  if(dFailureRate > RADIO_ADAPT_MAX_FAILURE_RATE ||
+     dMeanRetries > m_nARC * RADIO_ADAPT_RETRY_HEADROOM) {
+    // Noisy link: retry more often first, then wait longer between
+    // retries so that interference bursts can pass.
+    if(m_nARC < m_nARCMax) {
+      this->setARC(std::min(m_nARC + 2, m_nARCMax));
+    } else if(m_nARDTimeMax > 0) {
+      int nARDTime = (bTimeBasedARD ? m_nARDTime + 250 : 500);
+
+      if(nARDTime <= m_nARDTimeMax) {
+	this->setARDTime(nARDTime);
+      }
+    }
+  } else if(m_nAdaptFailures == 0 && dMeanRetries < RADIO_ADAPT_CLEAN_RETRIES) {
+    // Clean link: undo waiting first, then give up on retries that
+    // just add latency.
+    if(bTimeBasedARD) {
+      if(m_nARDTime > 500) {
+	this->setARDTime(m_nARDTime - 250);
+      } else {
+	this->setARDBytes(32);
+      }
+    } else if(m_nARC > m_nARCMin) {
+      this->setARC(m_nARC - 1);
+    }
+  }
+
+  m_nAdaptPackets = 0;
+  m_nAdaptFailures = 0;
+  m_nAdaptRetries = 0;
 }
 
 enum Power CCrazyRadio::power() {
@@ -288,106 +430,151 @@ enum Power CCrazyRadio::power() {
 }
 
 void CCrazyRadio::setPower(enum Power enumPower) {
-  m_enumPower = enumPower;
+  if(!m_bPowerKnown || enumPower != m_enumPower) {
+    m_enumPower = enumPower;
+    m_bPowerKnown = true;
 
-  this->writeControl(NULL, 0, 0x04, enumPower, 0);
+    this->writeControl(NULL, 0, 0x04, enumPower, 0);
+  }
 }
 
 void CCrazyRadio::setAddress(char *cAddress) {
-  m_cAddress = cAddress;
+  if(!m_bAddressKnown || std::memcmp(cAddress, m_cAddress, 5) != 0) {
+    std::memcpy(m_cAddress, cAddress, 5);
+    m_bAddressKnown = true;
 
-  this->writeControl(cAddress, 5, 0x02, 0, 0);
+    this->writeControl(cAddress, 5, 0x02, 0, 0);
+  }
 }
 
 void CCrazyRadio::setContCarrier(bool bContCarrier) {
-  m_bContCarrier = bContCarrier;
+  if((bContCarrier ? 1 : 0) != m_bContCarrier) {
+    m_bContCarrier = (bContCarrier ? 1 : 0);
 
-  this->writeControl(NULL, 0, 0x20, (bContCarrier ? 1 : 0), 0);
+    this->writeControl(NULL, 0, 0x20, (bContCarrier ? 1 : 0), 0);
+  }
 }
 
-bool CCrazyRadio::claimInterface(int nInterface) {
-  return libusb_claim_interface(m_hndlDevice, nInterface) == 0;
+void CCrazyRadio::selectContext(struct RadioContext &rcContext) {
+  this->setChannel(rcContext.nChannel);
+  this->setDataRate(rcContext.strDataRate);
+
+  if(m_fDeviceVersion >= 0.4) {
+    this->setAddress(rcContext.cAddress);
+  }
 }
 
-CCRTPPacket *CCrazyRadio::sendPacket(CCRTPPacket *crtpSend, bool bDeleteAfterwards) {
-  CCRTPPacket *crtpPacket = NULL;
+unsigned long CCrazyRadio::controlTransfers() {
+  return m_ulControlTransfers;
+}
 
-  char *cSendable = crtpSend->sendableData();
-  crtpPacket = this->writeData(cSendable, crtpSend->sendableDataLength());
+bool CCrazyRadio::inlineSettings() {
+  return m_bInlineSettings;
+}
 
-  delete[] cSendable;
+char *CCrazyRadio::frameData(struct RadioContext &rcContext, char *cData, int &nLength) {
+  if(m_bInlineSettings) {
+    // Header in the headroom: [frame length, datarate, channel,
+    // address (5 bytes)]
+    cData -= RADIO_INLINE_HEADER_SIZE;
+    nLength += RADIO_INLINE_HEADER_SIZE;
+
+    cData[0] = nLength;
+    cData[1] = this->dataRateCode(rcContext.strDataRate);
+    cData[2] = rcContext.nChannel;
+    std::memcpy(&cData[3], rcContext.cAddress, 5);
+  } else {
+    this->selectContext(rcContext);
+  }
 
-  if(crtpPacket) {
-    char *cData = crtpPacket->data();
-    int nLength = crtpPacket->dataLength();
+  return cData;
+}
 
-    if(nLength > 0) {
-      short sPort = (cData[0] & 0xf0) >> 4;
-      crtpPacket->setPort(sPort);
-      short sChannel = cData[0] & 0b00000011;
-      crtpPacket->setChannel(sChannel);
+CRadioTarget *CCrazyRadio::createTarget(int nChannel, std::string strDataRate, unsigned long long ullAddress) {
+  struct RadioContext rcContext;
+  rcContext.nChannel = nChannel;
+  rcContext.strDataRate = strDataRate;
 
-      switch(sPort) {
-      case 0: { // Console
-	char cText[nLength];
-	std::memcpy(cText, &cData[1], nLength - 1);
-	cText[nLength - 1] = '\0';
+  for(int nI = 0; nI < 5; nI++) {
+    rcContext.cAddress[nI] = (ullAddress >> (8 * (4 - nI))) & 0xff;
+  }
 
-	std::cout << "Console text: " << cText << std::endl;
-      } break;
+  CRadioTarget *rtTarget = new CRadioTarget(this, rcContext);
+  m_vecTargets.push_back(rtTarget);
 
-      case 5: { // Logging
-	if(crtpPacket->channel() == 2) {
-	  CCRTPPacket *crtpLog = new CCRTPPacket(cData, nLength, crtpPacket->channel());
-	  crtpLog->setChannel(crtpPacket->channel());
-	  crtpLog->setPort(crtpPacket->port());
+  return rtTarget;
+}
 
-	  m_lstLoggingPackets.push_back(crtpLog);
-	}
-      } break;
-      }
-    }
+CRadioTarget *CCrazyRadio::nextTarget() {
+  if(m_vecTargets.empty()) {
+    return NULL;
   }
 
-  if(bDeleteAfterwards) {
-    delete crtpSend;
+  if(m_unNextTarget >= m_vecTargets.size()) {
+    m_unNextTarget = 0;
   }
 
-  return crtpPacket;
+  return m_vecTargets[m_unNextTarget++];
+}
+
+int CCrazyRadio::targetCount() {
+  return m_vecTargets.size();
+}
+
+bool CCrazyRadio::claimInterface(int nInterface) {
+  return libusb_claim_interface(m_hndlDevice, nInterface) == 0;
+}
+
+bool CCrazyRadio::transmitData(char *cData, int nLength, CCRTPView &cvReply) {
+  return this->transmitDataTo(m_rcDefault, cData, nLength, cvReply);
 }
 
-CCRTPPacket *CCrazyRadio::readACK() {
-  CCRTPPacket *crtpPacket = NULL;
+bool CCrazyRadio::transmitDataTo(struct RadioContext &rcContext, char *cData, int nLength, CCRTPView &cvReply) {
+  char *cFrame = this->frameData(rcContext, cData, nLength);
 
-  int nBufferSize = 64;
-  char cBuffer[nBufferSize];
-  int nBytesRead = nBufferSize;
+  return this->writeData(cFrame, nLength, cvReply);
+}
 
-  if(this->readData(cBuffer, nBytesRead)) {
-    if(nBytesRead > 0) {
-      // Analyse status byte
-      m_bAckReceived = true;//cBuffer[0] & 0x1;
-      //bool bPowerDetector = cBuffer[0] & 0x2;
-      //int nRetransmissions = cBuffer[0] & 0xf0;
+bool CCrazyRadio::readACK(CCRTPView &cvReply) {
+  int nBytesRead = RADIO_USB_BUFFER_SIZE;
 
-      // TODO(winkler): Do internal stuff with the data received here
-      // (store current link quality, etc.). For now, ignore it.
+  if(this->readData(m_cReceiveBuffer, nBytesRead)) {
+    return this->viewFromACK(m_cReceiveBuffer, nBytesRead, cvReply);
+  }
 
-      crtpPacket = new CCRTPPacket(0);
+  return false;
+}
 
-      if(nBytesRead > 1) {
-      	crtpPacket->setData(&cBuffer[1], nBytesRead);
-      }
-    } else {
-      m_bAckReceived = false;
+bool CCrazyRadio::viewFromACK(char *cBuffer, int nBytesRead, CCRTPView &cvReply) {
+  if(m_bInlineSettings && nBytesRead > 0) {
+    // Inline replies start with the length of the whole frame,
+    // followed by the usual status byte and payload.
+    int nFrameLength = (unsigned char)cBuffer[0];
+    if(nFrameLength < nBytesRead) {
+      nBytesRead = nFrameLength;
     }
+
+    cBuffer++;
+    nBytesRead--;
   }
 
-  return crtpPacket;
-}
+  if(nBytesRead > 0) {
+    // Analyse status byte: ACK flag, power detector and number of
+    // retransmissions
+    this->recordStatus(cBuffer[0]);
+
+    if(m_bAdaptiveRetransmit) {
+      this->adaptRetransmit(cBuffer[0] & 0x1, (cBuffer[0] & 0xf0) >> 4);
+    }
+
+    cvReply.set(&cBuffer[1], nBytesRead - 1);
 
-bool CCrazyRadio::ackReceived() {
-  return m_bAckReceived;
+    return true;
+  }
+
+  m_bAckReceived = false;
+
+  return false;
 }
 
 bool CCrazyRadio::usbOK() {
@@ -396,81 +583,252 @@ bool CCrazyRadio::usbOK() {
 				       &ddDescriptor) == 0);
 }
 
-CCRTPPacket *CCrazyRadio::waitForPacket() {
-  bool bGoon = true;
-  CCRTPPacket *crtpReceived = NULL;
-  CCRTPPacket *crtpDummy = new CCRTPPacket(0);
-  crtpDummy->setIsPingPacket(true);
 
-  while(bGoon) {
-    crtpReceived = this->sendPacket(crtpDummy);
-    bGoon = (crtpReceived == NULL);
+
+bool CCrazyRadio::startAsync(int nTransfersInFlight) {
+  if(m_bAsyncMode) {
+    return true;
   }
 
-  delete crtpDummy;
-  return crtpReceived;
-}
+  if(m_hndlDevice == NULL || nTransfersInFlight < 1) {
+    return false;
+  }
+
+  for(int nI = 0; nI < nTransfersInFlight; nI++) {
+    struct AsyncSlot *asSlot = new struct AsyncSlot();
+    asSlot->crRadio = this;
+    asSlot->ltOut = libusb_alloc_transfer(0);
+    asSlot->ltIn = libusb_alloc_transfer(0);
+    asSlot->lSequence = -1;
+    asSlot->nPending = 0;
+
+    libusb_fill_bulk_transfer(asSlot->ltOut, m_hndlDevice, (0x01 | LIBUSB_ENDPOINT_OUT), asSlot->ucOutBuffer, 0, &CCrazyRadio::transferCallback, asSlot, 1000);
+    libusb_fill_bulk_transfer(asSlot->ltIn, m_hndlDevice, (0x81 | LIBUSB_ENDPOINT_IN), asSlot->ucInBuffer, RADIO_USB_BUFFER_SIZE, &CCrazyRadio::transferCallback, asSlot, 1000);
 
-CCRTPPacket *CCrazyRadio::sendAndReceive(CCRTPPacket *crtpSend, bool bDeleteAfterwards) {
-  return this->sendAndReceive(crtpSend, crtpSend->port(), crtpSend->channel(), bDeleteAfterwards);
+    m_vecAsyncSlots.push_back(asSlot);
+    m_lstFreeSlots.push_back(asSlot);
+  }
+
+  m_lNextSequence = 0;
+  m_dqACKs.clear();
+
+  m_rrRegistry->startEvents();
+  m_bAsyncMode = true;
+
+  return true;
 }
 
-CCRTPPacket *CCrazyRadio::sendAndReceive(CCRTPPacket *crtpSend, int nPort, int nChannel, bool bDeleteAfterwards, int nRetries, int nMicrosecondsWait) {
-  bool bGoon = true;
-  int nResendCounter = 0;
-  CCRTPPacket *crtpReturnvalue = NULL;
-  CCRTPPacket *crtpReceived = NULL;
+void CCrazyRadio::stopAsync() {
+  if(!m_bAsyncMode) {
+    return;
+  }
 
-  while(bGoon) {
-    if(nResendCounter == 0) {
-      crtpReceived = this->sendPacket(crtpSend);
-      nResendCounter = nRetries;
-    } else {
-      nResendCounter--;
-    }
+  m_bAsyncMode = false;
 
-    if(crtpReceived) {
-      if(crtpReceived->port() == nPort &&
-	 crtpReceived->channel() == nChannel) {
-	crtpReturnvalue = crtpReceived;
-	bGoon = false;
+  {
+    std::unique_lock<std::mutex> ulLock(m_mtxAsync);
+
+    for(std::vector<struct AsyncSlot*>::iterator itSlot = m_vecAsyncSlots.begin();
+	itSlot != m_vecAsyncSlots.end();
+	itSlot++) {
+      if((*itSlot)->nPending > 0) {
+	libusb_cancel_transfer((*itSlot)->ltOut);
+	libusb_cancel_transfer((*itSlot)->ltIn);
       }
     }
 
-    if(bGoon) {
-      if(crtpReceived) {
-	delete crtpReceived;
-      }
+    // The event thread is still running and delivers the
+    // cancellations. Wait until no transfer is in flight anymore.
+    m_cvAsync.wait(ulLock, [this] {
+	return m_lstFreeSlots.size() == m_vecAsyncSlots.size();
+      });
+  }
+
+  m_rrRegistry->stopEvents();
+
+  for(std::vector<struct AsyncSlot*>::iterator itSlot = m_vecAsyncSlots.begin();
+      itSlot != m_vecAsyncSlots.end();
+      itSlot++) {
+    libusb_free_transfer((*itSlot)->ltOut);
+    libusb_free_transfer((*itSlot)->ltIn);
+    delete *itSlot;
+  }
+
+  m_vecAsyncSlots.clear();
+  m_lstFreeSlots.clear();
+  m_dqACKs.clear();
+}
+
+bool CCrazyRadio::asyncMode() {
+  return m_bAsyncMode;
+}
+
+void LIBUSB_CALL CCrazyRadio::transferCallback(libusb_transfer *ltTransfer) {
+  struct AsyncSlot *asSlot = (struct AsyncSlot*)ltTransfer->user_data;
+
+  asSlot->crRadio->slotCompleted(asSlot, ltTransfer);
+}
+
+void CCrazyRadio::slotCompleted(struct AsyncSlot *asSlot, libusb_transfer *ltTransfer) {
+  std::lock_guard<std::mutex> lgLock(m_mtxAsync);
+
+  bool bOK = (ltTransfer->status == LIBUSB_TRANSFER_COMPLETED);
+
+  if(ltTransfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+    m_mcUSBTimeouts->increment();
+  }
+
+  if(ltTransfer == asSlot->ltOut) {
+    if(!bOK || ltTransfer->actual_length != ltTransfer->length) {
+      // The dongle won't answer a packet it never got. Don't let the
+      // IN transfer pick up the ACK of the next packet.
+      libusb_cancel_transfer(asSlot->ltIn);
+    }
+  } else {
+    struct AsyncACK aaACK;
+    aaACK.lSequence = asSlot->lSequence;
+    aaACK.nLength = -1;
 
-      usleep(nMicrosecondsWait);
-      crtpReceived = this->waitForPacket();
+    if(bOK) {
+      aaACK.nLength = ltTransfer->actual_length;
+      std::memcpy(aaACK.ucData, asSlot->ucInBuffer, ltTransfer->actual_length);
     }
+
+    m_dqACKs.push_back(aaACK);
+  }
+
+  asSlot->nPending--;
+
+  if(asSlot->nPending == 0) {
+    m_lstFreeSlots.push_back(asSlot);
+  }
+
+  m_cvAsync.notify_all();
+}
+
+long CCrazyRadio::submitData(void *vdData, int nLength) {
+  if(nLength > RADIO_USB_BUFFER_SIZE) {
+    return -1;
+  }
+
+  std::unique_lock<std::mutex> ulLock(m_mtxAsync);
+
+  m_cvAsync.wait(ulLock, [this] {
+      return !m_lstFreeSlots.empty();
+    });
+
+  struct AsyncSlot *asSlot = m_lstFreeSlots.front();
+  m_lstFreeSlots.pop_front();
+
+  std::memcpy(asSlot->ucOutBuffer, vdData, nLength);
+  asSlot->ltOut->length = nLength;
+  asSlot->lSequence = m_lNextSequence++;
+
+  // Submit the IN transfer first so that it is queued by the time
+  // the dongle has the ACK ready.
+  if(libusb_submit_transfer(asSlot->ltIn) != 0) {
+    m_lstFreeSlots.push_back(asSlot);
+    return -1;
+  }
+
+  if(libusb_submit_transfer(asSlot->ltOut) != 0) {
+    asSlot->nPending = 1;
+    libusb_cancel_transfer(asSlot->ltIn);
+    return -1;
+  }
+
+  asSlot->nPending = 2;
+
+  return asSlot->lSequence;
+}
+
+long CCrazyRadio::submitPacket(CCRTPPacket *crtpSend, bool bDeleteAfterwards) {
+  long lSequence = -1;
+
+  if(m_bAsyncMode) {
+    char *cData = &m_cSendBuffer[TRANSPORT_HEADROOM];
+    int nLength = crtpSend->writeSendableData(cData);
+    char *cFrame = this->frameData(m_rcDefault, cData, nLength);
+
+    lSequence = this->submitData(cFrame, nLength);
   }
 
   if(bDeleteAfterwards) {
     delete crtpSend;
   }
 
-  return crtpReturnvalue;
+  return lSequence;
 }
 
-std::list<CCRTPPacket*> CCrazyRadio::popLoggingPackets() {
-  std::list<CCRTPPacket*> lstPackets = m_lstLoggingPackets;
-  m_lstLoggingPackets.clear();
+bool CCrazyRadio::collectACK(long lSequence, int nTimeoutMilliseconds, CCRTPView &cvReply) {
+  std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMilliseconds);
+  std::unique_lock<std::mutex> ulLock(m_mtxAsync);
 
-  return lstPackets;
+  while(true) {
+    while(!m_dqACKs.empty()) {
+      struct AsyncACK aaACK = m_dqACKs.front();
+      m_dqACKs.pop_front();
+
+      if(aaACK.lSequence > lSequence) {
+	// Already collected or dropped earlier; put it back.
+	m_dqACKs.push_front(aaACK);
+	return false;
+      }
+
+      ulLock.unlock();
+
+      if(aaACK.lSequence == lSequence) {
+	// The reply has to outlive this function.
+	if(aaACK.nLength > 0) {
+	  std::memcpy(m_cReceiveBuffer, aaACK.ucData, aaACK.nLength);
+	}
+
+	return this->viewFromACK(m_cReceiveBuffer, aaACK.nLength, cvReply);
+      }
+
+      CCRTPView cvEarlier;
+      if(this->viewFromACK((char*)aaACK.ucData, aaACK.nLength, cvEarlier)) {
+	this->handleReply(cvEarlier);
+      }
+
+      ulLock.lock();
+    }
+
+    if(m_cvAsync.wait_until(ulLock, tpDeadline) == std::cv_status::timeout && m_dqACKs.empty()) {
+      return false;
+    }
+  }
 }
 
-bool CCrazyRadio::sendDummyPacket() {
-  CCRTPPacket *crtpReceived = NULL;
-  CCRTPPacket *crtpDummy = new CCRTPPacket(0);
-  crtpDummy->setIsPingPacket(true);
+CCRTPPacket *CCrazyRadio::waitForACK(long lSequence, int nTimeoutMilliseconds) {
+  CCRTPView cvReply;
 
-  crtpReceived = this->sendPacket(crtpDummy, true);
-  if(crtpReceived) {
-    delete crtpReceived;
-    return true;
+  if(this->collectACK(lSequence, nTimeoutMilliseconds, cvReply)) {
+    this->handleReply(cvReply);
+
+    return cvReply.copy(m_ppPool);
   }
 
-  return false;
+  return NULL;
 }
+
+int CCrazyRadio::processACKs() {
+  int nProcessed = 0;
+  std::unique_lock<std::mutex> ulLock(m_mtxAsync);
+
+  while(!m_dqACKs.empty()) {
+    struct AsyncACK aaACK = m_dqACKs.front();
+    m_dqACKs.pop_front();
+    ulLock.unlock();
+
+    CCRTPView cvReply;
+    if(this->viewFromACK((char*)aaACK.ucData, aaACK.nLength, cvReply)) {
+      this->handleReply(cvReply);
+    }
+
+    nProcessed++;
+    ulLock.lock();
+  }
+
+  return nProcessed;
+}
\ No newline at end of file
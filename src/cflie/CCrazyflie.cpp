@@ -29,7 +29,7 @@
 #include <cflie/CCrazyflie.h>
 
 
-CCrazyflie::CCrazyflie(CCrazyRadio *crRadio) {
+CCrazyflie::CCrazyflie(CTransport *crRadio) {
   m_crRadio = crRadio;
   
   // Review these values
@@ -45,54 +45,155 @@ CCrazyflie::CCrazyflie(CCrazyRadio *crRadio) {
   m_nThrust = 0;
   
   m_bSendsSetpoints = false;
+
+  m_nAckMissCounter = 0;
+  m_nAckMissTolerance = 10;
+  m_dMinAckRate = 0.25;
+  m_mhCycleTime = CMetrics::instance()->histogram("cflie_cycle_seconds", "Time spent in one call of CCrazyflie::cycle()", m_crRadio->metricLabels());
   
   m_tocParameters = new CTOC(m_crRadio, 2);
   m_tocLogs = new CTOC(m_crRadio, 5);
+  m_tfFetcher = NULL;
+
+  for(int nSensor = 0; nSensor < SENSOR_COUNT; nSensor++) {
+    m_thSensors[nSensor].nIndex = -1;
+    m_thSensors[nSensor].nType = 0;
+  }
+
+  // Decode logging data straight from the radio's receive buffer
+  m_crRadio->setLoggingConsumer(m_tocLogs);
   
   m_enumState = STATE_ZERO;
   
   m_dSendSetpointPeriod = 0.01; // Seconds
   m_dSetpointLastSent = 0;
+
+  m_bThreadedIO = false;
+  m_rioThread = new CRadioIOThread(m_crRadio);
+  m_tocParameters->setIOThread(m_rioThread);
+  m_tocLogs->setIOThread(m_rioThread);
+
+  m_bSetpointStreaming = false;
+  m_dStreamingFrequency = 100;
+  m_ssStreamer = new CSetpointStreamer(m_crRadio, m_rioThread);
 }
 
 CCrazyflie::~CCrazyflie() {
+  // The radio is used directly from here on.
+  m_ssStreamer->stop();
+  delete m_ssStreamer;
+
+  m_rioThread->stop();
+  m_tocParameters->setIOThread(NULL);
+  m_tocLogs->setIOThread(NULL);
+  delete m_rioThread;
+
+  delete m_tfFetcher;
+
   this->stopLogging();
+  m_crRadio->setLoggingConsumer(NULL);
 }
 
-bool CCrazyflie::readTOCParameters() {
-  if(m_tocParameters->requestMetaData()) {
-    if(m_tocParameters->requestItems()) {
+bool CCrazyflie::readTOCs() {
+  if(m_rioThread->running()) {
+    // The fetcher would use the transport the I/O thread owns; the
+    // TOCs' own requests go through the thread instead.
+    delete m_tfFetcher;
+    m_tfFetcher = NULL;
+
+    if(m_tocParameters->requestMetaData() && m_tocParameters->requestItems() &&
+       m_tocLogs->requestMetaData() && m_tocLogs->requestItems()) {
+      this->resolveSensorHandles();
+
       return true;
     }
+
+    return false;
   }
-  
-  return false;
-}
 
-bool CCrazyflie::readTOCLogs() {
-  if(m_tocLogs->requestMetaData()) {
-    if(m_tocLogs->requestItems()) {
-      return true;
-    }
+  if(m_tfFetcher == NULL) {
+    // Both TOCs share the request window instead of being
+    // downloaded one after the other.
+    m_tfFetcher = new CTOCFetcher(m_crRadio);
+    m_tfFetcher->addTOC(m_tocParameters);
+    m_tfFetcher->addTOC(m_tocLogs);
+  }
+
+  if(m_tfFetcher->step()) {
+    return false;
+  }
+
+  bool bSucceeded = m_tfFetcher->succeeded();
+
+  // Start over in the next cycle if a TOC failed.
+  delete m_tfFetcher;
+  m_tfFetcher = NULL;
+
+  if(bSucceeded) {
+    this->resolveSensorHandles();
+  }
+
+  return bSucceeded;
+}
+
+void CCrazyflie::resolveSensorHandles() {
+  // Same order as enum Sensor
+  static const char *s_cSensorNames[SENSOR_COUNT] = {
+  "stabilizer.thrust",
+  "stabilizer.roll",
+  "stabilizer.pitch",
+  "stabilizer.yaw",
+  "gyro.x",
+  "gyro.y",
+  "gyro.z",
+  "acc.x",
+  "acc.y",
+  "acc.z",
+  "acc.zw",
+  "pm.vbat",
+  "pm.state",
+  "mag.x",
+  "mag.y",
+  "mag.z",
+  "alti.asl",
+  "alti.aslLong",
+  "alti.pressure",
+  "alti.temperature"
+  };
+
+  for(int nSensor = 0; nSensor < SENSOR_COUNT; nSensor++) {
+    m_thSensors[nSensor] = m_tocLogs->handleForName(s_cSensorNames[nSensor]);
   }
-  
-  return false;
 }
 
-bool CCrazyflie::sendSetpoint(float fRoll, float fPitch, float fYaw, short sThrust) {
+int CCrazyflie::encodeSetpoint(char *cBuffer, float fRoll, float fPitch, float fYaw, short sThrust) {
   fPitch = -fPitch;
-  
-  int nSize = 3 * sizeof(float) + sizeof(short);
-  char cBuffer[nSize];
+
   memcpy(&cBuffer[0 * sizeof(float)], &fRoll, sizeof(float));
   memcpy(&cBuffer[1 * sizeof(float)], &fPitch, sizeof(float));
   memcpy(&cBuffer[2 * sizeof(float)], &fYaw, sizeof(float));
   memcpy(&cBuffer[3 * sizeof(float)], &sThrust, sizeof(short));
+
+  return 3 * sizeof(float) + sizeof(short);
+}
+
+bool CCrazyflie::sendSetpoint(float fRoll, float fPitch, float fYaw, short sThrust) {
+  if(m_rioThread->running()) {
+    char cBuffer[CRTP_MAX_DATA_LENGTH];
+    int nSize = this->encodeSetpoint(cBuffer, fRoll, fPitch, fYaw, sThrust);
+
+    CCRTPPacket *crtpPacket = new(m_crRadio->packetPool()) CCRTPPacket(cBuffer, nSize, 3);
+
+    // Latest value wins: a setpoint not sent yet is replaced
+    return m_rioThread->sendPacket(crtpPacket, TRAFFIC_SETPOINT);
+  }
+
+  // Encode straight into the radio's send buffer
+  char *cBuffer = m_crRadio->beginPacket(3, 0);
+  int nSize = this->encodeSetpoint(cBuffer, fRoll, fPitch, fYaw, sThrust);
+
+  CCRTPPacket *crtpReceived = m_crRadio->commitPacket(nSize);
   
-  CCRTPPacket *crtpPacket = new CCRTPPacket(cBuffer, nSize, 3);
-  CCRTPPacket *crtpReceived = m_crRadio->sendPacket(crtpPacket);
-  
-  delete crtpPacket;
   if(crtpReceived != NULL) {
     delete crtpReceived;
     return true;
@@ -112,10 +213,11 @@ void CCrazyflie::setThrust(int nThrust) {
 }
 
 int CCrazyflie::thrust() {
-  return this->sensorDoubleValue("stabilizer.thrust");
+  return this->sensorValue(SENSOR_THRUST);
 }
 
 bool CCrazyflie::cycle() {
+  std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
   double dTimeNow = this->currentTime();
   
   switch(m_enumState) {
@@ -123,14 +225,9 @@ bool CCrazyflie::cycle() {
     m_enumState = STATE_READ_PARAMETERS_TOC;
   } break;
     
-  case STATE_READ_PARAMETERS_TOC: {
-    if(this->readTOCParameters()) {
-      m_enumState = STATE_READ_LOGS_TOC;
-    }
-  } break;
-    
+  case STATE_READ_PARAMETERS_TOC:
   case STATE_READ_LOGS_TOC: {
-    if(this->readTOCLogs()) {
+    if(this->readTOCs()) {
       m_enumState = STATE_START_LOGGING;
     }
   } break;
@@ -142,7 +239,7 @@ bool CCrazyflie::cycle() {
   } break;
     
   case STATE_ZERO_MEASUREMENTS: {
-    m_tocLogs->processPackets(m_crRadio->popLoggingPackets());
+    this->drainLogging();
     
     // NOTE(winkler): Here, we can do measurement zero'ing. This is
     // not done at the moment, though. Reason: No readings to zero at
@@ -152,18 +249,45 @@ bool CCrazyflie::cycle() {
   } break;
     
   case STATE_NORMAL_OPERATION: {
+    if(m_bThreadedIO && !m_rioThread->running()) {
+      m_rioThread->start();
+    }
+
     // Shove over the sensor readings from the radio to the Logs TOC.
-    m_tocLogs->processPackets(m_crRadio->popLoggingPackets());
+    this->drainLogging();
+
+    if(m_rioThread->running()) {
+      // Nobody is waiting for other replies during normal operation.
+      CCRTPPacket *crtpReceived;
+      while((crtpReceived = m_rioThread->receivedPacket()) != NULL) {
+	delete crtpReceived;
+      }
+    }
     
-    if(m_bSendsSetpoints) {
+    if(!m_bSendsSetpoints || !m_bSetpointStreaming || !m_rioThread->running()) {
+      m_ssStreamer->stop();
+    }
+
+    if(m_bSendsSetpoints && m_bSetpointStreaming && m_rioThread->running()) {
+      // The streamer sends the setpoint on time; just keep it up to
+      // date.
+      char cBuffer[CRTP_MAX_DATA_LENGTH];
+      int nSize = this->encodeSetpoint(cBuffer, m_fRoll, m_fPitch, m_fYaw, m_nThrust);
+      m_ssStreamer->setSetpoint(cBuffer, nSize);
+
+      if(!m_ssStreamer->running()) {
+	m_ssStreamer->start(m_dStreamingFrequency);
+      }
+    } else if(m_bSendsSetpoints) {
       // Check if it's time to send the setpoint
       if(dTimeNow - m_dSetpointLastSent > m_dSendSetpointPeriod) {
 	// Send the current set point based on the previous calculations
 	this->sendSetpoint(m_fRoll, m_fPitch, m_fYaw, m_nThrust);
 	m_dSetpointLastSent = dTimeNow;
       }
-    } else {
-      // Send a dummy packet for keepalive
+    } else if(!m_rioThread->running()) {
+      // Send a dummy packet for keepalive (the I/O thread does this
+      // on its own)
       m_crRadio->sendDummyPacket();
     }
   } break;
@@ -172,17 +296,46 @@ bool CCrazyflie::cycle() {
   } break;
   }
   
-  if(m_crRadio->ackReceived()) {
+  if(this->ackReceived()) {
     m_nAckMissCounter = 0;
   } else {
     m_nAckMissCounter++;
   }
+
+  m_mhCycleTime->observeSince(tpStart);
   
+  if(m_rioThread->running()) {
+    return m_rioThread->usbOK();
+  }
+
   return m_crRadio->usbOK();
 }
 
+void CCrazyflie::drainLogging() {
+  if(m_rioThread->running()) {
+    m_rioThread->drainLogging(m_tocLogs);
+  } else {
+    m_crRadio->drainLoggingFrames(m_tocLogs);
+  }
+}
+
+bool CCrazyflie::ackReceived() {
+  if(m_rioThread->running()) {
+    return m_rioThread->ackReceived();
+  }
+
+  return m_crRadio->ackReceived();
+}
+
 bool CCrazyflie::copterInRange() {
-  return m_nAckMissCounter < m_nAckMissTolerance;
+  // Consecutive misses catch a copter that was switched off, the
+  // ACK rate catches a link that is fading out.
+  return m_nAckMissCounter < m_nAckMissTolerance &&
+    m_crRadio->linkQuality().dAckRate >= m_dMinAckRate;
+}
+
+struct LinkQuality CCrazyflie::linkQuality() {
+  return m_crRadio->linkQuality();
 }
 
 void CCrazyflie::setRoll(float fRoll) {
@@ -194,7 +347,7 @@ void CCrazyflie::setRoll(float fRoll) {
 }
 
 float CCrazyflie::roll() {
-  return this->sensorDoubleValue("stabilizer.roll");
+  return this->sensorValue(SENSOR_ROLL);
 }
 
 void CCrazyflie::setPitch(float fPitch) {
@@ -206,7 +359,7 @@ void CCrazyflie::setPitch(float fPitch) {
 }
 
 float CCrazyflie::pitch() {
-  return this->sensorDoubleValue("stabilizer.pitch");
+  return this->sensorValue(SENSOR_PITCH);
 }
 
 void CCrazyflie::setYaw(float fYaw) {
@@ -218,7 +371,7 @@ void CCrazyflie::setYaw(float fYaw) {
 }
 
 float CCrazyflie::yaw() {
-  return this->sensorDoubleValue("stabilizer.yaw");
+  return this->sensorValue(SENSOR_YAW);
 }
 
 double CCrazyflie::currentTime() {
@@ -263,10 +416,79 @@ bool CCrazyflie::sendsSetpoints() {
   return m_bSendsSetpoints;
 }
 
+void CCrazyflie::setThreadedIO(bool bThreadedIO) {
+  m_bThreadedIO = bThreadedIO;
+
+  if(!m_bThreadedIO) {
+    // Streaming needs the I/O thread.
+    m_bSetpointStreaming = false;
+    m_ssStreamer->stop();
+
+    m_rioThread->stop();
+  }
+}
+
+bool CCrazyflie::threadedIO() {
+  return m_bThreadedIO;
+}
+
+void CCrazyflie::setTOCCacheDirectory(std::string strDirectory) {
+  m_tocParameters->setCacheDirectory(strDirectory);
+  m_tocLogs->setCacheDirectory(strDirectory);
+}
+
+void CCrazyflie::setSetpointStreaming(bool bStreaming, double dFrequency) {
+  m_bSetpointStreaming = bStreaming;
+
+  if(m_bSetpointStreaming) {
+    m_bThreadedIO = true;
+  }
+
+  if(dFrequency != m_dStreamingFrequency || !m_bSetpointStreaming) {
+    // Restarted with the new frequency on the next cycle, if needed
+    m_ssStreamer->stop();
+    m_dStreamingFrequency = dFrequency;
+  }
+}
+
+bool CCrazyflie::setpointStreaming() {
+  return m_bSetpointStreaming;
+}
+
+struct StreamStatistics CCrazyflie::setpointStreamStatistics() {
+  return m_ssStreamer->statistics();
+}
+
 double CCrazyflie::sensorDoubleValue(std::string strName) {
   return m_tocLogs->doubleValue(strName);
 }
 
+struct TOCHandle CCrazyflie::sensorHandle(std::string strName) {
+  return m_tocLogs->handleForName(strName);
+}
+
+double CCrazyflie::sensorDoubleValue(const struct TOCHandle &thHandle) {
+  return m_tocLogs->doubleValue(thHandle);
+}
+
+bool CCrazyflie::setSensorHistory(std::string strName, unsigned int unCapacity) {
+  if(unCapacity == 0) {
+    m_tocLogs->disableHistory(strName);
+
+    return m_tocLogs->handleForName(strName).nIndex != -1;
+  }
+
+  return m_tocLogs->enableHistory(strName, unCapacity);
+}
+
+CTimeSeries *CCrazyflie::sensorHistory(std::string strName) {
+  return m_tocLogs->history(strName);
+}
+
+double CCrazyflie::sensorValue(enum Sensor enumSensor) {
+  return m_tocLogs->doubleValue(m_thSensors[enumSensor]);
+}
+
 void CCrazyflie::disableLogging() {
   m_tocLogs->unregisterLoggingBlock("high-speed");
   m_tocLogs->unregisterLoggingBlock("low-speed");
@@ -289,15 +511,15 @@ void CCrazyflie::enableGyroscopeLogging() {
 }
 
 float CCrazyflie::gyroX() {
-  return this->sensorDoubleValue("gyro.x");
+  return this->sensorValue(SENSOR_GYRO_X);
 }
 
 float CCrazyflie::gyroY() {
-  return this->sensorDoubleValue("gyro.y");
+  return this->sensorValue(SENSOR_GYRO_Y);
 }
 
 float CCrazyflie::gyroZ() {
-  return this->sensorDoubleValue("gyro.z");
+  return this->sensorValue(SENSOR_GYRO_Z);
 }
 
 void CCrazyflie::enableAccelerometerLogging() {
@@ -310,19 +532,19 @@ void CCrazyflie::enableAccelerometerLogging() {
 }
 
 float CCrazyflie::accX() {
-  return this->sensorDoubleValue("acc.x");
+  return this->sensorValue(SENSOR_ACC_X);
 }
 
 float CCrazyflie::accY() {
-  return this->sensorDoubleValue("acc.y");
+  return this->sensorValue(SENSOR_ACC_Y);
 }
 
 float CCrazyflie::accZ() {
-  return this->sensorDoubleValue("acc.z");
+  return this->sensorValue(SENSOR_ACC_Z);
 }
 
 float CCrazyflie::accZW() {
-  return this->sensorDoubleValue("acc.zw");
+  return this->sensorValue(SENSOR_ACC_ZW);
 }
 
 void CCrazyflie::disableStabilizerLogging() {
@@ -345,11 +567,11 @@ void CCrazyflie::enableBatteryLogging() {
 }
 
 double CCrazyflie::batteryLevel() {
-  return this->sensorDoubleValue("pm.vbat");
+  return this->sensorValue(SENSOR_BATTERY_LEVEL);
 }
 
 float CCrazyflie::batteryState() {
-  return this->sensorDoubleValue("pm.state");
+  return this->sensorValue(SENSOR_BATTERY_STATE);
 }
 
 void CCrazyflie::disableBatteryLogging() {
@@ -364,13 +586,13 @@ void CCrazyflie::enableMagnetometerLogging() {
   m_tocLogs->startLogging("mag.z", "magnetometer");
 }
 float CCrazyflie::magX() {
-  return this->sensorDoubleValue("mag.x");
+  return this->sensorValue(SENSOR_MAG_X);
 }
 float CCrazyflie::magY() {
-  return this->sensorDoubleValue("mag.y");
+  return this->sensorValue(SENSOR_MAG_Y);
 }
 float CCrazyflie::magZ() {
-  return this->sensorDoubleValue("mag.z");
+  return this->sensorValue(SENSOR_MAG_Z);
 }
 void CCrazyflie::disableMagnetometerLogging() {
   m_tocLogs->unregisterLoggingBlock("magnetometer");
@@ -385,16 +607,16 @@ void CCrazyflie::enableAltimeterLogging() {
 }
 
 float CCrazyflie::asl() {
-  return this->sensorDoubleValue("alti.asl");
+  return this->sensorValue(SENSOR_ASL);
 }
 float CCrazyflie::aslLong() {
-  return this->sensorDoubleValue("alti.aslLong");
+  return this->sensorValue(SENSOR_ASL_LONG);
 }
 float CCrazyflie::pressure() {
-  return this->sensorDoubleValue("alti.pressure");
+  return this->sensorValue(SENSOR_PRESSURE);
 }
 float CCrazyflie::temperature() {
-  return this->sensorDoubleValue("alti.temperature");
+  return this->sensorValue(SENSOR_TEMPERATURE);
 }
 
 void CCrazyflie::disableAltimeterLogging() {
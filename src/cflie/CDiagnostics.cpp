@@ -0,0 +1,207 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CDiagnostics.h>
+
+
+CDiagnostics::CDiagnostics() {
+  m_nMinSeverity = SEVERITY_INFO;
+  m_nRateLimit = DIAGNOSTICS_DEFAULT_RATE_LIMIT;
+  m_lRateWindow = 0;
+  m_nRateCount = 0;
+  m_ulSuppressed = 0;
+  m_ulDropped = 0;
+  m_ulReportedSuppressed = 0;
+  m_tpStart = std::chrono::steady_clock::now();
+
+  m_bWriterRunning = false;
+  this->startWriter();
+}
+
+CDiagnostics::~CDiagnostics() {
+  this->stopWriter();
+  this->deliver();
+}
+
+CDiagnostics *CDiagnostics::instance() {
+  static CDiagnostics dgInstance;
+
+  return &dgInstance;
+}
+
+bool CDiagnostics::admit() {
+  int nRateLimit = m_nRateLimit;
+
+  if(nRateLimit <= 0) {
+    return true;
+  }
+
+  long lNow = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_tpStart).count();
+  long lWindow = m_lRateWindow;
+
+  if(lNow != lWindow && m_lRateWindow.compare_exchange_strong(lWindow, lNow)) {
+    m_nRateCount = 0;
+  }
+
+  if(m_nRateCount++ >= nRateLimit) {
+    m_ulSuppressed++;
+
+    return false;
+  }
+
+  return true;
+}
+
+void CDiagnostics::post(enum Severity enumSeverity, const char *cText, int nLength, int nSource) {
+  if(enumSeverity < m_nMinSeverity || !this->admit()) {
+    return;
+  }
+
+  struct DiagnosticMessage dmMessage;
+  dmMessage.enumSeverity = enumSeverity;
+  dmMessage.nSource = nSource;
+  dmMessage.dTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tpStart).count();
+
+  if(nLength > DIAGNOSTICS_MESSAGE_LENGTH - 1) {
+    nLength = DIAGNOSTICS_MESSAGE_LENGTH - 1;
+  }
+
+  std::memcpy(dmMessage.cText, cText, nLength);
+  dmMessage.cText[nLength] = '\0';
+
+  if(!m_mpmcMessages.push(dmMessage)) {
+    m_ulDropped++;
+  }
+}
+
+void CDiagnostics::post(enum Severity enumSeverity, std::string strText, int nSource) {
+  this->post(enumSeverity, strText.c_str(), strText.size(), nSource);
+}
+
+void CDiagnostics::setMinSeverity(enum Severity enumSeverity) {
+  m_nMinSeverity = enumSeverity;
+}
+
+void CDiagnostics::setRateLimit(int nMessagesPerSecond) {
+  m_nRateLimit = nMessagesPerSecond;
+}
+
+void CDiagnostics::setCallback(std::function<void(const struct DiagnosticMessage&)> fncCallback) {
+  std::lock_guard<std::mutex> lgLock(m_mtxDelivery);
+
+  m_fncCallback = fncCallback;
+}
+
+void CDiagnostics::deliverMessage(const struct DiagnosticMessage &dmMessage) {
+  if(m_fncCallback) {
+    m_fncCallback(dmMessage);
+    return;
+  }
+
+  switch(dmMessage.enumSeverity) {
+  case SEVERITY_CONSOLE:
+    std::cout << "Console text: ";
+    break;
+
+  case SEVERITY_WARNING:
+    std::cout << "Warning: ";
+    break;
+
+  case SEVERITY_ERROR:
+    std::cout << "Error: ";
+    break;
+
+  default:
+    break;
+  }
+
+  std::cout << dmMessage.cText << "\n";
+}
+
+int CDiagnostics::deliver() {
+  std::lock_guard<std::mutex> lgLock(m_mtxDelivery);
+  int nDelivered = 0;
+
+  struct DiagnosticMessage dmMessage;
+  while(m_mpmcMessages.pop(dmMessage)) {
+    this->deliverMessage(dmMessage);
+    nDelivered++;
+  }
+
+  // Report suppressed messages once the rate limit allows again
+  unsigned long ulSuppressed = m_ulSuppressed;
+
+  if(ulSuppressed != m_ulReportedSuppressed && nDelivered > 0) {
+    std::string strText = std::to_string(ulSuppressed - m_ulReportedSuppressed) + " diagnostic messages suppressed";
+
+    dmMessage.enumSeverity = SEVERITY_WARNING;
+    dmMessage.nSource = -1;
+    std::strncpy(dmMessage.cText, strText.c_str(), DIAGNOSTICS_MESSAGE_LENGTH - 1);
+    dmMessage.cText[DIAGNOSTICS_MESSAGE_LENGTH - 1] = '\0';
+
+    this->deliverMessage(dmMessage);
+    m_ulReportedSuppressed = ulSuppressed;
+  }
+
+  if(nDelivered > 0 && !m_fncCallback) {
+    std::cout.flush();
+  }
+
+  return nDelivered;
+}
+
+void CDiagnostics::runWriter() {
+  while(m_bWriterRunning) {
+    if(this->deliver() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+void CDiagnostics::startWriter() {
+  if(!m_bWriterRunning) {
+    m_bWriterRunning = true;
+    m_thrdWriter = std::thread(&CDiagnostics::runWriter, this);
+  }
+}
+
+void CDiagnostics::stopWriter() {
+  if(m_bWriterRunning) {
+    m_bWriterRunning = false;
+    m_thrdWriter.join();
+  }
+}
+
+unsigned long CDiagnostics::suppressedMessages() {
+  return m_ulSuppressed;
+}
+
+unsigned long CDiagnostics::droppedMessages() {
+  return m_ulDropped;
+}
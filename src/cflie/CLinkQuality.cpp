@@ -0,0 +1,94 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CLinkQuality.h>
+
+
+CLinkQuality::CLinkQuality() {
+  this->reset();
+}
+
+void CLinkQuality::reset() {
+  m_ulRecorded = 0;
+  m_nPackets = 0;
+  m_nAcks = 0;
+  m_nPowerDetector = 0;
+  m_nRetries = 0;
+
+  for(int nI = 0; nI < 16; nI++) {
+    m_nRetryHistogram[nI] = 0;
+  }
+}
+
+void CLinkQuality::count(unsigned char ucStatus, int nDirection) {
+  int nRetries = (ucStatus & 0xf0) >> 4;
+
+  m_nAcks += (ucStatus & 0x1 ? nDirection : 0);
+  m_nPowerDetector += (ucStatus & 0x2 ? nDirection : 0);
+  m_nRetries += nRetries * nDirection;
+  m_nRetryHistogram[nRetries] += nDirection;
+}
+
+void CLinkQuality::record(unsigned char ucStatus) {
+  unsigned int unSlot = m_ulRecorded % LINK_QUALITY_WINDOW;
+
+  if(m_ulRecorded >= LINK_QUALITY_WINDOW) {
+    // The oldest status drops out of the window.
+    this->count(m_ucStatus[unSlot], -1);
+  } else {
+    m_nPackets++;
+  }
+
+  m_ucStatus[unSlot] = ucStatus;
+  this->count(ucStatus, 1);
+
+  m_ulRecorded++;
+}
+
+struct LinkQuality CLinkQuality::snapshot() {
+  struct LinkQuality lqQuality;
+  lqQuality.nPackets = m_nPackets;
+
+  double dPackets = (lqQuality.nPackets > 0 ? lqQuality.nPackets : 1);
+  lqQuality.dAckRate = (lqQuality.nPackets > 0 ? m_nAcks / dPackets : 1.0);
+  lqQuality.dPowerDetectorRatio = m_nPowerDetector / dPackets;
+  lqQuality.dMeanRetries = m_nRetries / dPackets;
+
+  for(int nI = 0; nI < 16; nI++) {
+    lqQuality.nRetryHistogram[nI] = m_nRetryHistogram[nI];
+  }
+
+  return lqQuality;
+}
+
+double CLinkQuality::ackRate() {
+  int nPackets = m_nPackets;
+
+  return (nPackets > 0 ? (double)m_nAcks / nPackets : 1.0);
+}
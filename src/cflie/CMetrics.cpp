@@ -0,0 +1,336 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CMetrics.h>
+
+
+const double CMetricHistogram::s_dBounds[METRICS_HISTOGRAM_BUCKETS] = {
+  0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025,
+  0.005, 0.01, 0.025, 0.05, 0.1, 0.25
+};
+
+
+CMetric::CMetric(std::string strName, std::string strHelp, std::string strLabels, enum MetricType enumType) {
+  m_strName = strName;
+  m_strHelp = strHelp;
+  m_strLabels = strLabels;
+  m_enumType = enumType;
+}
+
+CMetric::~CMetric() {
+}
+
+std::string CMetric::name() {
+  return m_strName;
+}
+
+std::string CMetric::help() {
+  return m_strHelp;
+}
+
+std::string CMetric::labels() {
+  return m_strLabels;
+}
+
+enum MetricType CMetric::type() {
+  return m_enumType;
+}
+
+
+CMetricCounter::CMetricCounter(std::string strName, std::string strHelp, std::string strLabels) : CMetric(strName, strHelp, strLabels, METRIC_COUNTER) {
+  m_ulValue = 0;
+}
+
+unsigned long CMetricCounter::value() {
+  return m_ulValue.load(std::memory_order_relaxed);
+}
+
+void CMetricCounter::sample(std::list<struct MetricSample> &lstSamples) {
+  struct MetricSample msSample = {m_strName, m_strLabels, (double)this->value()};
+  lstSamples.push_back(msSample);
+}
+
+
+CMetricGauge::CMetricGauge(std::string strName, std::string strHelp, std::string strLabels) : CMetric(strName, strHelp, strLabels, METRIC_GAUGE) {
+  m_lValue = 0;
+}
+
+long CMetricGauge::value() {
+  return m_lValue.load(std::memory_order_relaxed);
+}
+
+void CMetricGauge::sample(std::list<struct MetricSample> &lstSamples) {
+  struct MetricSample msSample = {m_strName, m_strLabels, (double)this->value()};
+  lstSamples.push_back(msSample);
+}
+
+
+CMetricHistogram::CMetricHistogram(std::string strName, std::string strHelp, std::string strLabels) : CMetric(strName, strHelp, strLabels, METRIC_HISTOGRAM) {
+  for(int nI = 0; nI <= METRICS_HISTOGRAM_BUCKETS; nI++) {
+    m_ulBuckets[nI] = 0;
+  }
+
+  m_ulCount = 0;
+  m_ullSumNanoseconds = 0;
+}
+
+void CMetricHistogram::observe(double dSeconds) {
+  int nBucket = 0;
+  while(nBucket < METRICS_HISTOGRAM_BUCKETS && dSeconds > s_dBounds[nBucket]) {
+    nBucket++;
+  }
+
+  m_ulBuckets[nBucket].fetch_add(1, std::memory_order_relaxed);
+  m_ulCount.fetch_add(1, std::memory_order_relaxed);
+  m_ullSumNanoseconds.fetch_add((unsigned long long)(dSeconds * 1e9), std::memory_order_relaxed);
+}
+
+void CMetricHistogram::observeSince(std::chrono::steady_clock::time_point tpStart) {
+  this->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count());
+}
+
+unsigned long CMetricHistogram::count() {
+  return m_ulCount.load(std::memory_order_relaxed);
+}
+
+void CMetricHistogram::sample(std::list<struct MetricSample> &lstSamples) {
+  std::string strPrefix = (m_strLabels.empty() ? "" : m_strLabels + ",");
+  unsigned long ulCumulative = 0;
+
+  for(int nI = 0; nI <= METRICS_HISTOGRAM_BUCKETS; nI++) {
+    ulCumulative += m_ulBuckets[nI].load(std::memory_order_relaxed);
+
+    std::stringstream sts;
+    sts << strPrefix << "le=\"";
+    if(nI < METRICS_HISTOGRAM_BUCKETS) {
+      sts << s_dBounds[nI];
+    } else {
+      sts << "+Inf";
+    }
+    sts << "\"";
+
+    struct MetricSample msBucket = {m_strName + "_bucket", sts.str(), (double)ulCumulative};
+    lstSamples.push_back(msBucket);
+  }
+
+  struct MetricSample msSum = {m_strName + "_sum", m_strLabels, m_ullSumNanoseconds.load(std::memory_order_relaxed) / 1e9};
+  struct MetricSample msCount = {m_strName + "_count", m_strLabels, (double)ulCumulative};
+  lstSamples.push_back(msSum);
+  lstSamples.push_back(msCount);
+}
+
+
+CMetrics::CMetrics() {
+}
+
+CMetrics::~CMetrics() {
+  for(std::list<CMetric*>::iterator itMetric = m_lstMetrics.begin();
+      itMetric != m_lstMetrics.end();
+      itMetric++) {
+    delete *itMetric;
+  }
+}
+
+CMetrics *CMetrics::instance() {
+  static CMetrics mtInstance;
+
+  return &mtInstance;
+}
+
+CMetric *CMetrics::find(std::string strName, std::string strLabels) {
+  for(std::list<CMetric*>::iterator itMetric = m_lstMetrics.begin();
+      itMetric != m_lstMetrics.end();
+      itMetric++) {
+    if((*itMetric)->name() == strName && (*itMetric)->labels() == strLabels) {
+      return *itMetric;
+    }
+  }
+
+  return NULL;
+}
+
+CMetric *CMetrics::add(CMetric *mtMetric) {
+  // Members of a family registered later still end up next to the
+  // others, as the exposition format requires.
+  std::list<CMetric*>::iterator itPosition = m_lstMetrics.begin();
+  while(itPosition != m_lstMetrics.end() && (*itPosition)->name() <= mtMetric->name()) {
+    itPosition++;
+  }
+
+  m_lstMetrics.insert(itPosition, mtMetric);
+
+  return mtMetric;
+}
+
+CMetricCounter *CMetrics::counter(std::string strName, std::string strHelp, std::string strLabels) {
+  std::lock_guard<std::mutex> lgLock(m_mtxMetrics);
+  CMetric *mtMetric = this->find(strName, strLabels);
+
+  if(mtMetric == NULL) {
+    mtMetric = this->add(new CMetricCounter(strName, strHelp, strLabels));
+  }
+
+  return dynamic_cast<CMetricCounter*>(mtMetric);
+}
+
+CMetricGauge *CMetrics::gauge(std::string strName, std::string strHelp, std::string strLabels) {
+  std::lock_guard<std::mutex> lgLock(m_mtxMetrics);
+  CMetric *mtMetric = this->find(strName, strLabels);
+
+  if(mtMetric == NULL) {
+    mtMetric = this->add(new CMetricGauge(strName, strHelp, strLabels));
+  }
+
+  return dynamic_cast<CMetricGauge*>(mtMetric);
+}
+
+CMetricHistogram *CMetrics::histogram(std::string strName, std::string strHelp, std::string strLabels) {
+  std::lock_guard<std::mutex> lgLock(m_mtxMetrics);
+  CMetric *mtMetric = this->find(strName, strLabels);
+
+  if(mtMetric == NULL) {
+    mtMetric = this->add(new CMetricHistogram(strName, strHelp, strLabels));
+  }
+
+  return dynamic_cast<CMetricHistogram*>(mtMetric);
+}
+
+std::list<struct MetricSample> CMetrics::snapshot() {
+  std::lock_guard<std::mutex> lgLock(m_mtxMetrics);
+  std::list<struct MetricSample> lstSamples;
+
+  for(std::list<CMetric*>::iterator itMetric = m_lstMetrics.begin();
+      itMetric != m_lstMetrics.end();
+      itMetric++) {
+    (*itMetric)->sample(lstSamples);
+  }
+
+  return lstSamples;
+}
+
+std::string CMetrics::renderPrometheus() {
+  std::lock_guard<std::mutex> lgLock(m_mtxMetrics);
+  std::stringstream sts;
+  std::string strDescribed;
+
+  // Counters easily exceed the six digits streams print by default
+  sts.precision(15);
+
+  for(std::list<CMetric*>::iterator itMetric = m_lstMetrics.begin();
+      itMetric != m_lstMetrics.end();
+      itMetric++) {
+    CMetric *mtMetric = *itMetric;
+    std::string strName = mtMetric->name();
+
+    // HELP and TYPE once per metric family, before its first sample;
+    // the registry keeps families together.
+    if(strName != strDescribed) {
+      const char *cTypes[] = {"counter", "gauge", "histogram"};
+
+      sts << "# HELP " << strName << " " << mtMetric->help() << "\n";
+      sts << "# TYPE " << strName << " " << cTypes[mtMetric->type()] << "\n";
+      strDescribed = strName;
+    }
+
+    std::list<struct MetricSample> lstSamples;
+    mtMetric->sample(lstSamples);
+
+    for(std::list<struct MetricSample>::iterator itSample = lstSamples.begin();
+	itSample != lstSamples.end();
+	itSample++) {
+      sts << (*itSample).strName;
+      if(!(*itSample).strLabels.empty()) {
+	sts << "{" << (*itSample).strLabels << "}";
+      }
+      sts << " " << (*itSample).dValue << "\n";
+    }
+  }
+
+  return sts.str();
+}
+
+bool CMetrics::writeToFile(std::string strPath) {
+  std::string strText = this->renderPrometheus();
+  std::string strTemporary = strPath + ".tmp";
+
+  FILE *fFile = std::fopen(strTemporary.c_str(), "w");
+  if(fFile == NULL) {
+    return false;
+  }
+
+  bool bWritten = (std::fwrite(strText.data(), 1, strText.size(), fFile) == strText.size());
+  bWritten = (std::fclose(fFile) == 0) && bWritten;
+
+  if(!bWritten) {
+    std::remove(strTemporary.c_str());
+    return false;
+  }
+
+  return std::rename(strTemporary.c_str(), strPath.c_str()) == 0;
+}
+
+bool CMetrics::writeToSocket(std::string strPath) {
+  struct sockaddr_un saAddress;
+
+  if(strPath.size() >= sizeof(saAddress.sun_path)) {
+    return false;
+  }
+
+  std::memset(&saAddress, 0, sizeof(saAddress));
+  saAddress.sun_family = AF_UNIX;
+  std::strcpy(saAddress.sun_path, strPath.c_str());
+
+  int nSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(nSocket < 0) {
+    return false;
+  }
+
+  bool bWritten = false;
+  if(connect(nSocket, (struct sockaddr*)&saAddress, sizeof(saAddress)) == 0) {
+    std::string strText = this->renderPrometheus();
+    size_t szWritten = 0;
+
+    while(szWritten < strText.size()) {
+      // A collector closing the connection early must not raise
+      // SIGPIPE in the host process.
+      ssize_t sszResult = send(nSocket, strText.data() + szWritten, strText.size() - szWritten, MSG_NOSIGNAL);
+      if(sszResult <= 0) {
+	break;
+      }
+
+      szWritten += sszResult;
+    }
+
+    bWritten = (szWritten == strText.size());
+  }
+
+  close(nSocket);
+
+  return bWritten;
+}
@@ -0,0 +1,213 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CRadioIOThread.h>
+
+
+CRadioIOThread::CRadioIOThread(CTransport *crRadio) : m_usScheduler(crRadio->metricLabels()) {
+  m_crRadio = crRadio;
+
+  m_bRunning = false;
+  m_bAckReceived = false;
+  m_bUSBOK = true;
+  m_ulDroppedPackets = 0;
+
+  m_ccLoggingConsumer = NULL;
+}
+
+CRadioIOThread::~CRadioIOThread() {
+  this->stop();
+  this->clearQueues();
+}
+
+bool CRadioIOThread::start() {
+  if(!m_bRunning) {
+    // Logging frames must cross over to the application thread, so
+    // they are collected as packets while the thread runs.
+    m_ccLoggingConsumer = m_crRadio->loggingConsumer();
+    m_crRadio->setLoggingConsumer(NULL);
+
+    m_bRunning = true;
+    m_thrdIO = std::thread(&CRadioIOThread::run, this);
+  }
+
+  return true;
+}
+
+void CRadioIOThread::stop() {
+  if(m_bRunning) {
+    m_bRunning = false;
+    m_thrdIO.join();
+
+    m_crRadio->setLoggingConsumer(m_ccLoggingConsumer);
+
+    m_usScheduler.clear();
+  }
+}
+
+bool CRadioIOThread::running() {
+  return m_bRunning;
+}
+
+void CRadioIOThread::setKeepalivePeriod(double dSeconds) {
+  m_usScheduler.setRateLimit(TRAFFIC_KEEPALIVE, (dSeconds > 0 ? 1 / dSeconds : 0));
+}
+
+CUplinkScheduler *CRadioIOThread::scheduler() {
+  return &m_usScheduler;
+}
+
+void CRadioIOThread::clearQueues() {
+  CCRTPPacket *crtpPacket;
+
+  m_usScheduler.clear();
+
+  while(m_spscIncoming.pop(crtpPacket)) {
+    delete crtpPacket;
+  }
+}
+
+void CRadioIOThread::run() {
+  while(m_bRunning) {
+    CCRTPPacket *crtpSend = NULL;
+    enum TrafficClass enumClass;
+
+    if(!m_usScheduler.next(crtpSend, enumClass)) {
+      // Nothing to do yet; poll the scheduler again shortly.
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+
+    CCRTPPacket *crtpReceived = m_crRadio->sendPacket(crtpSend);
+
+    m_bAckReceived = m_crRadio->ackReceived();
+    m_bUSBOK = m_crRadio->usbOK();
+
+    m_usScheduler.completed(crtpSend, enumClass, crtpReceived != NULL && m_bAckReceived);
+
+    if(crtpReceived) {
+      this->handleReply(crtpReceived);
+    }
+  }
+}
+
+void CRadioIOThread::handleReply(CCRTPPacket *crtpReceived) {
+  // Logging frames were already stored in the radio's logging ring,
+  // which the application drains on its own.
+  if(crtpReceived->dataLength() > 0 &&
+     !(crtpReceived->port() == 5 && crtpReceived->channel() == 2)) {
+    if(!m_spscIncoming.push(crtpReceived)) {
+      delete crtpReceived;
+      m_ulDroppedPackets++;
+    }
+  } else {
+    delete crtpReceived;
+  }
+}
+
+bool CRadioIOThread::sendPacket(CCRTPPacket *crtpSend, enum TrafficClass enumClass) {
+  return m_usScheduler.submit(crtpSend, enumClass);
+}
+
+CCRTPPacket *CRadioIOThread::receivedPacket() {
+  CCRTPPacket *crtpPacket = NULL;
+  m_spscIncoming.pop(crtpPacket);
+
+  return crtpPacket;
+}
+
+CCRTPPacket *CRadioIOThread::sendAndReceive(CCRTPPacket *crtpSend, bool bDeleteAfterwards, int nMatchLength) {
+  std::chrono::steady_clock::time_point tpNow = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::time_point::max();
+  if(m_crRadio->requestTimeout() > 0) {
+    tpDeadline = tpNow + std::chrono::milliseconds(m_crRadio->requestTimeout());
+  }
+
+  std::chrono::steady_clock::time_point tpResend = tpNow;
+  nMatchLength = std::max(0, std::min(nMatchLength, crtpSend->dataLength()));
+  CCRTPPacket *crtpReply = NULL;
+
+  while(crtpReply == NULL && m_bRunning && tpNow < tpDeadline) {
+    if(tpNow >= tpResend) {
+      // The scheduler takes ownership of what it sends.
+      CCRTPPacket *crtpCopy = new(m_crRadio->packetPool()) CCRTPPacket(crtpSend->data(), crtpSend->dataLength(), 0);
+      crtpCopy->setPort(crtpSend->port());
+      crtpCopy->setChannel(crtpSend->channel());
+
+      m_usScheduler.submit(crtpCopy, TRAFFIC_CONFIGURATION);
+      tpResend = tpNow + std::chrono::milliseconds(RADIO_IO_RESEND_INTERVAL);
+    }
+
+    CCRTPPacket *crtpReceived;
+    while(crtpReply == NULL && (crtpReceived = this->receivedPacket()) != NULL) {
+      // Replies hold the whole frame, header byte included.
+      if(crtpReceived->port() == crtpSend->port() &&
+	 crtpReceived->channel() == crtpSend->channel() &&
+	 crtpReceived->dataLength() > nMatchLength &&
+	 std::memcmp(crtpReceived->data() + 1, crtpSend->data(), nMatchLength) == 0) {
+	crtpReply = crtpReceived;
+      } else {
+	delete crtpReceived;
+      }
+    }
+
+    if(crtpReply == NULL) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      tpNow = std::chrono::steady_clock::now();
+    }
+  }
+
+  if(crtpReply == NULL) {
+    CDiagnostics::instance()->post(SEVERITY_WARNING, "No reply on port " + std::to_string(crtpSend->port()) + ", channel " + std::to_string(crtpSend->channel()) + " before the request timed out", m_crRadio->diagnosticsSource());
+  }
+
+  if(bDeleteAfterwards) {
+    delete crtpSend;
+  }
+
+  return crtpReply;
+}
+
+unsigned int CRadioIOThread::drainLogging(CCRTPConsumer *ccConsumer) {
+  // The logging ring is safe to drain while the thread uses the
+  // transport.
+  return m_crRadio->drainLoggingFrames(ccConsumer);
+}
+
+bool CRadioIOThread::ackReceived() {
+  return m_bAckReceived;
+}
+
+bool CRadioIOThread::usbOK() {
+  return m_bUSBOK;
+}
+
+unsigned long CRadioIOThread::droppedPackets() {
+  return m_ulDroppedPackets;
+}
@@ -0,0 +1,213 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CRadioRegistry.h>
+
+
+CRadioRegistry *CRadioRegistry::s_rrInstance = NULL;
+int CRadioRegistry::s_nUsers = 0;
+std::mutex CRadioRegistry::s_mtxInstance;
+
+
+CRadioRegistry::CRadioRegistry() {
+  m_ctxContext = NULL;
+  m_nEventUsers = 0;
+  m_bEventsRunning = false;
+
+  libusb_init(&m_ctxContext);
+}
+
+CRadioRegistry::~CRadioRegistry() {
+  this->clearDongles();
+
+  if(m_ctxContext) {
+    libusb_exit(m_ctxContext);
+  }
+}
+
+CRadioRegistry *CRadioRegistry::acquire() {
+  std::lock_guard<std::mutex> lgLock(s_mtxInstance);
+
+  if(s_rrInstance == NULL) {
+    s_rrInstance = new CRadioRegistry();
+  }
+
+  s_nUsers++;
+
+  return s_rrInstance;
+}
+
+void CRadioRegistry::release() {
+  std::lock_guard<std::mutex> lgLock(s_mtxInstance);
+
+  if(s_nUsers > 0) {
+    s_nUsers--;
+
+    if(s_nUsers == 0) {
+      delete s_rrInstance;
+      s_rrInstance = NULL;
+    }
+  }
+}
+
+libusb_context *CRadioRegistry::context() {
+  return m_ctxContext;
+}
+
+void CRadioRegistry::clearDongles() {
+  for(std::vector<struct DongleInfo>::iterator itDongle = m_vecDongles.begin();
+      itDongle != m_vecDongles.end();
+      itDongle++) {
+    libusb_unref_device((*itDongle).devDevice);
+  }
+
+  m_vecDongles.clear();
+}
+
+bool CRadioRegistry::dongleBefore(const struct DongleInfo &diA, const struct DongleInfo &diB) {
+  if(diA.nBus != diB.nBus) {
+    return diA.nBus < diB.nBus;
+  }
+
+  return diA.vecPorts < diB.vecPorts;
+}
+
+int CRadioRegistry::enumerate() {
+  std::lock_guard<std::mutex> lgLock(m_mtxDongles);
+
+  this->clearDongles();
+
+  libusb_device **ptDevices;
+  ssize_t szCount = libusb_get_device_list(m_ctxContext, &ptDevices);
+
+  for(ssize_t szI = 0; szI < szCount; szI++) {
+    libusb_device *devCurrent = ptDevices[szI];
+    libusb_device_descriptor ddDescriptor;
+
+    libusb_get_device_descriptor(devCurrent, &ddDescriptor);
+
+    if(ddDescriptor.idVendor == 0x1915 && ddDescriptor.idProduct == 0x7777) {
+      struct DongleInfo diDongle;
+      diDongle.devDevice = libusb_ref_device(devCurrent);
+      diDongle.nBus = libusb_get_bus_number(devCurrent);
+
+      uint8_t u8Ports[8];
+      int nPorts = libusb_get_port_numbers(devCurrent, u8Ports, 8);
+
+      std::stringstream sts;
+      sts << diDongle.nBus;
+
+      for(int nI = 0; nI < nPorts; nI++) {
+	diDongle.vecPorts.push_back(u8Ports[nI]);
+	sts << (nI == 0 ? "-" : ".") << (int)u8Ports[nI];
+      }
+
+      diDongle.strBusPath = sts.str();
+      m_vecDongles.push_back(diDongle);
+    }
+  }
+
+  if(szCount > 0) {
+    libusb_free_device_list(ptDevices, 1);
+  }
+
+  std::sort(m_vecDongles.begin(), m_vecDongles.end(), &CRadioRegistry::dongleBefore);
+
+  return m_vecDongles.size();
+}
+
+int CRadioRegistry::dongleCount() {
+  std::lock_guard<std::mutex> lgLock(m_mtxDongles);
+
+  return m_vecDongles.size();
+}
+
+std::string CRadioRegistry::dongleBusPath(int nDongle) {
+  std::lock_guard<std::mutex> lgLock(m_mtxDongles);
+
+  if(nDongle >= 0 && nDongle < (int)m_vecDongles.size()) {
+    return m_vecDongles[nDongle].strBusPath;
+  }
+
+  return "";
+}
+
+libusb_device *CRadioRegistry::deviceForDongle(int nDongle) {
+  if(nDongle < 0) {
+    return NULL;
+  }
+
+  if(nDongle >= this->dongleCount()) {
+    // Not known (yet); the dongle might have been plugged in since
+    // the last enumeration.
+    this->enumerate();
+  }
+
+  std::lock_guard<std::mutex> lgLock(m_mtxDongles);
+
+  if(nDongle < (int)m_vecDongles.size()) {
+    return libusb_ref_device(m_vecDongles[nDongle].devDevice);
+  }
+
+  return NULL;
+}
+
+void CRadioRegistry::startEvents() {
+  std::lock_guard<std::mutex> lgLock(m_mtxEvents);
+
+  m_nEventUsers++;
+
+  if(m_nEventUsers == 1) {
+    m_bEventsRunning = true;
+    m_thrdEvents = std::thread(&CRadioRegistry::eventLoop, this);
+  }
+}
+
+void CRadioRegistry::stopEvents() {
+  std::lock_guard<std::mutex> lgLock(m_mtxEvents);
+
+  if(m_nEventUsers > 0) {
+    m_nEventUsers--;
+
+    if(m_nEventUsers == 0) {
+      m_bEventsRunning = false;
+      m_thrdEvents.join();
+    }
+  }
+}
+
+void CRadioRegistry::eventLoop() {
+  while(m_bEventsRunning) {
+    struct timeval tvTimeout;
+    tvTimeout.tv_sec = 0;
+    tvTimeout.tv_usec = 100000;
+
+    libusb_handle_events_timeout_completed(m_ctxContext, &tvTimeout, NULL);
+  }
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CRadioTarget.h>
+
+
+CRadioTarget::CRadioTarget(CCrazyRadio *crRadio, struct RadioContext rcContext) {
+  m_crRadio = crRadio;
+  m_rcContext = rcContext;
+}
+
+CRadioTarget::~CRadioTarget() {
+}
+
+bool CRadioTarget::transmitData(char *cData, int nLength, CCRTPView &cvReply) {
+  bool bReceived = m_crRadio->transmitDataTo(m_rcContext, cData, nLength, cvReply);
+
+  if(bReceived) {
+    this->recordStatus(m_crRadio->lastStatus());
+  } else {
+    m_bAckReceived = false;
+  }
+
+  return bReceived;
+}
+
+struct RadioContext CRadioTarget::context() {
+  return m_rcContext;
+}
+
+bool CRadioTarget::usbOK() {
+  return m_crRadio->usbOK();
+}
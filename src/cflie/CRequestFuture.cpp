@@ -0,0 +1,147 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CRequestFuture.h>
+#include <cflie/CTransport.h>
+
+
+CRequestFuture::CRequestFuture() {
+  m_ctTransport = NULL;
+  m_lID = -1;
+  m_enumState = REQUEST_CANCELLED;
+  m_crtpReply = NULL;
+}
+
+CRequestFuture::CRequestFuture(CTransport *ctTransport, long lID) {
+  m_ctTransport = ctTransport;
+  m_lID = lID;
+  m_enumState = REQUEST_PENDING;
+  m_crtpReply = NULL;
+}
+
+CRequestFuture::CRequestFuture(CRequestFuture &&rfOther) {
+  m_ctTransport = rfOther.m_ctTransport;
+  m_lID = rfOther.m_lID;
+  m_enumState = rfOther.m_enumState;
+  m_crtpReply = rfOther.m_crtpReply;
+
+  rfOther.m_ctTransport = NULL;
+  rfOther.m_enumState = REQUEST_CANCELLED;
+  rfOther.m_crtpReply = NULL;
+}
+
+CRequestFuture::~CRequestFuture() {
+  this->release();
+}
+
+CRequestFuture &CRequestFuture::operator=(CRequestFuture &&rfOther) {
+  if(this != &rfOther) {
+    this->release();
+
+    m_ctTransport = rfOther.m_ctTransport;
+    m_lID = rfOther.m_lID;
+    m_enumState = rfOther.m_enumState;
+    m_crtpReply = rfOther.m_crtpReply;
+
+    rfOther.m_ctTransport = NULL;
+    rfOther.m_enumState = REQUEST_CANCELLED;
+    rfOther.m_crtpReply = NULL;
+  }
+
+  return *this;
+}
+
+void CRequestFuture::release() {
+  if(m_enumState == REQUEST_PENDING && m_ctTransport) {
+    m_ctTransport->cancelRequest(m_lID);
+  }
+
+  if(m_crtpReply) {
+    delete m_crtpReply;
+    m_crtpReply = NULL;
+  }
+
+  m_ctTransport = NULL;
+}
+
+enum RequestState CRequestFuture::poll() {
+  if(m_enumState != REQUEST_PENDING) {
+    return m_enumState;
+  }
+
+  m_enumState = m_ctTransport->requestState(m_lID);
+
+  switch(m_enumState) {
+  case REQUEST_ANSWERED: {
+    m_crtpReply = m_ctTransport->takeReply(m_lID);
+  } break;
+
+  case REQUEST_EXPIRED: {
+    m_ctTransport->cancelRequest(m_lID);
+  } break;
+
+  default: {
+  } break;
+  }
+
+  return m_enumState;
+}
+
+enum RequestState CRequestFuture::wait(int nMicrosecondsWait) {
+  while(this->poll() == REQUEST_PENDING) {
+    usleep(nMicrosecondsWait);
+    m_ctTransport->pumpRequests();
+  }
+
+  return m_enumState;
+}
+
+void CRequestFuture::cancel() {
+  if(this->poll() == REQUEST_PENDING) {
+    m_ctTransport->cancelRequest(m_lID);
+    m_enumState = REQUEST_CANCELLED;
+  }
+}
+
+CCRTPPacket *CRequestFuture::reply() {
+  this->poll();
+
+  CCRTPPacket *crtpReply = m_crtpReply;
+  m_crtpReply = NULL;
+
+  return crtpReply;
+}
+
+long CRequestFuture::id() {
+  return m_lID;
+}
+
+CTransport *CRequestFuture::transport() {
+  return m_ctTransport;
+}
@@ -0,0 +1,183 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CSetpointStreamer.h>
+
+
+CSetpointStreamer::CSetpointStreamer(CTransport *crRadio, CRadioIOThread *rioThread) {
+  m_crRadio = crRadio;
+  m_rioThread = rioThread;
+
+  m_bRunning = false;
+  m_lPeriod = 10000000;
+  m_nSetpointLength = 0;
+
+  CMetrics *mtMetrics = CMetrics::instance();
+  m_mhJitter = mtMetrics->histogram("cflie_setpoint_jitter_seconds", "Delay between a setpoint deadline and the streaming thread waking up", m_crRadio->metricLabels());
+  m_mcOverruns = mtMetrics->counter("cflie_setpoint_overruns_total", "Setpoint periods skipped because the streaming thread woke up too late", m_crRadio->metricLabels());
+
+  this->resetStatistics();
+}
+
+CSetpointStreamer::~CSetpointStreamer() {
+  this->stop();
+}
+
+bool CSetpointStreamer::start(double dFrequency) {
+  if(dFrequency <= 0) {
+    return false;
+  }
+
+  if(!m_bRunning) {
+    m_lPeriod = NSEC_PER_SEC / std::min(dFrequency, (double)SETPOINT_STREAM_MAX_FREQUENCY);
+
+    m_bRunning = true;
+    m_thrdStream = std::thread(&CSetpointStreamer::run, this);
+  }
+
+  return true;
+}
+
+void CSetpointStreamer::stop() {
+  if(m_bRunning) {
+    m_bRunning = false;
+    m_thrdStream.join();
+  }
+}
+
+bool CSetpointStreamer::running() {
+  return m_bRunning;
+}
+
+double CSetpointStreamer::period() {
+  return double(m_lPeriod) / NSEC_PER_SEC;
+}
+
+void CSetpointStreamer::setSetpoint(const char *cPayload, int nLength) {
+  std::lock_guard<std::mutex> lgSetpoint(m_mtxSetpoint);
+
+  m_nSetpointLength = std::min(nLength, CRTP_MAX_DATA_LENGTH);
+  memcpy(m_cSetpoint, cPayload, m_nSetpointLength);
+}
+
+bool CSetpointStreamer::sendSetpoint() {
+  CCRTPPacket *crtpSetpoint = NULL;
+
+  {
+    std::lock_guard<std::mutex> lgSetpoint(m_mtxSetpoint);
+
+    if(m_nSetpointLength > 0) {
+      crtpSetpoint = new(m_crRadio->packetPool()) CCRTPPacket(m_cSetpoint, m_nSetpointLength, 3);
+    }
+  }
+
+  if(crtpSetpoint) {
+    return m_rioThread->sendPacket(crtpSetpoint, TRAFFIC_SETPOINT);
+  }
+
+  return false;
+}
+
+void CSetpointStreamer::run() {
+  struct timespec tsDeadline;
+  clock_gettime(CLOCK_MONOTONIC, &tsDeadline);
+
+  while(m_bRunning) {
+    tsDeadline.tv_nsec += m_lPeriod;
+
+    while(tsDeadline.tv_nsec >= NSEC_PER_SEC) {
+      tsDeadline.tv_nsec -= NSEC_PER_SEC;
+      tsDeadline.tv_sec++;
+    }
+
+    // Sleep until the deadline itself, not for a duration: time
+    // spent in here doesn't shift the following deadlines.
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tsDeadline, NULL) == EINTR) {
+    }
+
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+
+    long lLate = (tsNow.tv_sec - tsDeadline.tv_sec) * NSEC_PER_SEC + (tsNow.tv_nsec - tsDeadline.tv_nsec);
+    unsigned long ulOverruns = 0;
+
+    if(lLate >= m_lPeriod) {
+      // Too late for the following deadline(s) already; skip them
+      // rather than sending a burst of setpoints to catch up.
+      ulOverruns = lLate / m_lPeriod;
+      long lSkipped = ulOverruns * m_lPeriod;
+
+      tsDeadline.tv_sec += lSkipped / NSEC_PER_SEC;
+      tsDeadline.tv_nsec += lSkipped % NSEC_PER_SEC;
+
+      if(tsDeadline.tv_nsec >= NSEC_PER_SEC) {
+	tsDeadline.tv_nsec -= NSEC_PER_SEC;
+	tsDeadline.tv_sec++;
+      }
+    }
+
+    this->recordPeriod(double(lLate) / NSEC_PER_SEC, ulOverruns);
+
+    if(m_bRunning) {
+      this->sendSetpoint();
+    }
+  }
+}
+
+void CSetpointStreamer::recordPeriod(double dJitter, unsigned long ulOverruns) {
+  m_mhJitter->observe(dJitter);
+
+  if(ulOverruns > 0) {
+    m_mcOverruns->increment(ulOverruns);
+  }
+
+  std::lock_guard<std::mutex> lgStatistics(m_mtxStatistics);
+
+  m_ssStatistics.ulPeriods++;
+  m_ssStatistics.ulOverruns += ulOverruns;
+  m_dJitterSum += dJitter;
+  m_ssStatistics.dMeanJitter = m_dJitterSum / m_ssStatistics.ulPeriods;
+  m_ssStatistics.dMaxJitter = std::max(m_ssStatistics.dMaxJitter, dJitter);
+}
+
+struct StreamStatistics CSetpointStreamer::statistics() {
+  std::lock_guard<std::mutex> lgStatistics(m_mtxStatistics);
+
+  return m_ssStatistics;
+}
+
+void CSetpointStreamer::resetStatistics() {
+  std::lock_guard<std::mutex> lgStatistics(m_mtxStatistics);
+
+  m_ssStatistics.ulPeriods = 0;
+  m_ssStatistics.ulOverruns = 0;
+  m_ssStatistics.dMeanJitter = 0;
+  m_ssStatistics.dMaxJitter = 0;
+  m_dJitterSum = 0;
+}
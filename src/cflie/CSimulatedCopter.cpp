@@ -0,0 +1,550 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CSimulatedCopter.h>
+
+
+CSimulatedCopter::CSimulatedCopter() : m_urdLoss(0.0, 1.0) {
+  m_unDownlinkCapacity = 16;
+  m_ulDownlinkOverflows = 0;
+  m_ulPacketsReceived = 0;
+  m_ulPacketsLost = 0;
+  m_nLatency = 0;
+  m_dLossRate = 0;
+  m_dStartTime = this->currentTime();
+
+  this->addDefaultVariables();
+}
+
+CSimulatedCopter::~CSimulatedCopter() {
+}
+
+void CSimulatedCopter::addDefaultVariables() {
+  this->addLogVariable("stabilizer", "roll", 7);
+  this->addLogVariable("stabilizer", "pitch", 7);
+  this->addLogVariable("stabilizer", "yaw", 7);
+  this->addLogVariable("stabilizer", "thrust", 2);
+  this->addLogVariable("gyro", "x", 7);
+  this->addLogVariable("gyro", "y", 7);
+  this->addLogVariable("gyro", "z", 7);
+  this->addLogVariable("acc", "x", 7);
+  this->addLogVariable("acc", "y", 7);
+  this->addLogVariable("acc", "z", 7, 1.0);
+  this->addLogVariable("acc", "zw", 7);
+  this->addLogVariable("pm", "vbat", 7, 3.9);
+  this->addLogVariable("pm", "state", 4);
+  this->addLogVariable("mag", "x", 7);
+  this->addLogVariable("mag", "y", 7);
+  this->addLogVariable("mag", "z", 7);
+  this->addLogVariable("alti", "asl", 7);
+  this->addLogVariable("alti", "aslLong", 7);
+  this->addLogVariable("alti", "pressure", 7, 1013.25);
+  this->addLogVariable("alti", "temperature", 7, 21.0);
+
+  this->addParameter("flightmode", "althold", 1);
+  this->addParameter("flightmode", "xmode", 1);
+  this->addParameter("pid_rate", "roll_kp", 7, 70.0);
+  this->addParameter("pid_rate", "pitch_kp", 7, 70.0);
+  this->addParameter("pid_rate", "yaw_kp", 7, 50.0);
+}
+
+double CSimulatedCopter::currentTime() {
+  struct timespec tsTime;
+  clock_gettime(CLOCK_MONOTONIC, &tsTime);
+
+  return tsTime.tv_sec + double(tsTime.tv_nsec) / 1000000000L;
+}
+
+void CSimulatedCopter::setLatency(int nMicroseconds) {
+  m_nLatency = nMicroseconds;
+}
+
+void CSimulatedCopter::setLossRate(double dLossRate) {
+  m_dLossRate = dLossRate;
+}
+
+void CSimulatedCopter::setDownlinkCapacity(unsigned int unCapacity) {
+  m_unDownlinkCapacity = unCapacity;
+}
+
+int CSimulatedCopter::addLogVariable(std::string strGroup, std::string strIdentifier, int nType, double dValue) {
+  struct SimulatedVariable svNew;
+  svNew.strGroup = strGroup;
+  svNew.strIdentifier = strIdentifier;
+  svNew.nType = nType;
+  svNew.dValue = dValue;
+
+  m_vecLogVariables.push_back(svNew);
+
+  return m_vecLogVariables.size() - 1;
+}
+
+int CSimulatedCopter::addParameter(std::string strGroup, std::string strIdentifier, int nType, double dValue) {
+  struct SimulatedVariable svNew;
+  svNew.strGroup = strGroup;
+  svNew.strIdentifier = strIdentifier;
+  svNew.nType = nType;
+  svNew.dValue = dValue;
+
+  m_vecParameters.push_back(svNew);
+
+  return m_vecParameters.size() - 1;
+}
+
+int CSimulatedCopter::indexForName(std::vector<struct SimulatedVariable> &vecVariables, std::string strName) {
+  for(unsigned int unI = 0; unI < vecVariables.size(); unI++) {
+    if(vecVariables[unI].strGroup + "." + vecVariables[unI].strIdentifier == strName) {
+      return unI;
+    }
+  }
+
+  return -1;
+}
+
+bool CSimulatedCopter::setLogValue(std::string strName, double dValue) {
+  int nIndex = this->indexForName(m_vecLogVariables, strName);
+
+  if(nIndex >= 0) {
+    m_vecLogVariables[nIndex].dValue = dValue;
+    return true;
+  }
+
+  return false;
+}
+
+bool CSimulatedCopter::usbOK() {
+  return true;
+}
+
+unsigned long CSimulatedCopter::packetsReceived() {
+  return m_ulPacketsReceived;
+}
+
+unsigned long CSimulatedCopter::packetsLost() {
+  return m_ulPacketsLost;
+}
+
+unsigned long CSimulatedCopter::downlinkOverflows() {
+  return m_ulDownlinkOverflows;
+}
+
+int CSimulatedCopter::typeSize(int nType) {
+  switch(nType) {
+  case 1: // UINT8
+  case 4: // INT8
+    return 1;
+
+  case 2: // UINT16
+  case 5: // INT16
+  case 8: // FP16
+    return 2;
+
+  case 3: // UINT32
+  case 6: // INT32
+  case 7: // FLOAT
+    return 4;
+
+  default:
+    return 0;
+  }
+}
+
+void CSimulatedCopter::encodeValue(char *cBuffer, int nType, double dValue) {
+  switch(nType) {
+  case 1: {
+    uint8_t uint8Value = dValue;
+    std::memcpy(cBuffer, &uint8Value, 1);
+  } break;
+
+  case 2: {
+    uint16_t uint16Value = dValue;
+    std::memcpy(cBuffer, &uint16Value, 2);
+  } break;
+
+  case 3: {
+    uint32_t uint32Value = dValue;
+    std::memcpy(cBuffer, &uint32Value, 4);
+  } break;
+
+  case 4: {
+    int8_t int8Value = dValue;
+    std::memcpy(cBuffer, &int8Value, 1);
+  } break;
+
+  case 5: {
+    int16_t int16Value = dValue;
+    std::memcpy(cBuffer, &int16Value, 2);
+  } break;
+
+  case 6: {
+    int32_t int32Value = dValue;
+    std::memcpy(cBuffer, &int32Value, 4);
+  } break;
+
+  case 7: {
+    float fValue = dValue;
+    std::memcpy(cBuffer, &fValue, 4);
+  } break;
+
+  default: { // FP16 isn't simulated
+    std::memset(cBuffer, 0, this->typeSize(nType));
+  } break;
+  }
+}
+
+uint32_t CSimulatedCopter::tocCRC(std::vector<struct SimulatedVariable> &vecVariables) {
+  // CRC32 over all advertised names and types, so that the CRC
+  // changes whenever the TOC does.
+  uint32_t u32CRC = 0xffffffff;
+
+  for(unsigned int unI = 0; unI < vecVariables.size(); unI++) {
+    std::string strEntry = vecVariables[unI].strGroup + "." + vecVariables[unI].strIdentifier;
+    strEntry += (char)vecVariables[unI].nType;
+
+    for(unsigned int unJ = 0; unJ < strEntry.size(); unJ++) {
+      u32CRC ^= (unsigned char)strEntry[unJ];
+
+      for(int nBit = 0; nBit < 8; nBit++) {
+	u32CRC = (u32CRC >> 1) ^ (0xedb88320 & -(u32CRC & 1));
+      }
+    }
+  }
+
+  return ~u32CRC;
+}
+
+struct SimulatedLogBlock *CSimulatedCopter::logBlockForID(int nID) {
+  for(std::list<struct SimulatedLogBlock>::iterator itBlock = m_lstLogBlocks.begin();
+      itBlock != m_lstLogBlocks.end();
+      itBlock++) {
+    if((*itBlock).nID == nID) {
+      return &(*itBlock);
+    }
+  }
+
+  return NULL;
+}
+
+int CSimulatedCopter::logBlockSize(struct SimulatedLogBlock *slbBlock) {
+  int nSize = 0;
+
+  for(std::list<int>::iterator itVariable = slbBlock->lstVariables.begin();
+      itVariable != slbBlock->lstVariables.end();
+      itVariable++) {
+    nSize += this->typeSize(m_vecLogVariables[*itVariable].nType);
+  }
+
+  return nSize;
+}
+
+void CSimulatedCopter::queueDownlink(int nPort, int nChannel, const char *cData, int nLength) {
+  if(m_dqDownlink.size() >= m_unDownlinkCapacity) {
+    m_ulDownlinkOverflows++;
+    return;
+  }
+
+  std::string strPacket;
+  strPacket += (char)((nPort << 4) | 0b00001100 | (nChannel & 0x03));
+  strPacket.append(cData, nLength);
+
+  m_dqDownlink.push_back(strPacket);
+}
+
+bool CSimulatedCopter::transmitData(char *cData, int nLength, CCRTPView &cvReply) {
+  if(m_nLatency > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(m_nLatency));
+  }
+
+  if(m_dLossRate > 0 && m_urdLoss(m_mtRandom) < m_dLossRate) {
+    // Neither delivered nor acknowledged; the dongle still reports
+    // back, just without ACK.
+    m_ulPacketsLost++;
+    this->recordStatus(0x00);
+    cvReply.set(m_cReceiveBuffer, 0);
+
+    return true;
+  }
+
+  m_ulPacketsReceived++;
+  this->recordStatus(0x01);
+
+  // Ping packets consist of a single 0xff byte
+  if(!(nLength == 1 && (unsigned char)cData[0] == 0xff)) {
+    int nPort = (cData[0] & 0xf0) >> 4;
+    int nChannel = cData[0] & 0x03;
+
+    this->handlePacket(nPort, nChannel, &cData[1], nLength - 1);
+  }
+
+  this->emitLogPackets(this->currentTime());
+
+  int nReplyLength = 0;
+
+  if(!m_dqDownlink.empty()) {
+    std::string &strPacket = m_dqDownlink.front();
+
+    nReplyLength = std::min((int)strPacket.size(), (int)sizeof(m_cReceiveBuffer));
+    std::memcpy(m_cReceiveBuffer, strPacket.data(), nReplyLength);
+
+    m_dqDownlink.pop_front();
+  }
+
+  cvReply.set(m_cReceiveBuffer, nReplyLength);
+
+  return true;
+}
+
+void CSimulatedCopter::handlePacket(int nPort, int nChannel, char *cData, int nLength) {
+  switch(nPort) {
+  case 2: { // Parameters
+    if(nChannel == 0) {
+      this->handleTOC(m_vecParameters, nPort, cData, nLength);
+    }
+  } break;
+
+  case 3: { // Commander
+    this->handleSetpoint(cData, nLength);
+  } break;
+
+  case 5: { // Logging
+    if(nChannel == 0) {
+      this->handleTOC(m_vecLogVariables, nPort, cData, nLength);
+    } else if(nChannel == 1) {
+      this->handleLogControl(cData, nLength);
+    }
+  } break;
+
+  default: {
+  } break;
+  }
+}
+
+void CSimulatedCopter::handleTOC(std::vector<struct SimulatedVariable> &vecVariables, int nPort, char *cData, int nLength) {
+  if(nLength < 1) {
+    return;
+  }
+
+  switch(cData[0]) {
+  case 0x00: { // Get item
+    unsigned int unID = (nLength > 1 ? (unsigned char)cData[1] : 0);
+
+    if(unID < vecVariables.size()) {
+      std::string strReply;
+      strReply += (char)0x00;
+      strReply += (char)unID;
+      strReply += (char)vecVariables[unID].nType;
+      strReply += vecVariables[unID].strGroup;
+      strReply += '\0';
+      strReply += vecVariables[unID].strIdentifier;
+      strReply += '\0';
+
+      this->queueDownlink(nPort, 0, strReply.data(), strReply.size());
+    }
+  } break;
+
+  case 0x01: { // Get info
+    uint32_t u32CRC = this->tocCRC(vecVariables);
+    char cReply[8];
+    cReply[0] = 0x01;
+    cReply[1] = vecVariables.size();
+    std::memcpy(&cReply[2], &u32CRC, 4);
+    cReply[6] = 16; // Maximum number of logging blocks
+    cReply[7] = 128; // Maximum number of logged variables
+
+    this->queueDownlink(nPort, 0, cReply, (nPort == 5 ? 8 : 6));
+  } break;
+
+  default: {
+  } break;
+  }
+}
+
+void CSimulatedCopter::handleLogControl(char *cData, int nLength) {
+  if(nLength < 1) {
+    return;
+  }
+
+  char cCommand = cData[0];
+  int nBlockID = (nLength > 1 ? (unsigned char)cData[1] : 0);
+  char cResult = 0;
+
+  switch(cCommand) {
+  case 0x00: // Create block
+  case 0x01: { // Append variables to block
+    struct SimulatedLogBlock *slbBlock = this->logBlockForID(nBlockID);
+
+    if(cCommand == 0x00) {
+      if(slbBlock) {
+	cResult = 17; // EEXIST
+	break;
+      }
+
+      struct SimulatedLogBlock slbNew;
+      slbNew.nID = nBlockID;
+      slbNew.dPeriod = 0.1;
+      slbNew.bStarted = false;
+      slbNew.dNextDue = 0;
+      m_lstLogBlocks.push_back(slbNew);
+
+      slbBlock = &m_lstLogBlocks.back();
+    } else if(!slbBlock) {
+      cResult = 2; // ENOENT
+      break;
+    }
+
+    // Variables come as (type, ID) pairs
+    for(int nI = 2; nI + 1 < nLength; nI += 2) {
+      unsigned int unID = (unsigned char)cData[nI + 1];
+
+      if(unID >= m_vecLogVariables.size()) {
+	cResult = 2; // ENOENT
+	break;
+      }
+
+      if(this->logBlockSize(slbBlock) + this->typeSize(m_vecLogVariables[unID].nType) > 26) {
+	cResult = 7; // E2BIG
+	break;
+      }
+
+      slbBlock->lstVariables.push_back(unID);
+    }
+  } break;
+
+  case 0x02: { // Delete block
+    bool bFound = false;
+
+    for(std::list<struct SimulatedLogBlock>::iterator itBlock = m_lstLogBlocks.begin();
+	itBlock != m_lstLogBlocks.end();
+	itBlock++) {
+      if((*itBlock).nID == nBlockID) {
+	m_lstLogBlocks.erase(itBlock);
+	bFound = true;
+	break;
+      }
+    }
+
+    if(!bFound) {
+      cResult = 2; // ENOENT
+    }
+  } break;
+
+  case 0x03: { // Start block
+    struct SimulatedLogBlock *slbBlock = this->logBlockForID(nBlockID);
+
+    if(slbBlock) {
+      // The period is given in units of 10ms
+      int nPeriod = (nLength > 2 ? (unsigned char)cData[2] : 10);
+      if(nPeriod < 1) {
+	nPeriod = 1;
+      }
+
+      slbBlock->dPeriod = nPeriod * 0.01;
+      slbBlock->bStarted = true;
+      slbBlock->dNextDue = this->currentTime() + slbBlock->dPeriod;
+    } else {
+      cResult = 2; // ENOENT
+    }
+  } break;
+
+  case 0x04: { // Stop block
+    struct SimulatedLogBlock *slbBlock = this->logBlockForID(nBlockID);
+
+    if(slbBlock) {
+      slbBlock->bStarted = false;
+    } else {
+      cResult = 2; // ENOENT
+    }
+  } break;
+
+  case 0x05: { // Reset
+    m_lstLogBlocks.clear();
+    nBlockID = 0;
+  } break;
+
+  default: {
+    cResult = 8; // ENOEXEC
+  } break;
+  }
+
+  char cReply[3] = {cCommand, (char)nBlockID, cResult};
+  this->queueDownlink(5, 1, cReply, 3);
+}
+
+void CSimulatedCopter::handleSetpoint(char *cData, int nLength) {
+  if(nLength < 3 * (int)sizeof(float) + (int)sizeof(uint16_t)) {
+    return;
+  }
+
+  float fRoll, fPitch, fYaw;
+  uint16_t u16Thrust;
+  std::memcpy(&fRoll, &cData[0 * sizeof(float)], sizeof(float));
+  std::memcpy(&fPitch, &cData[1 * sizeof(float)], sizeof(float));
+  std::memcpy(&fYaw, &cData[2 * sizeof(float)], sizeof(float));
+  std::memcpy(&u16Thrust, &cData[3 * sizeof(float)], sizeof(uint16_t));
+
+  // A perfect stabilizer: the copter immediately is where it was
+  // told to be.
+  this->setLogValue("stabilizer.roll", fRoll);
+  this->setLogValue("stabilizer.pitch", -fPitch);
+  this->setLogValue("stabilizer.yaw", fYaw);
+  this->setLogValue("stabilizer.thrust", u16Thrust);
+}
+
+void CSimulatedCopter::emitLogPackets(double dNow) {
+  uint32_t u32Timestamp = (dNow - m_dStartTime) * 1000;
+
+  for(std::list<struct SimulatedLogBlock>::iterator itBlock = m_lstLogBlocks.begin();
+      itBlock != m_lstLogBlocks.end();
+      itBlock++) {
+    struct SimulatedLogBlock &slbBlock = *itBlock;
+
+    if(!slbBlock.bStarted) {
+      continue;
+    }
+
+    while(slbBlock.dNextDue <= dNow) {
+      char cPacket[30];
+      cPacket[0] = slbBlock.nID;
+      std::memcpy(&cPacket[1], &u32Timestamp, 3);
+
+      int nOffset = 4;
+      for(std::list<int>::iterator itVariable = slbBlock.lstVariables.begin();
+	  itVariable != slbBlock.lstVariables.end();
+	  itVariable++) {
+	struct SimulatedVariable &svVariable = m_vecLogVariables[*itVariable];
+
+	this->encodeValue(&cPacket[nOffset], svVariable.nType, svVariable.dValue);
+	nOffset += this->typeSize(svVariable.nType);
+      }
+
+      this->queueDownlink(5, 2, cPacket, nOffset);
+      slbBlock.dNextDue += slbBlock.dPeriod;
+    }
+  }
+}
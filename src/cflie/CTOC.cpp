@@ -27,20 +27,34 @@
 
 
 #include <cflie/CTOC.h>
+#include <cflie/CTOCFetcher.h>
 
 
-CTOC::CTOC(CCrazyRadio *crRadio, int nPort) {
+CTOC::CTOC(CTransport *crRadio, int nPort) {
   m_crRadio = crRadio;
+  m_rioThread = NULL;
   m_nPort = nPort;
   m_nItemCount = 0;
+  m_u32CRC = 0;
+  m_bHasCRC = false;
 }
 
 CTOC::~CTOC() {
+  for(std::vector<CTimeSeries*>::iterator itHistory = m_vecHistories.begin();
+      itHistory != m_vecHistories.end();
+      itHistory++) {
+    delete *itHistory;
+  }
 }
 
 bool CTOC::sendTOCPointerReset() {
-  CCRTPPacket* crtpPacket = new CCRTPPacket(0x00, 0);
+  CCRTPPacket* crtpPacket = new(m_crRadio->packetPool()) CCRTPPacket(0x00, 0);
   crtpPacket->setPort(m_nPort);
+
+  if(m_rioThread && m_rioThread->running()) {
+    return m_rioThread->sendPacket(crtpPacket, TRAFFIC_CONFIGURATION);
+  }
+
   CCRTPPacket* crtpReceived = m_crRadio->sendPacket(crtpPacket, true);
 
   if(crtpReceived) {
@@ -51,18 +65,183 @@ bool CTOC::sendTOCPointerReset() {
   return false;
 }
 
-bool CTOC::requestMetaData() {
-  bool bReturnvalue = false;
+void CTOC::setIOThread(CRadioIOThread* rioThread) {
+  m_rioThread = rioThread;
+}
+
+CCRTPPacket* CTOC::exchangeRequest(CCRTPPacket* crtpRequest, int nMatchLength) {
+  if(m_rioThread && m_rioThread->running()) {
+    return m_rioThread->sendAndReceive(crtpRequest, true, nMatchLength);
+  }
+
+  return m_crRadio->sendAndReceive(crtpRequest, true, nMatchLength);
+}
+
+CTransport* CTOC::transport() {
+  return m_crRadio;
+}
+
+int CTOC::itemCount() {
+  return m_nItemCount;
+}
+
+uint32_t CTOC::crc() {
+  return m_u32CRC;
+}
+
+void CTOC::setCacheDirectory(std::string strDirectory) {
+  m_strCacheDirectory = strDirectory;
+}
+
+std::string CTOC::cacheDirectory() {
+  return m_strCacheDirectory;
+}
+
+std::string CTOC::cachePath() {
+  char cFilename[32];
+  std::snprintf(cFilename, sizeof(cFilename), "toc-%d-%08x.bin", m_nPort, m_u32CRC);
+
+  return m_strCacheDirectory + "/" + cFilename;
+}
+
+bool CTOC::loadCache() {
+  if(m_strCacheDirectory == "" || !m_bHasCRC) {
+    return false;
+  }
+
+  int nFile = open(this->cachePath().c_str(), O_RDONLY);
+  if(nFile == -1) {
+    return false;
+  }
+
+  bool bLoaded = false;
+  struct stat stFile;
+
+  if(fstat(nFile, &stFile) == 0 && stFile.st_size >= (off_t)sizeof(struct TOCCacheHeader)) {
+    void *vMapped = mmap(NULL, stFile.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
+
+    if(vMapped != MAP_FAILED) {
+      const struct TOCCacheHeader *tchHeader = (const struct TOCCacheHeader*)vMapped;
+      const struct TOCCacheRecord *tcrRecords = (const struct TOCCacheRecord*)(tchHeader + 1);
+
+      if(tchHeader->u32Magic == TOC_CACHE_MAGIC &&
+	 tchHeader->u32Version == TOC_CACHE_VERSION &&
+	 tchHeader->u32Port == (uint32_t)m_nPort &&
+	 tchHeader->u32CRC == m_u32CRC &&
+	 tchHeader->u32Count == (uint32_t)m_nItemCount &&
+	 stFile.st_size == (off_t)(sizeof(struct TOCCacheHeader) + tchHeader->u32Count * sizeof(struct TOCCacheRecord))) {
+	for(uint32_t u32I = 0; u32I < tchHeader->u32Count; u32I++) {
+	  const char *cNames = tcrRecords[u32I].cNames;
+	  int nGroupLength = strnlen(cNames, TOC_CACHE_NAME_LENGTH);
+	  int nIdentifierLength = (nGroupLength < TOC_CACHE_NAME_LENGTH ? strnlen(&cNames[nGroupLength + 1], TOC_CACHE_NAME_LENGTH - nGroupLength - 1) : 0);
+
+	  this->addElement(tcrRecords[u32I].n32ID, tcrRecords[u32I].n32Type,
+			   std::string(cNames, nGroupLength),
+			   std::string(&cNames[nGroupLength + 1], nIdentifierLength));
+	}
+
+	bLoaded = true;
+      }
+
+      munmap(vMapped, stFile.st_size);
+    }
+  }
+
+  close(nFile);
+
+  if(bLoaded) {
+    CDiagnostics::instance()->post(SEVERITY_INFO, "Loaded " + std::to_string(m_nItemCount) + " TOC items for port " + std::to_string(m_nPort) + " from the cache", m_crRadio->diagnosticsSource());
+  }
+
+  return bLoaded;
+}
+
+bool CTOC::saveCache() {
+  if(m_strCacheDirectory == "" || !m_bHasCRC || (int)m_vecTOCElements.size() != m_nItemCount) {
+    return false;
+  }
+
+  struct TOCCacheHeader tchHeader;
+  tchHeader.u32Magic = TOC_CACHE_MAGIC;
+  tchHeader.u32Version = TOC_CACHE_VERSION;
+  tchHeader.u32Port = m_nPort;
+  tchHeader.u32CRC = m_u32CRC;
+  tchHeader.u32Count = m_vecTOCElements.size();
+
+  std::vector<struct TOCCacheRecord> vecRecords(m_vecTOCElements.size());
+
+  for(unsigned int unI = 0; unI < m_vecTOCElements.size(); unI++) {
+    struct TOCElement &teElement = m_vecTOCElements[unI];
+
+    if(teElement.strGroup.size() + teElement.strIdentifier.size() + 2 > TOC_CACHE_NAME_LENGTH) {
+      return false;
+    }
 
-  CCRTPPacket* crtpPacket = new CCRTPPacket(0x01, 0);
+    std::memset(&vecRecords[unI], 0, sizeof(struct TOCCacheRecord));
+    vecRecords[unI].n32ID = teElement.nID;
+    vecRecords[unI].n32Type = teElement.nType;
+    std::memcpy(vecRecords[unI].cNames, teElement.strGroup.c_str(), teElement.strGroup.size() + 1);
+    std::memcpy(&vecRecords[unI].cNames[teElement.strGroup.size() + 1], teElement.strIdentifier.c_str(), teElement.strIdentifier.size() + 1);
+  }
+
+  // Written aside and renamed, so that other processes never map a
+  // half-written file.
+  std::string strPath = this->cachePath();
+  std::string strTemporary = strPath + "." + std::to_string(getpid()) + ".tmp";
+
+  FILE *fFile = std::fopen(strTemporary.c_str(), "wb");
+  if(fFile == NULL) {
+    return false;
+  }
+
+  bool bWritten = (std::fwrite(&tchHeader, sizeof(tchHeader), 1, fFile) == 1);
+  if(!vecRecords.empty()) {
+    bWritten = (std::fwrite(&vecRecords[0], sizeof(struct TOCCacheRecord), vecRecords.size(), fFile) == vecRecords.size()) && bWritten;
+  }
+  bWritten = (std::fclose(fFile) == 0) && bWritten;
+
+  if(!bWritten) {
+    std::remove(strTemporary.c_str());
+    return false;
+  }
+
+  return std::rename(strTemporary.c_str(), strPath.c_str()) == 0;
+}
+
+CCRTPPacket* CTOC::metaDataRequest() {
+  CCRTPPacket* crtpPacket = new(m_crRadio->packetPool()) CCRTPPacket(0x01, 0);
   crtpPacket->setPort(m_nPort);
-  CCRTPPacket* crtpReceived = m_crRadio->sendAndReceive(crtpPacket);
 
-  if(crtpReceived->data()[1] == 0x01) {
-    m_nItemCount = crtpReceived->data()[2];
-    bReturnvalue = true;
+  return crtpPacket;
+}
+
+bool CTOC::processMetaData(CCRTPPacket* crtpReply) {
+  if(crtpReply->dataLength() > 2 && crtpReply->data()[1] == 0x01) {
+    m_nItemCount = crtpReply->data()[2];
+
+    // The item count is followed by the CRC of the whole TOC
+    m_bHasCRC = (crtpReply->dataLength() >= 7);
+    m_u32CRC = 0;
+
+    if(m_bHasCRC) {
+      memcpy(&m_u32CRC, &crtpReply->data()[3], 4);
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+bool CTOC::requestMetaData() {
+  CCRTPPacket* crtpReceived = this->exchangeRequest(this->metaDataRequest(), 1);
+
+  if(crtpReceived == NULL) {
+    return false;
   }
 
+  bool bReturnvalue = this->processMetaData(crtpReceived);
+
   delete crtpReceived;
   return bReturnvalue;
 }
@@ -75,18 +254,32 @@ bool CTOC::requestItem(int nID) {
   return this->requestItem(nID, false);
 }
 
-bool CTOC::requestItem(int nID, bool bInitial) {
-  bool bReturnvalue = false;
-
+CCRTPPacket* CTOC::itemRequest(int nID) {
   char cRequest[2];
   cRequest[0] = 0x0;
   cRequest[1] = nID;
 
-  CCRTPPacket* crtpPacket = new CCRTPPacket(cRequest,
-					    (bInitial ? 1 : 2),
-					    0);
+  CCRTPPacket* crtpPacket = new(m_crRadio->packetPool()) CCRTPPacket(cRequest, 2, 0);
   crtpPacket->setPort(m_nPort);
-  CCRTPPacket* crtpReceived = m_crRadio->sendAndReceive(crtpPacket);
+
+  return crtpPacket;
+}
+
+bool CTOC::requestItem(int nID, bool bInitial) {
+  bool bReturnvalue = false;
+
+  CCRTPPacket* crtpPacket = this->itemRequest(nID);
+  if(bInitial) {
+    // Without an ID, the copter answers with the first item
+    char cRequest = 0x0;
+    crtpPacket->setData(&cRequest, 1);
+  }
+
+  CCRTPPacket* crtpReceived = this->exchangeRequest(crtpPacket, 2);
+
+  if(crtpReceived == NULL) {
+    return false;
+  }
 
   bReturnvalue = this->processItem(crtpReceived);
 
@@ -95,11 +288,29 @@ bool CTOC::requestItem(int nID, bool bInitial) {
 }
 
 bool CTOC::requestItems() {
-  for(int nI = 0; nI < m_nItemCount; nI++) {
-    this->requestItem(nI);
+  if(m_rioThread && m_rioThread->running()) {
+    // The fetcher drives the transport itself, which belongs to the
+    // I/O thread now; request one item after the other through it.
+    if(this->loadCache()) {
+      return true;
+    }
+
+    bool bOK = true;
+    for(int nI = 0; nI < m_nItemCount; nI++) {
+      bOK = this->requestItem(nI) && bOK;
+    }
+
+    if(bOK) {
+      this->saveCache();
+    }
+
+    return bOK;
   }
 
-  return true;
+  CTOCFetcher tfFetcher(m_crRadio);
+  tfFetcher.addTOC(this, false);
+
+  return tfFetcher.run();
 }
 
 bool CTOC::processItem(CCRTPPacket* crtpItem) {
@@ -124,15 +335,7 @@ bool CTOC::processItem(CCRTPPacket* crtpItem) {
 	  strIdentifier += cData[nI];
 	}
 
-	struct TOCElement teNew;
-	teNew.strIdentifier = strIdentifier;
-	teNew.strGroup = strGroup;
-	teNew.nID = nID;
-	teNew.nType = nType;
-	teNew.bIsLogging = false;
-	teNew.dValue = 0;
-
-	m_lstTOCElements.push_back(teNew);
+	this->addElement(nID, nType, strGroup, strIdentifier);
 
 	// NOTE(winkler): For debug purposes only.
 	//std::cout << strGroup << "." << strIdentifier << std::endl;
@@ -145,17 +348,43 @@ bool CTOC::processItem(CCRTPPacket* crtpItem) {
   return false;
 }
 
+void CTOC::addElement(int nID, int nType, std::string strGroup, std::string strIdentifier) {
+  struct TOCElement teNew;
+  teNew.strIdentifier = strIdentifier;
+  teNew.strGroup = strGroup;
+  teNew.nID = nID;
+  teNew.nType = nType;
+  teNew.bIsLogging = false;
+  teNew.dValue = 0;
+
+  int nIndex = this->indexForID(nID);
+
+  if(nIndex == -1) {
+    nIndex = m_vecTOCElements.size();
+
+    m_vecTOCElements.push_back(teNew);
+    m_vecValues.push_back(0);
+    m_vecHistories.push_back(NULL);
+    m_mapIDIndex[nID] = nIndex;
+  } else {
+    // Downloaded again; the element keeps its index.
+    m_mapNameIndex.erase(m_vecTOCElements[nIndex].strGroup + "." + m_vecTOCElements[nIndex].strIdentifier);
+    m_vecTOCElements[nIndex] = teNew;
+    m_vecValues[nIndex] = 0;
+  }
+
+  m_mapNameIndex[strGroup + "." + strIdentifier] = nIndex;
+}
+
 struct TOCElement CTOC::elementForName(std::string strName, bool& bFound) {
-  for(std::list<struct TOCElement>::iterator itElement = m_lstTOCElements.begin();
-      itElement != m_lstTOCElements.end();
-      itElement++) {
-    struct TOCElement teCurrent = *itElement;
+  std::unordered_map<std::string, int>::iterator itIndex = m_mapNameIndex.find(strName);
 
-    std::string strTempFullname = teCurrent.strGroup + "." + teCurrent.strIdentifier;
-    if(strName == strTempFullname) {
-      bFound = true;
-      return teCurrent;
-    }
+  if(itIndex != m_mapNameIndex.end()) {
+    struct TOCElement teCurrent = m_vecTOCElements[(*itIndex).second];
+    teCurrent.dValue = m_vecValues[(*itIndex).second];
+
+    bFound = true;
+    return teCurrent;
   }
 
   bFound = false;
@@ -165,15 +394,14 @@ struct TOCElement CTOC::elementForName(std::string strName, bool& bFound) {
 }
 
 struct TOCElement CTOC::elementForID(int nID, bool& bFound) {
-  for(std::list<struct TOCElement>::iterator itElement = m_lstTOCElements.begin();
-      itElement != m_lstTOCElements.end();
-      itElement++) {
-    struct TOCElement teCurrent = *itElement;
+  int nIndex = this->indexForID(nID);
 
-    if(nID == teCurrent.nID) {
-      bFound = true;
-      return teCurrent;
-    }
+  if(nIndex != -1) {
+    struct TOCElement teCurrent = m_vecTOCElements[nIndex];
+    teCurrent.dValue = m_vecValues[nIndex];
+
+    bFound = true;
+    return teCurrent;
   }
 
   bFound = false;
@@ -182,30 +410,82 @@ struct TOCElement CTOC::elementForID(int nID, bool& bFound) {
   return teEmpty;
 }
 
-int CTOC::idForName(std::string strName) {
-  bool bFound;
+int CTOC::indexForID(int nID) {
+  std::unordered_map<int, int>::iterator itIndex = m_mapIDIndex.find(nID);
 
-  struct TOCElement teResult = this->elementForName(strName, bFound);
+  if(itIndex != m_mapIDIndex.end()) {
+    return (*itIndex).second;
+  }
 
-  if(bFound) {
-    return teResult.nID;
+  return -1;
+}
+
+struct TOCHandle CTOC::handleForName(std::string strName) {
+  struct TOCHandle thHandle;
+  thHandle.nIndex = -1;
+  thHandle.nType = 0;
+
+  std::unordered_map<std::string, int>::iterator itIndex = m_mapNameIndex.find(strName);
+
+  if(itIndex != m_mapNameIndex.end()) {
+    thHandle.nIndex = (*itIndex).second;
+    thHandle.nType = m_vecTOCElements[thHandle.nIndex].nType;
+  }
+
+  return thHandle;
+}
+
+int CTOC::idForName(std::string strName) {
+  struct TOCHandle thHandle = this->handleForName(strName);
+
+  if(thHandle.nIndex != -1) {
+    return m_vecTOCElements[thHandle.nIndex].nID;
   }
 
   return -1;
 }
 
 int CTOC::typeForName(std::string strName) {
-  bool bFound;
+  struct TOCHandle thHandle = this->handleForName(strName);
 
-  struct TOCElement teResult = this->elementForName(strName, bFound);
-
-  if(bFound) {
-    return teResult.nType;
+  if(thHandle.nIndex != -1) {
+    return thHandle.nType;
   }
 
   return -1;
 }
 
+CCRTPPacket* CTOC::appendVariableRequest(struct LoggingBlock lbBlock, struct TOCElement teElement) {
+  char cPayload[4] = {0x01, lbBlock.nID, teElement.nType, teElement.nID};
+  CCRTPPacket* crtpLogVariable = new(m_crRadio->packetPool()) CCRTPPacket(cPayload, 4, 1);
+  crtpLogVariable->setPort(m_nPort);
+  crtpLogVariable->setChannel(1);
+
+  return crtpLogVariable;
+}
+
+bool CTOC::processAppendVariable(CCRTPPacket* crtpReply, struct LoggingBlock lbBlock, struct TOCElement teElement) {
+  char* cData = crtpReply->data();
+
+  if(crtpReply->dataLength() > 3 &&
+     cData[1] == 0x01 &&
+     cData[2] == lbBlock.nID &&
+     cData[3] == 0x00) {
+    this->addElementToBlock(lbBlock.nID, teElement.nID);
+
+    return true;
+  }
+
+  std::string strMessage = "Adding variable `" + teElement.strGroup + "." + teElement.strIdentifier + "' to logging block failed";
+  if(crtpReply->dataLength() > 3) {
+    strMessage += " with error " + std::to_string((int)cData[3]);
+  }
+
+  CDiagnostics::instance()->post(SEVERITY_WARNING, strMessage, m_crRadio->diagnosticsSource());
+
+  return false;
+}
+
 bool CTOC::startLogging(std::string strName, std::string strBlockName) {
   bool bFound;
   struct LoggingBlock lbCurrent = this->loggingBlockForName(strBlockName, bFound);
@@ -213,31 +493,16 @@ bool CTOC::startLogging(std::string strName, std::string strBlockName) {
   if(bFound) {
     struct TOCElement teCurrent = this->elementForName(strName, bFound);
     if(bFound) {
-      char cPayload[5] = {0x01, lbCurrent.nID, teCurrent.nType, teCurrent.nID};
-      CCRTPPacket* crtpLogVariable = new CCRTPPacket(cPayload, 4, 1);
-      crtpLogVariable->setPort(m_nPort);
-      crtpLogVariable->setChannel(1);
-      CCRTPPacket* crtpReceived = m_crRadio->sendAndReceive(crtpLogVariable, true);
-
-      char* cData = crtpReceived->data();
-      bool bCreateOK = false;
-      if(cData[1] == 0x01 &&
-	 cData[2] == lbCurrent.nID &&
-	 cData[3] == 0x00) {
-	bCreateOK = true;
-      } else {
-	std::cout << cData[3] << std::endl;
-      }
+      CCRTPPacket* crtpReceived = this->exchangeRequest(this->appendVariableRequest(lbCurrent, teCurrent), 2);
 
-      if(crtpReceived) {
-	delete crtpReceived;
+      if(crtpReceived == NULL) {
+	return false;
       }
 
-      if(bCreateOK) {
-	this->addElementToBlock(lbCurrent.nID, teCurrent.nID);
+      bool bAppendOK = this->processAppendVariable(crtpReceived, lbCurrent, teCurrent);
 
-	return true;
-      }
+      delete crtpReceived;
+      return bAppendOK;
     }
   }
 
@@ -251,8 +516,34 @@ bool CTOC::addElementToBlock(int nBlockID, int nElementID) {
     struct LoggingBlock lbCurrent = *itBlock;
 
     if(lbCurrent.nID == nBlockID) {
+      int nIndex = this->indexForID(nElementID);
+
+      if(nIndex == -1) {
+	return false;
+      }
+
       (*itBlock).lstElementIDs.push_back(nElementID);
 
+      // Compile the variable into the block's decode plan: its
+      // values follow right behind the ones of the variables added
+      // before.
+      if(m_mapDecodePlans.find(nBlockID) == m_mapDecodePlans.end()) {
+	struct DecodePlan dpNew;
+	dpNew.nLength = 0;
+	dpNew.mcDecoded = lbCurrent.mcDecoded;
+	m_mapDecodePlans[nBlockID] = dpNew;
+      }
+
+      struct DecodePlan &dpPlan = m_mapDecodePlans[nBlockID];
+      struct DecodeStep dsStep;
+      dsStep.nOffset = dpPlan.nLength;
+      dsStep.nType = m_vecTOCElements[nIndex].nType;
+      dsStep.nLength = this->typeLength(dsStep.nType);
+      dsStep.nIndex = nIndex;
+
+      dpPlan.vecSteps.push_back(dsStep);
+      dpPlan.nLength += dsStep.nLength;
+
       return true;
     }
   }
@@ -269,17 +560,58 @@ bool CTOC::isLogging(std::string strName) {
 }
 
 double CTOC::doubleValue(std::string strName) {
-  bool bFound;
-
-  struct TOCElement teResult = this->elementForName(strName, bFound);
+  return this->doubleValue(this->handleForName(strName));
+}
 
-  if(bFound) {
-    return teResult.dValue;
+double CTOC::doubleValue(const struct TOCHandle &thHandle) {
+  if(thHandle.nIndex >= 0 && thHandle.nIndex < (int)m_vecValues.size()) {
+    return m_vecValues[thHandle.nIndex];
   }
 
   return 0;
 }
 
+bool CTOC::enableHistory(std::string strName, unsigned int unCapacity) {
+  struct TOCHandle thHandle = this->handleForName(strName);
+
+  if(thHandle.nIndex != -1) {
+    delete m_vecHistories[thHandle.nIndex];
+    m_vecHistories[thHandle.nIndex] = new CTimeSeries(unCapacity);
+
+    return true;
+  }
+
+  return false;
+}
+
+void CTOC::disableHistory(std::string strName) {
+  struct TOCHandle thHandle = this->handleForName(strName);
+
+  if(thHandle.nIndex != -1) {
+    delete m_vecHistories[thHandle.nIndex];
+    m_vecHistories[thHandle.nIndex] = NULL;
+  }
+}
+
+CTimeSeries* CTOC::history(const struct TOCHandle &thHandle) {
+  if(thHandle.nIndex >= 0 && thHandle.nIndex < (int)m_vecHistories.size()) {
+    return m_vecHistories[thHandle.nIndex];
+  }
+
+  return NULL;
+}
+
+CTimeSeries* CTOC::history(std::string strName) {
+  return this->history(this->handleForName(strName));
+}
+
+double CTOC::currentTime() {
+  struct timespec tsTime;
+  clock_gettime(CLOCK_MONOTONIC, &tsTime);
+
+  return tsTime.tv_sec + double(tsTime.tv_nsec) / 1000000000.0;
+}
+
 struct LoggingBlock CTOC::loggingBlockForName(std::string strName, bool& bFound) {
   for(std::list<struct LoggingBlock>::iterator itBlock = m_lstLoggingBlocks.begin();
       itBlock != m_lstLoggingBlocks.end();
@@ -294,6 +626,7 @@ struct LoggingBlock CTOC::loggingBlockForName(std::string strName, bool& bFound)
 
   bFound = false;
   struct LoggingBlock lbEmpty;
+  lbEmpty.mcDecoded = NULL;
 
   return lbEmpty;
 }
@@ -312,60 +645,88 @@ struct LoggingBlock CTOC::loggingBlockForID(int nID, bool& bFound) {
 
   bFound = false;
   struct LoggingBlock lbEmpty;
+  lbEmpty.mcDecoded = NULL;
 
   return lbEmpty;
 }
 
-bool CTOC::registerLoggingBlock(std::string strName, double dFrequency) {
+int CTOC::freeLoggingBlockID() {
   int nID = 0;
   bool bFound;
 
-  if(dFrequency > 0) { // Only do it if a valid frequency > 0 is given
-    this->loggingBlockForName(strName, bFound);
+  do {
+    this->loggingBlockForID(nID, bFound);
+
     if(bFound) {
-      this->unregisterLoggingBlock(strName);
+      nID++;
     }
+  } while(bFound);
 
-    do {
-      this->loggingBlockForID(nID, bFound);
+  return nID;
+}
 
-      if(bFound) {
-	nID++;
-      }
-    } while(bFound);
+CCRTPPacket* CTOC::createBlockRequest(int nID, double dFrequency) {
+  double d10thOfMS = (1 / dFrequency) * 1000 * 10;
+  char cPayload[3] = {0x00, nID, d10thOfMS};
 
-    this->unregisterLoggingBlockID(nID);
+  CCRTPPacket* crtpRegisterBlock = new(m_crRadio->packetPool()) CCRTPPacket(cPayload, 3, 1);
+  crtpRegisterBlock->setPort(m_nPort);
+  crtpRegisterBlock->setChannel(1);
 
-    double d10thOfMS = (1 / dFrequency) * 1000 * 10;
-    char cPayload[4] = {0x00, nID, d10thOfMS};
+  return crtpRegisterBlock;
+}
 
-    CCRTPPacket* crtpRegisterBlock = new CCRTPPacket(cPayload, 3, 1);
-    crtpRegisterBlock->setPort(m_nPort);
-    crtpRegisterBlock->setChannel(1);
+bool CTOC::processCreateBlock(CCRTPPacket* crtpReply, std::string strName, int nID, double dFrequency) {
+  char* cData = crtpReply->data();
 
-    CCRTPPacket* crtpReceived = m_crRadio->sendAndReceive(crtpRegisterBlock, true);
+  if(crtpReply->dataLength() > 3 &&
+     cData[1] == 0x00 &&
+     cData[2] == nID &&
+     cData[3] == 0x00) {
+    CDiagnostics::instance()->post(SEVERITY_INFO, "Registered logging block `" + strName + "'", m_crRadio->diagnosticsSource());
 
-    char* cData = crtpReceived->data();
-    bool bCreateOK = false;
-    if(cData[1] == 0x00 &&
-       cData[2] == nID &&
-       cData[3] == 0x00) {
-      bCreateOK = true;
-      std::cout << "Registered logging block `" << strName << "'" << std::endl;
-    }
+    struct LoggingBlock lbNew;
+    lbNew.strName = strName;
+    lbNew.nID = nID;
+    lbNew.dFrequency = dFrequency;
+    lbNew.mcDecoded = CMetrics::instance()->counter("cflie_log_packets_decoded_total", "Logging frames decoded, per logging block", m_crRadio->metricLabels("block=\"" + strName + "\""));
 
-    if(crtpReceived) {
-      delete crtpReceived;
+    m_lstLoggingBlocks.push_back(lbNew);
+
+    // Variables added later extend the block's decode plan.
+    struct DecodePlan dpNew;
+    dpNew.nLength = 0;
+    dpNew.mcDecoded = lbNew.mcDecoded;
+    m_mapDecodePlans[nID] = dpNew;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool CTOC::registerLoggingBlock(std::string strName, double dFrequency) {
+  bool bFound;
+
+  if(dFrequency > 0) { // Only do it if a valid frequency > 0 is given
+    this->loggingBlockForName(strName, bFound);
+    if(bFound) {
+      this->unregisterLoggingBlock(strName);
     }
 
-    if(bCreateOK) {
-      struct LoggingBlock lbNew;
-      lbNew.strName = strName;
-      lbNew.nID = nID;
-      lbNew.dFrequency = dFrequency;
+    int nID = this->freeLoggingBlockID();
+    this->unregisterLoggingBlockID(nID);
 
-      m_lstLoggingBlocks.push_back(lbNew);
+    CCRTPPacket* crtpReceived = this->exchangeRequest(this->createBlockRequest(nID, dFrequency), 2);
 
+    if(crtpReceived == NULL) {
+      return false;
+    }
+
+    bool bCreateOK = this->processCreateBlock(crtpReceived, strName, nID, dFrequency);
+    delete crtpReceived;
+
+    if(bCreateOK) {
       return this->enableLogging(strName);
     }
   }
@@ -373,22 +734,28 @@ bool CTOC::registerLoggingBlock(std::string strName, double dFrequency) {
   return false;
 }
 
+CCRTPPacket* CTOC::startBlockRequest(struct LoggingBlock lbBlock) {
+  double d10thOfMS = (1 / lbBlock.dFrequency) * 1000 * 10;
+  char cPayload[3] = {0x03, lbBlock.nID, d10thOfMS};
+
+  CCRTPPacket* crtpEnable = new(m_crRadio->packetPool()) CCRTPPacket(cPayload, 3, 1);
+  crtpEnable->setPort(m_nPort);
+  crtpEnable->setChannel(1);
+
+  return crtpEnable;
+}
+
 bool CTOC::enableLogging(std::string strBlockName) {
   bool bFound;
 
   struct LoggingBlock lbCurrent = this->loggingBlockForName(strBlockName, bFound);
   if(bFound) {
-    double d10thOfMS = (1 / lbCurrent.dFrequency) * 1000 * 10;
-    char cPayload[3] = {0x03, lbCurrent.nID, d10thOfMS};
-
-    CCRTPPacket* crtpEnable = new CCRTPPacket(cPayload, 3, 1);
-    crtpEnable->setPort(m_nPort);
-    crtpEnable->setChannel(1);
-
-    CCRTPPacket* crtpReceived = m_crRadio->sendAndReceive(crtpEnable);
-    delete crtpReceived;
+    CCRTPPacket* crtpReceived = this->exchangeRequest(this->startBlockRequest(lbCurrent), 2);
 
-    return true;
+    if(crtpReceived) {
+      delete crtpReceived;
+      return true;
+    }
   }
 
   return false;
@@ -405,173 +772,174 @@ bool CTOC::unregisterLoggingBlock(std::string strName) {
   return false;
 }
 
-bool CTOC::unregisterLoggingBlockID(int nID) {
+CCRTPPacket* CTOC::deleteBlockRequest(int nID) {
   char cPayload[2] = {0x02, nID};
 
-  CCRTPPacket* crtpUnregisterBlock = new CCRTPPacket(cPayload, 2, 1);
+  CCRTPPacket* crtpUnregisterBlock = new(m_crRadio->packetPool()) CCRTPPacket(cPayload, 2, 1);
   crtpUnregisterBlock->setPort(m_nPort);
   crtpUnregisterBlock->setChannel(1);
 
-  CCRTPPacket* crtpReceived = m_crRadio->sendAndReceive(crtpUnregisterBlock, true);
+  return crtpUnregisterBlock;
+}
+
+bool CTOC::unregisterLoggingBlockID(int nID) {
+  CCRTPPacket* crtpReceived = this->exchangeRequest(this->deleteBlockRequest(nID), 2);
 
   if(crtpReceived) {
     delete crtpReceived;
+
+    for(std::list<struct LoggingBlock>::iterator itBlock = m_lstLoggingBlocks.begin();
+	itBlock != m_lstLoggingBlocks.end();
+	itBlock++) {
+      if((*itBlock).nID == nID) {
+	m_lstLoggingBlocks.erase(itBlock);
+	break;
+      }
+    }
+
+    m_mapDecodePlans.erase(nID);
+
     return true;
   }
 
   return false;
 }
 
-void CTOC::processPackets(std::list<CCRTPPacket*> lstPackets) {
-  if(lstPackets.size() > 0) {
-    for(std::list<CCRTPPacket*>::iterator itPacket = lstPackets.begin();
-	itPacket != lstPackets.end();
-	itPacket++) {
-      CCRTPPacket* crtpPacket = *itPacket;
-
-      char* cData = crtpPacket->data();
-      float fValue;
-      memcpy(&fValue, &cData[5], 4);
-
-      char* cLogdata = &cData[5];
-      int nOffset = 0;
-      int nIndex = 0;
-      int nAvailableLogBytes = crtpPacket->dataLength() - 5;
-
-      int nBlockID = cData[1];
-      bool bFound;
-      struct LoggingBlock lbCurrent = this->loggingBlockForID(nBlockID, bFound);
-
-      if(bFound) {
-	while(nIndex < lbCurrent.lstElementIDs.size()) {
-	  int nElementID = this->elementIDinBlock(nBlockID, nIndex);
-	  bool bFound;
-	  struct TOCElement teCurrent = this->elementForID(nElementID, bFound);
-
-	  if(bFound) {
-	    int nByteLength = 0;
-
-	    // NOTE(winkler): We just copy over the incoming bytes in
-	    // their according data structures and afterwards assign
-	    // the value to fValue. This way, we let the compiler to
-	    // the magic of conversion.
-	    float fValue = 0;
-
-	    switch(teCurrent.nType) {
-	    case 1: { // UINT8
-	      nByteLength = 1;
-	      uint8_t uint8Value;
-	      memcpy(&uint8Value, &cLogdata[nOffset], nByteLength);
-	      fValue = uint8Value;
-	    } break;
-
-	    case 2: { // UINT16
-	      nByteLength = 2;
-	      uint16_t uint16Value;
-	      memcpy(&uint16Value, &cLogdata[nOffset], nByteLength);
-	      fValue = uint16Value;
-	    } break;
-
-	    case 3: { // UINT32
-	      nByteLength = 4;
-	      uint32_t uint32Value;
-	      memcpy(&uint32Value, &cLogdata[nOffset], nByteLength);
-	      fValue = uint32Value;
-	    } break;
-
-	    case 4: { // INT8
-	      nByteLength = 1;
-	      int8_t int8Value;
-	      memcpy(&int8Value, &cLogdata[nOffset], nByteLength);
-	      fValue = int8Value;
-	    } break;
-
-	    case 5: { // INT16
-	      nByteLength = 2;
-	      int16_t int16Value;
-	      memcpy(&int16Value, &cLogdata[nOffset], nByteLength);
-	      fValue = int16Value;
-	    } break;
-
-	    case 6: { // INT32
-	      nByteLength = 4;
-	      int32_t int32Value;
-	      memcpy(&int32Value, &cLogdata[nOffset], nByteLength);
-	      fValue = int32Value;
-	    } break;
-
-	    case 7: { // FLOAT
-	      nByteLength = 4;
-	      memcpy(&fValue, &cLogdata[nOffset], nByteLength);
-	    } break;
-
-	    case 8: { // FP16
-	      // NOTE(winkler): This is untested code (as no FP16
-	      // variable gets advertised yet). This has to be tested
-	      // and is to be used carefully. I will do that as soon
-	      // as I find time for it.
-	      nByteLength = 2;
-	      char cBuffer1[nByteLength];
-	      char cBuffer2[4];
-	      memcpy(cBuffer1, &cLogdata[nOffset], nByteLength);
-	      cBuffer2[0] = cBuffer1[0] & 0b10000000; // Get the sign bit
-	      cBuffer2[1] = 0;
-	      cBuffer2[2] = cBuffer1[0] & 0b01111111; // Get the magnitude
-	      cBuffer2[3] = cBuffer1[1];
-	      memcpy(&fValue, cBuffer2, 4); // Put it into the float variable
-	    } break;
-
-	    default: { // Unknown. This hopefully never happens.
-	    } break;
-	    }
-
-	    this->setFloatValueForElementID(nElementID, fValue);
-	    nOffset += nByteLength;
-	    nIndex++;
-	  } else {
-	    std::cerr << "Didn't find element ID " << nElementID
-		 << " in block ID " << nBlockID
-		 << " while parsing incoming logging data." << std::endl;
-	    std::cerr << "This REALLY shouldn't be happening!" << std::endl;
-	    std::exit(-1);
-	  }
-	}
+void CTOC::consumeFrame(const CCRTPView &cvFrame) {
+  this->processPacket(cvFrame);
+}
+
+void CTOC::processPacket(const CCRTPView &cvPacket) {
+  // Header byte, block ID and three bytes of timestamp
+  if(cvPacket.dataLength() < 5) {
+    return;
+  }
+
+  const char* cData = cvPacket.data();
+  std::unordered_map<int, struct DecodePlan>::iterator itPlan = m_mapDecodePlans.find(cData[1]);
+
+  if(itPlan != m_mapDecodePlans.end()) {
+    struct DecodePlan &dpPlan = (*itPlan).second;
+    const char* cLogdata = &cData[5];
+    int nAvailableLogBytes = cvPacket.dataLength() - 5;
+    // Frames drained from the logging ring carry their receive
+    // time; others are decoded as they arrive, so the time is only
+    // taken once a variable of the frame keeps a history.
+    double dReceived = cvPacket.receiveTime();
+
+    dpPlan.mcDecoded->increment();
+
+    for(std::vector<struct DecodeStep>::iterator itStep = dpPlan.vecSteps.begin();
+	itStep != dpPlan.vecSteps.end();
+	itStep++) {
+      if((*itStep).nOffset + (*itStep).nLength > nAvailableLogBytes) {
+	// Truncated frame; the remaining variables keep their values.
+	break;
       }
 
-      delete crtpPacket;
+      // We store floats as doubles
+      double dValue = this->decodeValue(&cLogdata[(*itStep).nOffset], (*itStep).nType);
+      m_vecValues[(*itStep).nIndex] = dValue;
+
+      CTimeSeries* tsHistory = m_vecHistories[(*itStep).nIndex];
+      if(tsHistory) {
+	if(dReceived <= 0) {
+	  dReceived = this->currentTime();
+	}
+
+	tsHistory->append(dReceived, dValue);
+      }
     }
   }
 }
 
-int CTOC::elementIDinBlock(int nBlockID, int nElementIndex) {
-  bool bFound;
+int CTOC::typeLength(int nType) {
+  switch(nType) {
+  case 1: // UINT8
+  case 4: // INT8
+    return 1;
 
-  struct LoggingBlock lbCurrent = this->loggingBlockForID(nBlockID, bFound);
-  if(bFound) {
-    if(nElementIndex < lbCurrent.lstElementIDs.size()) {
-      std::list<int>::iterator itID = lbCurrent.lstElementIDs.begin();
-      advance(itID, nElementIndex);
-      return *itID;
-    }
-  }
+  case 2: // UINT16
+  case 5: // INT16
+  case 8: // FP16
+    return 2;
 
-  return -1;
-}
+  case 3: // UINT32
+  case 6: // INT32
+  case 7: // FLOAT
+    return 4;
 
-bool CTOC::setFloatValueForElementID(int nElementID, float fValue) {
-  int nIndex = 0;
-  for(std::list<struct TOCElement>::iterator itElement = m_lstTOCElements.begin();
-      itElement != m_lstTOCElements.end();
-      itElement++, nIndex++) {
-    struct TOCElement teCurrent = *itElement;
+  default: // Unknown. This hopefully never happens.
+    return 0;
+  }
+}
 
-    if(teCurrent.nID == nElementID) {
-      teCurrent.dValue = fValue; // We store floats as doubles
-      (*itElement) = teCurrent;
-      // std::cout << fValue << std::endl;
-      return true;
-    }
+float CTOC::decodeValue(const char* cLogdata, int nType) {
+  // NOTE(winkler): We just copy over the incoming bytes in their
+  // according data structures and afterwards assign the value to
+  // fValue. This way, we let the compiler to the magic of
+  // conversion.
+  float fValue = 0;
+
+  switch(nType) {
+  case 1: { // UINT8
+    uint8_t uint8Value;
+    memcpy(&uint8Value, cLogdata, sizeof(uint8Value));
+    fValue = uint8Value;
+  } break;
+
+  case 2: { // UINT16
+    uint16_t uint16Value;
+    memcpy(&uint16Value, cLogdata, sizeof(uint16Value));
+    fValue = uint16Value;
+  } break;
+
+  case 3: { // UINT32
+    uint32_t uint32Value;
+    memcpy(&uint32Value, cLogdata, sizeof(uint32Value));
+    fValue = uint32Value;
+  } break;
+
+  case 4: { // INT8
+    int8_t int8Value;
+    memcpy(&int8Value, cLogdata, sizeof(int8Value));
+    fValue = int8Value;
+  } break;
+
+  case 5: { // INT16
+    int16_t int16Value;
+    memcpy(&int16Value, cLogdata, sizeof(int16Value));
+    fValue = int16Value;
+  } break;
+
+  case 6: { // INT32
+    int32_t int32Value;
+    memcpy(&int32Value, cLogdata, sizeof(int32Value));
+    fValue = int32Value;
+  } break;
+
+  case 7: { // FLOAT
+    memcpy(&fValue, cLogdata, sizeof(fValue));
+  } break;
+
+  case 8: { // FP16
+    // NOTE(winkler): This is untested code (as no FP16
+    // variable gets advertised yet). This has to be tested
+    // and is to be used carefully. I will do that as soon
+    // as I find time for it.
+    char cBuffer1[2];
+    char cBuffer2[4];
+    memcpy(cBuffer1, cLogdata, 2);
+    cBuffer2[0] = cBuffer1[0] & 0b10000000; // Get the sign bit
+    cBuffer2[1] = 0;
+    cBuffer2[2] = cBuffer1[0] & 0b01111111; // Get the magnitude
+    cBuffer2[3] = cBuffer1[1];
+    memcpy(&fValue, cBuffer2, 4); // Put it into the float variable
+  } break;
+
+  default: { // Unknown. This hopefully never happens.
+  } break;
   }
 
-  return false;
+  return fValue;
 }
@@ -0,0 +1,251 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+
+#include <cflie/CTOCFetcher.h>
+#include <cflie/CTOC.h>
+
+
+CTOCFetcher::CTOCFetcher(CTransport *crRadio, int nWindow) {
+  m_crRadio = crRadio;
+  m_nWindow = (nWindow > 0 ? nWindow : 1);
+  m_nNextTOC = 0;
+}
+
+void CTOCFetcher::addTOC(CTOC *tocTOC, bool bMetaData) {
+  struct TOCFetch tfFetch;
+  tfFetch.tocTOC = tocTOC;
+  tfFetch.bMetaData = bMetaData;
+  tfFetch.nNextID = 0;
+  tfFetch.nMetaDataAttempts = 0;
+  tfFetch.nInFlight = 0;
+  tfFetch.bDone = false;
+  tfFetch.bFailed = false;
+
+  if(!bMetaData) {
+    if(tocTOC->loadCache()) {
+      tfFetch.bDone = true;
+    } else {
+      tfFetch.vecAttempts.assign(tocTOC->itemCount(), 0);
+    }
+  }
+
+  m_vecFetches.push_back(tfFetch);
+}
+
+bool CTOCFetcher::submitNext(int nTOC) {
+  struct TOCFetch &tfFetch = m_vecFetches[nTOC];
+
+  if(tfFetch.bDone || tfFetch.bFailed) {
+    return false;
+  }
+
+  CCRTPPacket *crtpRequest = NULL;
+  int nID = -1;
+  int nMatchLength = 2;
+
+  if(tfFetch.bMetaData) {
+    if(tfFetch.nInFlight > 0) {
+      // Items can only be requested once the count is known.
+      return false;
+    }
+
+    crtpRequest = tfFetch.tocTOC->metaDataRequest();
+    nMatchLength = 1;
+    tfFetch.nMetaDataAttempts++;
+  } else if(!tfFetch.lstRetries.empty()) {
+    nID = tfFetch.lstRetries.front();
+    tfFetch.lstRetries.pop_front();
+  } else if(tfFetch.nNextID < (int)tfFetch.vecAttempts.size()) {
+    nID = tfFetch.nNextID++;
+  } else {
+    return false;
+  }
+
+  if(nID != -1) {
+    crtpRequest = tfFetch.tocTOC->itemRequest(nID);
+    tfFetch.vecAttempts[nID]++;
+  }
+
+  std::chrono::steady_clock::time_point tpDeadline = std::chrono::steady_clock::time_point::max();
+  if(m_crRadio->requestTimeout() > 0) {
+    tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_crRadio->requestTimeout());
+  }
+
+  // The copter sends back one queued reply per exchange, so a full
+  // window takes that many exchanges to come back; only resend
+  // requests that took longer.
+  struct FetchRequest frRequest;
+  frRequest.nTOC = nTOC;
+  frRequest.nID = nID;
+  frRequest.rfReply = m_crRadio->request(crtpRequest, tpDeadline, nMatchLength, m_nWindow + 2);
+  delete crtpRequest;
+
+  tfFetch.nInFlight++;
+  m_lstInFlight.push_back(std::move(frRequest));
+
+  return true;
+}
+
+void CTOCFetcher::handleReply(struct FetchRequest &frRequest, enum RequestState enumState) {
+  struct TOCFetch &tfFetch = m_vecFetches[frRequest.nTOC];
+  tfFetch.nInFlight--;
+
+  if(tfFetch.bFailed) {
+    return;
+  }
+
+  bool bOK = false;
+
+  if(enumState == REQUEST_ANSWERED) {
+    CCRTPPacket *crtpReply = frRequest.rfReply.reply();
+
+    if(frRequest.nID == -1) {
+      bOK = tfFetch.tocTOC->processMetaData(crtpReply);
+    } else {
+      bOK = tfFetch.tocTOC->processItem(crtpReply);
+    }
+
+    delete crtpReply;
+  }
+
+  if(!bOK) {
+    this->retry(frRequest.nTOC, frRequest.nID);
+  } else if(frRequest.nID == -1) {
+    tfFetch.bMetaData = false;
+
+    // With the CRC known, a cached copy may spare the download.
+    if(tfFetch.tocTOC->loadCache()) {
+      tfFetch.bDone = true;
+    } else {
+      tfFetch.vecAttempts.assign(tfFetch.tocTOC->itemCount(), 0);
+    }
+  }
+}
+
+void CTOCFetcher::retry(int nTOC, int nID) {
+  struct TOCFetch &tfFetch = m_vecFetches[nTOC];
+
+  int nAttempts = (nID == -1 ? tfFetch.nMetaDataAttempts : tfFetch.vecAttempts[nID]);
+
+  if(nAttempts >= TOC_FETCH_ATTEMPTS) {
+    tfFetch.bFailed = true;
+  } else if(nID != -1) {
+    tfFetch.lstRetries.push_back(nID);
+  }
+}
+
+void CTOCFetcher::checkDone(int nTOC) {
+  struct TOCFetch &tfFetch = m_vecFetches[nTOC];
+
+  if(!tfFetch.bDone && !tfFetch.bFailed && !tfFetch.bMetaData &&
+     tfFetch.nInFlight == 0 && tfFetch.lstRetries.empty() &&
+     tfFetch.nNextID >= (int)tfFetch.vecAttempts.size()) {
+    tfFetch.bDone = true;
+
+    // Only complete TOCs end up in the cache.
+    tfFetch.tocTOC->saveCache();
+  }
+}
+
+bool CTOCFetcher::step() {
+  if(this->finished()) {
+    return false;
+  }
+
+  int nTOCs = m_vecFetches.size();
+  bool bSubmitted = false;
+
+  // Fill the window, taking turns between the TOCs.
+  int nIdle = 0;
+  while((int)m_lstInFlight.size() < m_nWindow && nIdle < nTOCs) {
+    int nTOC = m_nNextTOC;
+    m_nNextTOC = (m_nNextTOC + 1) % nTOCs;
+
+    if(this->submitNext(nTOC)) {
+      bSubmitted = true;
+      nIdle = 0;
+    } else {
+      nIdle++;
+    }
+  }
+
+  // Every submission is an exchange of its own; only pump if there
+  // was none.
+  if(!bSubmitted && !m_lstInFlight.empty()) {
+    m_crRadio->pumpRequests();
+  }
+
+  for(std::list<struct FetchRequest>::iterator itRequest = m_lstInFlight.begin();
+      itRequest != m_lstInFlight.end();) {
+    enum RequestState enumState = (*itRequest).rfReply.poll();
+
+    if(enumState == REQUEST_PENDING) {
+      itRequest++;
+    } else {
+      this->handleReply(*itRequest, enumState);
+      itRequest = m_lstInFlight.erase(itRequest);
+    }
+  }
+
+  for(int nTOC = 0; nTOC < nTOCs; nTOC++) {
+    this->checkDone(nTOC);
+  }
+
+  return !this->finished();
+}
+
+bool CTOCFetcher::run() {
+  while(this->step()) {
+  }
+
+  return this->succeeded();
+}
+
+bool CTOCFetcher::finished() {
+  for(std::vector<struct TOCFetch>::iterator itFetch = m_vecFetches.begin();
+      itFetch != m_vecFetches.end(); itFetch++) {
+    if(!(*itFetch).bDone && !(*itFetch).bFailed) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool CTOCFetcher::succeeded() {
+  for(std::vector<struct TOCFetch>::iterator itFetch = m_vecFetches.begin();
+      itFetch != m_vecFetches.end(); itFetch++) {
+    if(!(*itFetch).bDone) {
+      return false;
+    }
+  }
+
+  return true;
+}
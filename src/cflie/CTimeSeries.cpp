@@ -0,0 +1,122 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CTimeSeries.h>
+
+
+CTimeSeries::CTimeSeries(unsigned int unCapacity) {
+  m_unCapacity = std::max(unCapacity, 1u);
+  m_vecTimes.resize(m_unCapacity);
+  m_vecValues.resize(m_unCapacity);
+
+  m_ulAppended = 0;
+}
+
+void CTimeSeries::append(double dTime, double dValue) {
+  unsigned int unPosition = m_ulAppended % m_unCapacity;
+
+  m_vecTimes[unPosition] = dTime;
+  m_vecValues[unPosition] = dValue;
+  m_ulAppended++;
+}
+
+void CTimeSeries::clear() {
+  m_ulAppended = 0;
+}
+
+unsigned int CTimeSeries::size() {
+  return (m_ulAppended < m_unCapacity ? m_ulAppended : m_unCapacity);
+}
+
+unsigned int CTimeSeries::capacity() {
+  return m_unCapacity;
+}
+
+unsigned long CTimeSeries::samplesAppended() {
+  return m_ulAppended;
+}
+
+unsigned int CTimeSeries::position(unsigned int unAge) {
+  return (m_ulAppended - this->size() + unAge) % m_unCapacity;
+}
+
+void CTimeSeries::copyOut(unsigned int unFirst, unsigned int unCount, std::vector<double> &vecTimes, std::vector<double> &vecValues) {
+  vecTimes.resize(unCount);
+  vecValues.resize(unCount);
+
+  for(unsigned int unI = 0; unI < unCount; unI++) {
+    unsigned int unPosition = this->position(unFirst + unI);
+
+    vecTimes[unI] = m_vecTimes[unPosition];
+    vecValues[unI] = m_vecValues[unPosition];
+  }
+}
+
+unsigned int CTimeSeries::latest(unsigned int unCount, std::vector<double> &vecTimes, std::vector<double> &vecValues) {
+  unsigned int unSize = this->size();
+  unCount = std::min(unCount, unSize);
+
+  this->copyOut(unSize - unCount, unCount, vecTimes, vecValues);
+
+  return unCount;
+}
+
+unsigned int CTimeSeries::range(double dFrom, double dTo, std::vector<double> &vecTimes, std::vector<double> &vecValues) {
+  unsigned int unSize = this->size();
+
+  // Times are sorted by age: find the first sample at or after
+  // dFrom and the first one after dTo.
+  unsigned int unLow = 0, unHigh = unSize;
+  while(unLow < unHigh) {
+    unsigned int unMiddle = (unLow + unHigh) / 2;
+
+    if(m_vecTimes[this->position(unMiddle)] < dFrom) {
+      unLow = unMiddle + 1;
+    } else {
+      unHigh = unMiddle;
+    }
+  }
+
+  unsigned int unFirst = unLow;
+  unHigh = unSize;
+  while(unLow < unHigh) {
+    unsigned int unMiddle = (unLow + unHigh) / 2;
+
+    if(m_vecTimes[this->position(unMiddle)] <= dTo) {
+      unLow = unMiddle + 1;
+    } else {
+      unHigh = unMiddle;
+    }
+  }
+
+  unsigned int unCount = (dTo < dFrom ? 0 : unLow - unFirst);
+  this->copyOut(unFirst, unCount, vecTimes, vecValues);
+
+  return unCount;
+}
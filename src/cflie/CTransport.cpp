@@ -0,0 +1,530 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CTransport.h>
+
+
+CTransport::CTransport() {
+  m_bAckReceived = false;
+  m_ppPool = new CCRTPPacketPool();
+  m_ccLoggingConsumer = NULL;
+  m_ucLastStatus = 0;
+
+  static std::atomic<int> s_nNextSource(0);
+  m_nDiagnosticsSource = s_nNextSource++;
+  m_nConsoleLength = 0;
+
+  CMetrics *mtMetrics = CMetrics::instance();
+  for(int nPort = 0; nPort < 16; nPort++) {
+    std::stringstream sts;
+    sts << "port=\"" << nPort << "\"";
+
+    m_mcPacketsSent[nPort] = mtMetrics->counter("cflie_packets_sent_total", "CRTP frames sent to the copter", this->metricLabels(sts.str()));
+  }
+
+  m_mcSendRetries = mtMetrics->counter("cflie_send_receive_retries_total", "Resends and pings needed until the expected reply arrived", this->metricLabels());
+  m_mgLoggingQueueDepth = mtMetrics->gauge("cflie_logging_queue_depth", "Logging packets waiting to be picked up", this->metricLabels());
+  m_mcLoggingDropped[OVERFLOW_DROP_OLDEST] = mtMetrics->counter("cflie_logging_frames_dropped_total", "Logging frames dropped because the logging ring was full", this->metricLabels("dropped=\"oldest\""));
+  m_mcLoggingDropped[OVERFLOW_DROP_NEWEST] = mtMetrics->counter("cflie_logging_frames_dropped_total", "Logging frames dropped because the logging ring was full", this->metricLabels("dropped=\"newest\""));
+
+  m_lNextRequestID = 0;
+  m_nRequestTimeout = TRANSPORT_DEFAULT_REQUEST_TIMEOUT;
+  m_mcRequestsExpired = mtMetrics->counter("cflie_requests_expired_total", "Requests whose deadline passed without a reply", this->metricLabels());
+
+  m_nDrainBudget = 0;
+  m_mcDrainPings = mtMetrics->counter("cflie_drain_pings_total", "Pings sent to drain the copter's downlink queue", this->metricLabels());
+  for(int nPort = 0; nPort < 16; nPort++) {
+    m_ccPortConsumers[nPort] = NULL;
+  }
+}
+
+CTransport::~CTransport() {
+  for(std::list<struct PendingRequest>::iterator itRequest = m_lstPendingRequests.begin();
+      itRequest != m_lstPendingRequests.end();
+      itRequest++) {
+    if((*itRequest).crtpReply) {
+      delete (*itRequest).crtpReply;
+    }
+  }
+
+  m_ppPool->release();
+}
+
+CCRTPPacket *CTransport::sendPacket(CCRTPPacket *crtpSend, bool bDeleteAfterwards) {
+  char *cData = &m_cSendBuffer[TRANSPORT_HEADROOM];
+  int nLength = crtpSend->writeSendableData(cData);
+
+  if(bDeleteAfterwards) {
+    delete crtpSend;
+  }
+
+  return this->exchangeData(cData, nLength);
+}
+
+CCRTPPacket *CTransport::exchangeData(char *cData, int nLength) {
+  CCRTPView cvReply;
+
+  m_mcPacketsSent[((unsigned char)cData[0] >> 4) & 0x0f]->increment();
+
+  if(!this->transmitData(cData, nLength, cvReply)) {
+    return NULL;
+  }
+
+  CCRTPPacket *crtpPacket;
+
+  if(this->handleReply(cvReply)) {
+    // The frame was decoded already; only hand back where it came
+    // from.
+    crtpPacket = new(m_ppPool) CCRTPPacket(cvReply.port());
+    crtpPacket->setChannel(cvReply.channel());
+  } else {
+    crtpPacket = cvReply.copy(m_ppPool);
+  }
+
+  // The reply is dealt with; draining may reuse the receive buffer.
+  if(m_nDrainBudget > 0 && !cvReply.empty()) {
+    this->drainDownlink();
+  }
+
+  return crtpPacket;
+}
+
+void CTransport::drainDownlink() {
+  char *cData = &m_cSendBuffer[TRANSPORT_HEADROOM];
+
+  for(int nPing = 0; nPing < m_nDrainBudget; nPing++) {
+    CCRTPView cvReply;
+    cData[0] = 0xff;
+
+    m_mcPacketsSent[15]->increment();
+    m_mcDrainPings->increment();
+
+    if(!this->transmitData(cData, 1, cvReply) || cvReply.empty()) {
+      break;
+    }
+
+    this->handleReply(cvReply);
+  }
+}
+
+void CTransport::setDrainMode(bool bDrain, int nBudget) {
+  m_nDrainBudget = (bDrain ? std::max(0, nBudget) : 0);
+}
+
+bool CTransport::drainMode() {
+  return m_nDrainBudget > 0;
+}
+
+char *CTransport::beginPacket(int nPort, int nChannel) {
+  char *cData = &m_cSendBuffer[TRANSPORT_HEADROOM];
+  cData[0] = (nPort << 4) | 0b00001100 | (nChannel & 0x03);
+
+  return &cData[1];
+}
+
+CCRTPPacket *CTransport::commitPacket(int nLength) {
+  if(nLength > CRTP_MAX_DATA_LENGTH - 1) {
+    nLength = CRTP_MAX_DATA_LENGTH - 1;
+  }
+
+  return this->exchangeData(&m_cSendBuffer[TRANSPORT_HEADROOM], nLength + 1);
+}
+
+bool CTransport::handleReply(const CCRTPView &cvReply) {
+  if(cvReply.empty()) {
+    return false;
+  }
+
+  if(this->matchReply(cvReply)) {
+    return true;
+  }
+
+  switch(cvReply.port()) {
+  case 0: { // Console
+    this->appendConsoleText(cvReply.payload(), cvReply.payloadLength());
+  } break;
+
+  case 5: { // Logging
+    if(cvReply.channel() == 2) {
+      if(m_ccLoggingConsumer) {
+	m_ccLoggingConsumer->consumeFrame(cvReply);
+
+	return true;
+      }
+
+      switch(m_lfrLogging.push(cvReply)) {
+      case RING_DROPPED_OLDEST: {
+	m_mcLoggingDropped[OVERFLOW_DROP_OLDEST]->increment();
+      } break;
+
+      case RING_DROPPED_NEWEST: {
+	m_mcLoggingDropped[OVERFLOW_DROP_NEWEST]->increment();
+      } break;
+
+      default: {
+      } break;
+      }
+
+      m_mgLoggingQueueDepth->set(m_lfrLogging.size());
+    }
+  } break;
+
+  default: {
+    if(m_ccPortConsumers[cvReply.port()]) {
+      m_ccPortConsumers[cvReply.port()]->consumeFrame(cvReply);
+
+      return true;
+    }
+  } break;
+  }
+
+  return false;
+}
+
+bool CTransport::matchReply(const CCRTPView &cvReply) {
+  for(std::list<struct PendingRequest>::iterator itRequest = m_lstPendingRequests.begin();
+      itRequest != m_lstPendingRequests.end();
+      itRequest++) {
+    struct PendingRequest &prRequest = *itRequest;
+
+    if(prRequest.crtpReply == NULL && !prRequest.bExpired &&
+       prRequest.nPort == cvReply.port() &&
+       prRequest.nChannel == cvReply.channel() &&
+       cvReply.payloadLength() >= prRequest.nMatchLength &&
+       std::memcmp(cvReply.payload(), &prRequest.cFrame[1], prRequest.nMatchLength) == 0) {
+      prRequest.crtpReply = cvReply.copy(m_ppPool);
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+struct PendingRequest *CTransport::pendingRequest(long lID) {
+  for(std::list<struct PendingRequest>::iterator itRequest = m_lstPendingRequests.begin();
+      itRequest != m_lstPendingRequests.end();
+      itRequest++) {
+    if((*itRequest).lID == lID) {
+      return &(*itRequest);
+    }
+  }
+
+  return NULL;
+}
+
+long CTransport::submitRequest(CCRTPPacket *crtpRequest, int nMatchLength, int nRetries) {
+  return this->submitRequest(crtpRequest, crtpRequest->port(), crtpRequest->channel(), nMatchLength, nRetries);
+}
+
+long CTransport::submitRequest(CCRTPPacket *crtpRequest, int nPort, int nChannel, int nMatchLength, int nRetries, std::chrono::steady_clock::time_point tpDeadline) {
+  struct PendingRequest prRequest;
+  prRequest.lID = m_lNextRequestID++;
+  prRequest.nFrameLength = crtpRequest->writeSendableData(prRequest.cFrame);
+  prRequest.nPort = nPort;
+  prRequest.nChannel = nChannel;
+  prRequest.nMatchLength = std::max(0, std::min(nMatchLength, prRequest.nFrameLength - 1));
+  prRequest.nRetries = nRetries;
+  prRequest.nResendCounter = nRetries;
+  prRequest.crtpReply = NULL;
+  prRequest.tpDeadline = tpDeadline;
+  prRequest.bExpired = false;
+
+  m_lstPendingRequests.push_back(prRequest);
+
+  char *cData = &m_cSendBuffer[TRANSPORT_HEADROOM];
+  std::memcpy(cData, prRequest.cFrame, prRequest.nFrameLength);
+
+  CCRTPPacket *crtpReceived = this->exchangeData(cData, prRequest.nFrameLength);
+  if(crtpReceived) {
+    delete crtpReceived;
+  }
+
+  return prRequest.lID;
+}
+
+CRequestFuture CTransport::request(CCRTPPacket *crtpRequest, std::chrono::steady_clock::time_point tpDeadline, int nMatchLength, int nRetries) {
+  return this->request(crtpRequest, crtpRequest->port(), crtpRequest->channel(), tpDeadline, nMatchLength, nRetries);
+}
+
+CRequestFuture CTransport::request(CCRTPPacket *crtpRequest, int nPort, int nChannel, std::chrono::steady_clock::time_point tpDeadline, int nMatchLength, int nRetries) {
+  return CRequestFuture(this, this->submitRequest(crtpRequest, nPort, nChannel, nMatchLength, nRetries, tpDeadline));
+}
+
+bool CTransport::checkDeadline(struct PendingRequest &prRequest, std::chrono::steady_clock::time_point tpNow) {
+  if(!prRequest.bExpired && prRequest.crtpReply == NULL && tpNow >= prRequest.tpDeadline) {
+    prRequest.bExpired = true;
+    m_mcRequestsExpired->increment();
+  }
+
+  return prRequest.bExpired;
+}
+
+enum RequestState CTransport::requestState(long lID) {
+  struct PendingRequest *prRequest = this->pendingRequest(lID);
+
+  if(prRequest == NULL) {
+    return REQUEST_CANCELLED;
+  }
+
+  if(prRequest->crtpReply) {
+    return REQUEST_ANSWERED;
+  }
+
+  if(this->checkDeadline(*prRequest, std::chrono::steady_clock::now())) {
+    return REQUEST_EXPIRED;
+  }
+
+  return REQUEST_PENDING;
+}
+
+std::chrono::steady_clock::time_point CTransport::requestDeadline() {
+  if(m_nRequestTimeout > 0) {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(m_nRequestTimeout);
+  }
+
+  return std::chrono::steady_clock::time_point::max();
+}
+
+void CTransport::setRequestTimeout(int nMilliseconds) {
+  m_nRequestTimeout = nMilliseconds;
+}
+
+int CTransport::requestTimeout() {
+  return m_nRequestTimeout;
+}
+
+bool CTransport::pumpRequests() {
+  struct PendingRequest *prResend = NULL;
+  std::chrono::steady_clock::time_point tpNow = std::chrono::steady_clock::now();
+
+  for(std::list<struct PendingRequest>::iterator itRequest = m_lstPendingRequests.begin();
+      itRequest != m_lstPendingRequests.end();
+      itRequest++) {
+    struct PendingRequest &prRequest = *itRequest;
+
+    if(prRequest.crtpReply == NULL && !this->checkDeadline(prRequest, tpNow)) {
+      prRequest.nResendCounter--;
+
+      // Only one frame goes out per exchange; requests due at the
+      // same time are resent on the following ones.
+      if(prResend == NULL && prRequest.nResendCounter <= 0) {
+	prRequest.nResendCounter = prRequest.nRetries;
+	prResend = &prRequest;
+      }
+    }
+  }
+
+  char *cData = &m_cSendBuffer[TRANSPORT_HEADROOM];
+  int nLength = 1;
+
+  if(prResend) {
+    std::memcpy(cData, prResend->cFrame, prResend->nFrameLength);
+    nLength = prResend->nFrameLength;
+  } else {
+    cData[0] = 0xff;
+  }
+
+  m_mcSendRetries->increment();
+
+  CCRTPPacket *crtpReceived = this->exchangeData(cData, nLength);
+  if(crtpReceived) {
+    delete crtpReceived;
+
+    return true;
+  }
+
+  return false;
+}
+
+CCRTPPacket *CTransport::takeReply(long lID) {
+  for(std::list<struct PendingRequest>::iterator itRequest = m_lstPendingRequests.begin();
+      itRequest != m_lstPendingRequests.end();
+      itRequest++) {
+    if((*itRequest).lID == lID) {
+      CCRTPPacket *crtpReply = (*itRequest).crtpReply;
+
+      if(crtpReply) {
+	m_lstPendingRequests.erase(itRequest);
+      }
+
+      return crtpReply;
+    }
+  }
+
+  return NULL;
+}
+
+bool CTransport::requestAnswered(long lID) {
+  struct PendingRequest *prRequest = this->pendingRequest(lID);
+
+  return prRequest && prRequest->crtpReply;
+}
+
+void CTransport::cancelRequest(long lID) {
+  for(std::list<struct PendingRequest>::iterator itRequest = m_lstPendingRequests.begin();
+      itRequest != m_lstPendingRequests.end();
+      itRequest++) {
+    if((*itRequest).lID == lID) {
+      if((*itRequest).crtpReply) {
+	delete (*itRequest).crtpReply;
+      }
+
+      m_lstPendingRequests.erase(itRequest);
+      break;
+    }
+  }
+}
+
+int CTransport::pendingRequests() {
+  return m_lstPendingRequests.size();
+}
+
+void CTransport::setPortConsumer(int nPort, CCRTPConsumer *ccConsumer) {
+  m_ccPortConsumers[nPort & 0x0f] = ccConsumer;
+}
+
+void CTransport::appendConsoleText(const char *cText, int nLength) {
+  // The firmware sends console text in chunks that don't respect
+  // line breaks; only complete lines are posted.
+  for(int nI = 0; nI < nLength; nI++) {
+    if(cText[nI] != '\n') {
+      m_cConsoleLine[m_nConsoleLength++] = cText[nI];
+    }
+
+    if(cText[nI] == '\n' || m_nConsoleLength == DIAGNOSTICS_MESSAGE_LENGTH - 1) {
+      CDiagnostics::instance()->post(SEVERITY_CONSOLE, m_cConsoleLine, m_nConsoleLength, m_nDiagnosticsSource);
+      m_nConsoleLength = 0;
+    }
+  }
+}
+
+int CTransport::diagnosticsSource() {
+  return m_nDiagnosticsSource;
+}
+
+std::string CTransport::metricLabels(std::string strLabels) {
+  std::string strTransport = "transport=\"" + std::to_string(m_nDiagnosticsSource) + "\"";
+
+  return (strLabels.empty() ? strTransport : strTransport + "," + strLabels);
+}
+
+void CTransport::setLoggingConsumer(CCRTPConsumer *ccConsumer) {
+  m_ccLoggingConsumer = ccConsumer;
+}
+
+CCRTPConsumer *CTransport::loggingConsumer() {
+  return m_ccLoggingConsumer;
+}
+
+void CTransport::recordStatus(unsigned char ucStatus) {
+  m_ucLastStatus = ucStatus;
+  m_bAckReceived = ucStatus & 0x1;
+
+  m_lqLinkQuality.record(ucStatus);
+}
+
+struct LinkQuality CTransport::linkQuality() {
+  return m_lqLinkQuality.snapshot();
+}
+
+unsigned char CTransport::lastStatus() {
+  return m_ucLastStatus;
+}
+
+bool CTransport::ackReceived() {
+  return m_bAckReceived;
+}
+
+CCRTPPacket *CTransport::waitForPacket() {
+  bool bGoon = true;
+  CCRTPPacket *crtpReceived = NULL;
+  CCRTPPacket *crtpDummy = new(m_ppPool) CCRTPPacket(0);
+  crtpDummy->setIsPingPacket(true);
+  std::chrono::steady_clock::time_point tpDeadline = this->requestDeadline();
+
+  while(bGoon) {
+    crtpReceived = this->sendPacket(crtpDummy);
+    bGoon = (crtpReceived == NULL && std::chrono::steady_clock::now() < tpDeadline);
+  }
+
+  delete crtpDummy;
+  return crtpReceived;
+}
+
+CCRTPPacket *CTransport::sendAndReceive(CCRTPPacket *crtpSend, bool bDeleteAfterwards, int nMatchLength) {
+  return this->sendAndReceive(crtpSend, crtpSend->port(), crtpSend->channel(), bDeleteAfterwards, 10, 100, nMatchLength);
+}
+
+CCRTPPacket *CTransport::sendAndReceive(CCRTPPacket *crtpSend, int nPort, int nChannel, bool bDeleteAfterwards, int nRetries, int nMicrosecondsWait, int nMatchLength) {
+  CRequestFuture rfReply = this->request(crtpSend, nPort, nChannel, this->requestDeadline(), nMatchLength, nRetries);
+
+  if(bDeleteAfterwards) {
+    delete crtpSend;
+  }
+
+  if(rfReply.wait(nMicrosecondsWait) == REQUEST_EXPIRED) {
+    CDiagnostics::instance()->post(SEVERITY_WARNING, "No reply on port " + std::to_string(nPort) + ", channel " + std::to_string(nChannel) + " before the request timed out", m_nDiagnosticsSource);
+  }
+
+  return rfReply.reply();
+}
+
+unsigned int CTransport::drainLoggingFrames(CCRTPConsumer *ccConsumer) {
+  unsigned int unDrained = m_lfrLogging.drain(ccConsumer);
+  m_mgLoggingQueueDepth->set(m_lfrLogging.size());
+
+  return unDrained;
+}
+
+void CTransport::setLoggingOverflowPolicy(enum OverflowPolicy enumPolicy) {
+  m_lfrLogging.setOverflowPolicy(enumPolicy);
+}
+
+unsigned long CTransport::loggingFramesDropped() {
+  return m_lfrLogging.droppedOldest() + m_lfrLogging.droppedNewest();
+}
+
+bool CTransport::sendDummyPacket() {
+  CCRTPPacket *crtpReceived = NULL;
+  CCRTPPacket *crtpDummy = new(m_ppPool) CCRTPPacket(0);
+  crtpDummy->setIsPingPacket(true);
+
+  crtpReceived = this->sendPacket(crtpDummy, true);
+  if(crtpReceived) {
+    delete crtpReceived;
+    return true;
+  }
+
+  return false;
+}
+
+CCRTPPacketPool *CTransport::packetPool() {
+  return m_ppPool;
+}
@@ -0,0 +1,218 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <cflie/CUplinkScheduler.h>
+
+
+CUplinkScheduler::CUplinkScheduler(std::string strLabels) {
+  m_crtpSetpoint = NULL;
+  m_crtpRetried = NULL;
+  m_nRetries = 0;
+
+  m_crtpPing = new CCRTPPacket(0);
+  m_crtpPing->setIsPingPacket(true);
+
+  const char *cClasses[UPLINK_TRAFFIC_CLASSES] = {"emergency", "setpoint", "configuration", "keepalive"};
+  CMetrics *mtMetrics = CMetrics::instance();
+
+  for(int nClass = 0; nClass < UPLINK_TRAFFIC_CLASSES; nClass++) {
+    this->setRateLimit((enum TrafficClass)nClass, 0);
+    m_mcSent[nClass] = mtMetrics->counter("cflie_uplink_packets_total", "Packets sent by the uplink scheduler, per traffic class", (strLabels.empty() ? "" : strLabels + ",") + "class=\"" + cClasses[nClass] + "\"");
+  }
+
+  this->setRateLimit(TRAFFIC_KEEPALIVE, 1000);
+
+  m_mcSetpointsReplaced = mtMetrics->counter("cflie_setpoints_replaced_total", "Setpoints replaced by a newer one before they were sent", strLabels);
+  m_mcDropped = mtMetrics->counter("cflie_uplink_dropped_total", "Packets dropped because their uplink queue was full", strLabels);
+}
+
+CUplinkScheduler::~CUplinkScheduler() {
+  this->clear();
+
+  delete m_crtpPing;
+}
+
+void CUplinkScheduler::clear() {
+  CCRTPPacket *crtpPacket;
+
+  while(m_mpmcEmergency.pop(crtpPacket)) {
+    delete crtpPacket;
+  }
+
+  while(m_mpmcConfiguration.pop(crtpPacket)) {
+    delete crtpPacket;
+  }
+
+  crtpPacket = m_crtpSetpoint.exchange(NULL);
+  if(crtpPacket) {
+    delete crtpPacket;
+  }
+
+  if(m_crtpRetried) {
+    delete m_crtpRetried;
+    m_crtpRetried = NULL;
+  }
+
+  m_nRetries = 0;
+}
+
+void CUplinkScheduler::setRateLimit(enum TrafficClass enumClass, double dPacketsPerSecond, double dBurst) {
+  struct RateLimit &rlLimit = m_rlLimits[enumClass];
+
+  rlLimit.dRate = dPacketsPerSecond;
+  rlLimit.dBurst = std::max(1.0, dBurst);
+  rlLimit.dTokens = rlLimit.dBurst;
+  rlLimit.tpRefilled = std::chrono::steady_clock::now();
+}
+
+bool CUplinkScheduler::takeToken(enum TrafficClass enumClass, std::chrono::steady_clock::time_point tpNow) {
+  struct RateLimit &rlLimit = m_rlLimits[enumClass];
+
+  if(rlLimit.dRate <= 0) {
+    return true;
+  }
+
+  double dElapsed = std::chrono::duration<double>(tpNow - rlLimit.tpRefilled).count();
+  rlLimit.dTokens = std::min(rlLimit.dBurst, rlLimit.dTokens + dElapsed * rlLimit.dRate);
+  rlLimit.tpRefilled = tpNow;
+
+  if(rlLimit.dTokens >= 1) {
+    rlLimit.dTokens -= 1;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool CUplinkScheduler::submit(CCRTPPacket *crtpSend, enum TrafficClass enumClass) {
+  bool bQueued = false;
+
+  switch(enumClass) {
+  case TRAFFIC_EMERGENCY: {
+    bQueued = m_mpmcEmergency.push(crtpSend);
+  } break;
+
+  case TRAFFIC_SETPOINT: {
+    CCRTPPacket *crtpStale = m_crtpSetpoint.exchange(crtpSend);
+
+    if(crtpStale) {
+      delete crtpStale;
+      m_mcSetpointsReplaced->increment();
+    }
+
+    bQueued = true;
+  } break;
+
+  case TRAFFIC_CONFIGURATION: {
+    bQueued = m_mpmcConfiguration.push(crtpSend);
+  } break;
+
+  default: {
+  } break;
+  }
+
+  if(!bQueued) {
+    delete crtpSend;
+    m_mcDropped->increment();
+  }
+
+  return bQueued;
+}
+
+bool CUplinkScheduler::next(CCRTPPacket *&crtpSend, enum TrafficClass &enumClass) {
+  std::chrono::steady_clock::time_point tpNow = std::chrono::steady_clock::now();
+
+  // Tokens are only taken once a class actually has something to
+  // send.
+  if(!m_mpmcEmergency.empty() && this->takeToken(TRAFFIC_EMERGENCY, tpNow)) {
+    if(m_mpmcEmergency.pop(crtpSend)) {
+      enumClass = TRAFFIC_EMERGENCY;
+      return true;
+    }
+  }
+
+  if((m_crtpSetpoint.load() || m_crtpRetried) && this->takeToken(TRAFFIC_SETPOINT, tpNow)) {
+    crtpSend = m_crtpSetpoint.exchange(NULL);
+
+    if(crtpSend) {
+      // A newer setpoint supersedes the one being retried.
+      if(m_crtpRetried) {
+	delete m_crtpRetried;
+	m_crtpRetried = NULL;
+	m_mcSetpointsReplaced->increment();
+      }
+
+      m_nRetries = 0;
+    } else {
+      crtpSend = m_crtpRetried;
+      m_crtpRetried = NULL;
+    }
+
+    if(crtpSend) {
+      enumClass = TRAFFIC_SETPOINT;
+      return true;
+    }
+  }
+
+  if(!m_mpmcConfiguration.empty() && this->takeToken(TRAFFIC_CONFIGURATION, tpNow)) {
+    if(m_mpmcConfiguration.pop(crtpSend)) {
+      enumClass = TRAFFIC_CONFIGURATION;
+      return true;
+    }
+  }
+
+  if(this->takeToken(TRAFFIC_KEEPALIVE, tpNow)) {
+    crtpSend = m_crtpPing;
+    enumClass = TRAFFIC_KEEPALIVE;
+    return true;
+  }
+
+  return false;
+}
+
+void CUplinkScheduler::completed(CCRTPPacket *crtpSend, enum TrafficClass enumClass, bool bAcknowledged) {
+  m_mcSent[enumClass]->increment();
+
+  if(enumClass == TRAFFIC_KEEPALIVE) {
+    return;
+  }
+
+  // Kept by the sending thread rather than put back into the
+  // mailbox, so the retry count can't carry over to a newer setpoint
+  // (see next()).
+  if(enumClass == TRAFFIC_SETPOINT && !bAcknowledged && m_nRetries < UPLINK_SETPOINT_RETRIES) {
+    m_crtpRetried = crtpSend;
+    m_nRetries++;
+
+    return;
+  }
+
+  delete crtpSend;
+}
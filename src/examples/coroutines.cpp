@@ -0,0 +1,107 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+/* \author Jan Winkler */
+
+
+// System
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+
+// libcflie
+#include <cflie/CCrazyflie.h>
+#include <cflie/CSimulatedCopter.h>
+#include <cflie/CEventLoop.h>
+
+
+// Brings up a copter: reads both TOCs and sets up a logging block,
+// awaiting every reply instead of blocking on it.
+CTask<bool> setUpCopter(CEventLoop &elLoop, CTOC *tocParameters, CTOC *tocLogs) {
+  bool bOK = co_await requestMetaData(elLoop, tocParameters);
+  bOK = bOK && co_await requestItems(elLoop, tocParameters);
+  bOK = bOK && co_await requestMetaData(elLoop, tocLogs);
+  bOK = bOK && co_await requestItems(elLoop, tocLogs);
+  bOK = bOK && co_await registerLoggingBlock(elLoop, tocLogs, "stabilizer", 1000);
+  bOK = bOK && co_await startLogging(elLoop, tocLogs, "stabilizer.roll", "stabilizer");
+  bOK = bOK && co_await startLogging(elLoop, tocLogs, "stabilizer.pitch", "stabilizer");
+
+  co_return bOK;
+}
+
+int main(int argc, char **argv) {
+  // Usage: ex-coroutines [copters] [latency in us]
+  int nCopters = (argc > 1 ? std::atoi(argv[1]) : 24);
+  int nLatency = (argc > 2 ? std::atoi(argv[2]) : 200);
+
+  std::vector<CSimulatedCopter*> vecCopters;
+  std::vector<CTOC*> vecTOCs;
+  std::vector<CTask<bool>*> vecSetups;
+  CEventLoop elLoop(0);
+
+  CDiagnostics::instance()->setMinSeverity(SEVERITY_WARNING);
+  std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+
+  // All setup sequences run side by side on this thread.
+  for(int nI = 0; nI < nCopters; nI++) {
+    CSimulatedCopter *scCopter = new CSimulatedCopter();
+    scCopter->setLatency(nLatency);
+
+    CTOC *tocParameters = new CTOC(scCopter, 2);
+    CTOC *tocLogs = new CTOC(scCopter, 5);
+
+    vecCopters.push_back(scCopter);
+    vecTOCs.push_back(tocParameters);
+    vecTOCs.push_back(tocLogs);
+    vecSetups.push_back(elLoop.spawn(setUpCopter(elLoop, tocParameters, tocLogs)));
+  }
+
+  elLoop.run();
+
+  int nSetUp = 0;
+  for(int nI = 0; nI < nCopters; nI++) {
+    if(vecSetups[nI]->done() && vecSetups[nI]->result()) {
+      nSetUp++;
+    }
+  }
+
+  std::cout << nSetUp << " of " << nCopters << " copters set up in "
+	    << std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count() * 1000
+	    << " ms" << std::endl;
+
+  for(int nI = 0; nI < (int)vecTOCs.size(); nI++) {
+    delete vecTOCs[nI];
+  }
+
+  for(int nI = 0; nI < nCopters; nI++) {
+    delete vecCopters[nI];
+  }
+
+  return 0;
+}
@@ -80,6 +80,10 @@ int main(int argc, char **argv) {
     cflieCopter->setSendSetpoints(true);
     cflieCopter->setThrust(0);
 
+    // Rendering may take a while; let a dedicated thread keep the
+    // radio link alive in the meantime.
+    cflieCopter->setThreadedIO(true);
+
     if(glfwInit() == GL_TRUE) {
       g_bGoon = true;
 
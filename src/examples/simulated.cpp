@@ -0,0 +1,122 @@
+// Copyright (c) 2013, Jan Winkler <winkler@cs.uni-bremen.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Universität Bremen nor the names of its
+//       contributors may be used to endorse or promote products derived from
+//       this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+/* \author Jan Winkler */
+
+
+// System
+#include <iostream>
+#include <cstdlib>
+
+// libcflie
+#include <cflie/CCrazyflie.h>
+#include <cflie/CSimulatedCopter.h>
+
+
+double currentTime() {
+  struct timespec tsTime;
+  clock_gettime(CLOCK_MONOTONIC, &tsTime);
+
+  return tsTime.tv_sec + double(tsTime.tv_nsec) / NSEC_PER_SEC;
+}
+
+int main(int argc, char **argv) {
+  // Usage: ex-simulated [latency in us] [loss rate] [seconds] [drain budget] [stream Hz] [TOC cache dir]
+  int nLatency = (argc > 1 ? std::atoi(argv[1]) : 0);
+  double dLossRate = (argc > 2 ? std::atof(argv[2]) : 0.0);
+  double dDuration = (argc > 3 ? std::atof(argv[3]) : 5.0);
+  int nDrainBudget = (argc > 4 ? std::atoi(argv[4]) : 0);
+  double dStreamFrequency = (argc > 5 ? std::atof(argv[5]) : 0.0);
+  std::string strCacheDirectory = (argc > 6 ? argv[6] : "");
+
+  // No dongle needed: the copter is simulated in-process.
+  CSimulatedCopter *scCopter = new CSimulatedCopter();
+  scCopter->setLatency(nLatency);
+  scCopter->setLossRate(dLossRate);
+  scCopter->setDrainMode(nDrainBudget > 0, nDrainBudget);
+
+  CCrazyflie *cflieCopter = new CCrazyflie(scCopter);
+  cflieCopter->setSendSetpoints(true);
+  cflieCopter->setThrust(10001);
+  cflieCopter->setRoll(10);
+
+  if(dStreamFrequency > 0) {
+    cflieCopter->setSetpointStreaming(true, dStreamFrequency);
+  }
+
+  // A second run with the same directory skips the TOC downloads.
+  cflieCopter->setTOCCacheDirectory(strCacheDirectory);
+
+  double dStart = currentTime();
+  while(!cflieCopter->isInitialized()) {
+    cflieCopter->cycle();
+  }
+
+  double dConnected = currentTime();
+  std::cout << "Connected after " << (dConnected - dStart) * 1000 << " ms ("
+	    << scCopter->packetsReceived() << " packets)" << std::endl;
+
+  // Record every roll sample, not only the latest one
+  cflieCopter->setSensorHistory("stabilizer.roll", 1024);
+
+  unsigned long ulCycles = 0;
+  unsigned long ulPacketsBefore = scCopter->packetsReceived();
+
+  while(currentTime() - dConnected < dDuration) {
+    cflieCopter->cycle();
+    ulCycles++;
+  }
+
+  double dElapsed = currentTime() - dConnected;
+  std::cout << "Cycles per second:  " << ulCycles / dElapsed << std::endl;
+  std::cout << "Packets per second: " << (scCopter->packetsReceived() - ulPacketsBefore) / dElapsed << std::endl;
+  std::cout << "Packets lost:       " << scCopter->packetsLost() << std::endl;
+  std::cout << "Downlink overflows: " << scCopter->downlinkOverflows() << std::endl;
+  std::cout << "Pooled packets:     " << scCopter->packetPool()->blocksAllocated() << std::endl;
+  std::cout << "ACK rate:           " << cflieCopter->linkQuality().dAckRate << std::endl;
+  std::cout << "Roll reported:      " << cflieCopter->roll() << std::endl;
+
+  std::vector<double> vecTimes, vecValues;
+  CTimeSeries *tsRoll = cflieCopter->sensorHistory("stabilizer.roll");
+  tsRoll->range(currentTime() - 1, currentTime(), vecTimes, vecValues);
+  std::cout << "Roll samples:       " << tsRoll->samplesAppended() << " (" << vecTimes.size() << " in the last second)" << std::endl;
+  std::cout << "Battery reported:   " << cflieCopter->batteryLevel() << std::endl;
+
+  if(dStreamFrequency > 0) {
+    struct StreamStatistics ssStream = cflieCopter->setpointStreamStatistics();
+    std::cout << "Setpoint periods:   " << ssStream.ulPeriods << " (" << ssStream.ulOverruns << " overruns)" << std::endl;
+    std::cout << "Setpoint jitter:    " << ssStream.dMeanJitter * 1e6 << " us mean, "
+	      << ssStream.dMaxJitter * 1e6 << " us max" << std::endl;
+  }
+
+  delete cflieCopter;
+  delete scCopter;
+
+  return 0;
+}